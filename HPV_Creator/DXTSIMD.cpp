@@ -0,0 +1,408 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstddef>
+
+#include "DXTSIMD.h"
+#include "stb_dxt.h"
+
+#if defined(HPV_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+namespace HPV {
+
+    static void stb_compress(unsigned char * dst, const unsigned char * src, int width, int height, int isDxt5)
+    {
+        rygCompress(dst, const_cast<unsigned char *>(src), width, height, isDxt5);
+    }
+
+#if defined(HPV_ARCH_X86)
+    /* stb__OMatch5/6: best 565 endpoint pair for a single colour, built the way stb_dxt builds its own */
+    struct HPVDXTTables
+    {
+        HPVDXTTables()
+        {
+            unsigned char expand5[32];
+            unsigned char expand6[64];
+
+            for (int i = 0; i < 32; ++i)
+                expand5[i] = static_cast<unsigned char>((i << 3) | (i >> 2));
+            for (int i = 0; i < 64; ++i)
+                expand6[i] = static_cast<unsigned char>((i << 2) | (i >> 4));
+
+            prepare(omatch5, expand5, 32);
+            prepare(omatch6, expand6, 64);
+        }
+
+        static void prepare(unsigned char table[256][2], const unsigned char * expand, int size)
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                int best_err = 256;
+                for (int mn = 0; mn < size; ++mn)
+                {
+                    for (int mx = 0; mx < size; ++mx)
+                    {
+                        int mine = expand[mn];
+                        int maxe = expand[mx];
+                        int err = abs((2 * maxe + mine) / 3 - i) + abs(maxe - mine) * 3 / 100;
+
+                        if (err < best_err)
+                        {
+                            table[i][0] = static_cast<unsigned char>(mx);
+                            table[i][1] = static_cast<unsigned char>(mn);
+                            best_err = err;
+                        }
+                    }
+                }
+            }
+        }
+
+        unsigned char omatch5[256][2];
+        unsigned char omatch6[256][2];
+    };
+
+    static const HPVDXTTables& dxt_tables()
+    {
+        static const HPVDXTTables tables;
+        return tables;
+    }
+
+    static inline void put_le(unsigned char * dst, uint32_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+            dst[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    static void compress_single_block(unsigned char * dst, const unsigned char * src, std::size_t stride, int isDxt5)
+    {
+        unsigned char block[64];
+        for (int y = 0; y < 4; ++y)
+            memcpy(block + y * 16, src + y * stride, 16);
+
+        stb_compress_dxt_block(dst, block, isDxt5, STB_DXT_HIGHQUAL);
+    }
+
+    /* 4 blocks per __m128i */
+    namespace dxt_sse41 {
+
+#define HPV_DXT_TARGET HPV_TARGET("sse4.1")
+
+        typedef __m128i vi;
+        typedef __m128 vf;
+        enum { LANES = 4 };
+
+        HPV_DXT_TARGET static inline vi vset(int a) { return _mm_set1_epi32(a); }
+        HPV_DXT_TARGET static inline vi vadd(vi a, vi b) { return _mm_add_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vsub(vi a, vi b) { return _mm_sub_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vmul(vi a, vi b) { return _mm_mullo_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vand(vi a, vi b) { return _mm_and_si128(a, b); }
+        HPV_DXT_TARGET static inline vi vandnot(vi a, vi b) { return _mm_andnot_si128(a, b); }
+        HPV_DXT_TARGET static inline vi vor(vi a, vi b) { return _mm_or_si128(a, b); }
+        HPV_DXT_TARGET static inline vi vxor(vi a, vi b) { return _mm_xor_si128(a, b); }
+        HPV_DXT_TARGET static inline vi vsll(vi a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vsrl(vi a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vsra(vi a, int n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vmin(vi a, vi b) { return _mm_min_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vmax(vi a, vi b) { return _mm_max_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vcmpgt(vi a, vi b) { return _mm_cmpgt_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vcmpeq(vi a, vi b) { return _mm_cmpeq_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vblend(vi a, vi b, vi m) { return _mm_blendv_epi8(a, b, m); }
+        HPV_DXT_TARGET static inline bool vany(vi m) { return _mm_movemask_epi8(m) != 0; }
+        HPV_DXT_TARGET static inline vi vload(const int32_t * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+        HPV_DXT_TARGET static inline void vstore(int32_t * p, vi a) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), a); }
+
+        HPV_DXT_TARGET static inline vf vfset(float a) { return _mm_set1_ps(a); }
+        HPV_DXT_TARGET static inline vf vcvt(vi a) { return _mm_cvtepi32_ps(a); }
+        HPV_DXT_TARGET static inline vi vcvtt(vf a) { return _mm_cvttps_epi32(a); }
+        HPV_DXT_TARGET static inline vf vfadd(vf a, vf b) { return _mm_add_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfmul(vf a, vf b) { return _mm_mul_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfdiv(vf a, vf b) { return _mm_div_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfmax(vf a, vf b) { return _mm_max_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfabs(vf a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+        HPV_DXT_TARGET static inline vi vfcmplt(vf a, vf b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+
+        /* (int)(x * (512.0 / magn)) in double */
+        HPV_DXT_TARGET static inline vi vscale_trunc(vf x, vf magn)
+        {
+            const __m128d scale = _mm_set1_pd(512.0);
+            __m128i lo = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(x), _mm_div_pd(scale, _mm_cvtps_pd(magn))));
+            __m128i hi = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)),
+                                                     _mm_div_pd(scale, _mm_cvtps_pd(_mm_movehl_ps(magn, magn)))));
+            return _mm_unpacklo_epi64(lo, hi);
+        }
+
+        /* px[y * 4 + x] is pixel (x, y) of the 4 blocks; the rows of the blocks are transposed 4x4 */
+        HPV_DXT_TARGET static inline void vload_blocks(const unsigned char * row, std::size_t stride, vi px[16])
+        {
+            for (int y = 0; y < 4; ++y, row += stride)
+            {
+                const __m128i * p = reinterpret_cast<const __m128i *>(row);
+                __m128i t0 = _mm_unpacklo_epi32(_mm_loadu_si128(p + 0), _mm_loadu_si128(p + 1));
+                __m128i t1 = _mm_unpacklo_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+                __m128i t2 = _mm_unpackhi_epi32(_mm_loadu_si128(p + 0), _mm_loadu_si128(p + 1));
+                __m128i t3 = _mm_unpackhi_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3));
+
+                px[y * 4 + 0] = _mm_unpacklo_epi64(t0, t1);
+                px[y * 4 + 1] = _mm_unpackhi_epi64(t0, t1);
+                px[y * 4 + 2] = _mm_unpacklo_epi64(t2, t3);
+                px[y * 4 + 3] = _mm_unpackhi_epi64(t2, t3);
+            }
+        }
+
+#include "DXTSIMDBlock.inl"
+
+#undef HPV_DXT_TARGET
+
+    } /* namespace dxt_sse41 */
+
+    /* 8 blocks per __m256i, blocks 0-3 in the low half and 4-7 in the high half */
+    namespace dxt_avx2 {
+
+#define HPV_DXT_TARGET HPV_TARGET("avx2")
+
+        typedef __m256i vi;
+        typedef __m256 vf;
+        enum { LANES = 8 };
+
+        HPV_DXT_TARGET static inline vi vset(int a) { return _mm256_set1_epi32(a); }
+        HPV_DXT_TARGET static inline vi vadd(vi a, vi b) { return _mm256_add_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vsub(vi a, vi b) { return _mm256_sub_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vmul(vi a, vi b) { return _mm256_mullo_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vand(vi a, vi b) { return _mm256_and_si256(a, b); }
+        HPV_DXT_TARGET static inline vi vandnot(vi a, vi b) { return _mm256_andnot_si256(a, b); }
+        HPV_DXT_TARGET static inline vi vor(vi a, vi b) { return _mm256_or_si256(a, b); }
+        HPV_DXT_TARGET static inline vi vxor(vi a, vi b) { return _mm256_xor_si256(a, b); }
+        HPV_DXT_TARGET static inline vi vsll(vi a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vsrl(vi a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vsra(vi a, int n) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vmin(vi a, vi b) { return _mm256_min_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vmax(vi a, vi b) { return _mm256_max_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vcmpgt(vi a, vi b) { return _mm256_cmpgt_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vcmpeq(vi a, vi b) { return _mm256_cmpeq_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vblend(vi a, vi b, vi m) { return _mm256_blendv_epi8(a, b, m); }
+        HPV_DXT_TARGET static inline bool vany(vi m) { return _mm256_movemask_epi8(m) != 0; }
+        HPV_DXT_TARGET static inline vi vload(const int32_t * p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+        HPV_DXT_TARGET static inline void vstore(int32_t * p, vi a) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), a); }
+
+        HPV_DXT_TARGET static inline vf vfset(float a) { return _mm256_set1_ps(a); }
+        HPV_DXT_TARGET static inline vf vcvt(vi a) { return _mm256_cvtepi32_ps(a); }
+        HPV_DXT_TARGET static inline vi vcvtt(vf a) { return _mm256_cvttps_epi32(a); }
+        HPV_DXT_TARGET static inline vf vfadd(vf a, vf b) { return _mm256_add_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfmul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfdiv(vf a, vf b) { return _mm256_div_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfmax(vf a, vf b) { return _mm256_max_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfabs(vf a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+        HPV_DXT_TARGET static inline vi vfcmplt(vf a, vf b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+
+        /* (int)(x * (512.0 / magn)) in double */
+        HPV_DXT_TARGET static inline vi vscale_trunc(vf x, vf magn)
+        {
+            const __m256d scale = _mm256_set1_pd(512.0);
+            __m128i lo = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)),
+                                                           _mm256_div_pd(scale, _mm256_cvtps_pd(_mm256_castps256_ps128(magn)))));
+            __m128i hi = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)),
+                                                           _mm256_div_pd(scale, _mm256_cvtps_pd(_mm256_extractf128_ps(magn, 1)))));
+            return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        }
+
+        /* Rows of blocks k and k + 4 share a register, then the same 4x4 transpose as SSE4.1 in each half */
+        HPV_DXT_TARGET static inline vi load_pair(const __m128i * p, int k)
+        {
+            return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(p + k)), _mm_loadu_si128(p + k + 4), 1);
+        }
+
+        HPV_DXT_TARGET static inline void vload_blocks(const unsigned char * row, std::size_t stride, vi px[16])
+        {
+            for (int y = 0; y < 4; ++y, row += stride)
+            {
+                const __m128i * p = reinterpret_cast<const __m128i *>(row);
+                __m256i b0 = load_pair(p, 0);
+                __m256i b1 = load_pair(p, 1);
+                __m256i b2 = load_pair(p, 2);
+                __m256i b3 = load_pair(p, 3);
+                __m256i t0 = _mm256_unpacklo_epi32(b0, b1);
+                __m256i t1 = _mm256_unpacklo_epi32(b2, b3);
+                __m256i t2 = _mm256_unpackhi_epi32(b0, b1);
+                __m256i t3 = _mm256_unpackhi_epi32(b2, b3);
+
+                px[y * 4 + 0] = _mm256_unpacklo_epi64(t0, t1);
+                px[y * 4 + 1] = _mm256_unpackhi_epi64(t0, t1);
+                px[y * 4 + 2] = _mm256_unpacklo_epi64(t2, t3);
+                px[y * 4 + 3] = _mm256_unpackhi_epi64(t2, t3);
+            }
+        }
+
+#include "DXTSIMDBlock.inl"
+
+#undef HPV_DXT_TARGET
+
+    } /* namespace dxt_avx2 */
+
+    /*
+     *  16 blocks per __m512i, block k in 128-bit lane k % 4. Compares give k-masks, turned back into
+     *  vectors so the shared code sees the same masks as on AVX2. The float math goes through the
+     *  _round forms, which the compiler leaves alone instead of fusing a multiply and add into an
+     *  FMA that would round differently from stb.
+     *
+     *  GCC's avx512fintrin.h builds the masked-off lanes of those intrinsics from an undefined
+     *  vector, and -Wall reports every inlined use of it as uninitialized.
+     */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+    namespace dxt_avx512 {
+
+#define HPV_DXT_TARGET HPV_TARGET("avx512f")
+
+        typedef __m512i vi;
+        typedef __m512 vf;
+        enum { LANES = 16 };
+
+        HPV_DXT_TARGET static inline vi from_mask(__mmask16 m) { return _mm512_maskz_set1_epi32(m, -1); }
+        HPV_DXT_TARGET static inline __mmask16 to_mask(vi m) { return _mm512_test_epi32_mask(m, m); }
+
+        HPV_DXT_TARGET static inline vi vset(int a) { return _mm512_set1_epi32(a); }
+        HPV_DXT_TARGET static inline vi vadd(vi a, vi b) { return _mm512_add_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vsub(vi a, vi b) { return _mm512_sub_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vmul(vi a, vi b) { return _mm512_mullo_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vand(vi a, vi b) { return _mm512_and_si512(a, b); }
+        HPV_DXT_TARGET static inline vi vandnot(vi a, vi b) { return _mm512_andnot_si512(a, b); }
+        HPV_DXT_TARGET static inline vi vor(vi a, vi b) { return _mm512_or_si512(a, b); }
+        HPV_DXT_TARGET static inline vi vxor(vi a, vi b) { return _mm512_xor_si512(a, b); }
+        HPV_DXT_TARGET static inline vi vsll(vi a, int n) { return _mm512_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vsrl(vi a, int n) { return _mm512_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vsra(vi a, int n) { return _mm512_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+        HPV_DXT_TARGET static inline vi vmin(vi a, vi b) { return _mm512_min_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vmax(vi a, vi b) { return _mm512_max_epi32(a, b); }
+        HPV_DXT_TARGET static inline vi vcmpgt(vi a, vi b) { return from_mask(_mm512_cmpgt_epi32_mask(a, b)); }
+        HPV_DXT_TARGET static inline vi vcmpeq(vi a, vi b) { return from_mask(_mm512_cmpeq_epi32_mask(a, b)); }
+        HPV_DXT_TARGET static inline vi vblend(vi a, vi b, vi m) { return _mm512_mask_blend_epi32(to_mask(m), a, b); }
+        HPV_DXT_TARGET static inline bool vany(vi m) { return to_mask(m) != 0; }
+        HPV_DXT_TARGET static inline vi vload(const int32_t * p) { return _mm512_loadu_si512(p); }
+        HPV_DXT_TARGET static inline void vstore(int32_t * p, vi a) { _mm512_storeu_si512(p, a); }
+
+        HPV_DXT_TARGET static inline vf vfset(float a) { return _mm512_set1_ps(a); }
+        HPV_DXT_TARGET static inline vf vcvt(vi a) { return _mm512_cvtepi32_ps(a); }
+        HPV_DXT_TARGET static inline vi vcvtt(vf a) { return _mm512_cvttps_epi32(a); }
+        HPV_DXT_TARGET static inline vf vfadd(vf a, vf b) { return _mm512_add_round_ps(a, b, _MM_FROUND_CUR_DIRECTION); }
+        HPV_DXT_TARGET static inline vf vfmul(vf a, vf b) { return _mm512_mul_round_ps(a, b, _MM_FROUND_CUR_DIRECTION); }
+        HPV_DXT_TARGET static inline vf vfdiv(vf a, vf b) { return _mm512_div_round_ps(a, b, _MM_FROUND_CUR_DIRECTION); }
+        HPV_DXT_TARGET static inline vf vfmax(vf a, vf b) { return _mm512_max_ps(a, b); }
+        HPV_DXT_TARGET static inline vf vfabs(vf a) { return _mm512_abs_ps(a); }
+        HPV_DXT_TARGET static inline vi vfcmplt(vf a, vf b) { return from_mask(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)); }
+
+        /* (int)(x * (512.0 / magn)) in double */
+        HPV_DXT_TARGET static inline __m256i scale_trunc_half(__m256 x, __m256 magn)
+        {
+            __m512d scale = _mm512_div_round_pd(_mm512_set1_pd(512.0), _mm512_cvtps_pd(magn), _MM_FROUND_CUR_DIRECTION);
+            return _mm512_cvttpd_epi32(_mm512_mul_round_pd(_mm512_cvtps_pd(x), scale, _MM_FROUND_CUR_DIRECTION));
+        }
+
+        HPV_DXT_TARGET static inline __m256 high_half(vf a)
+        {
+            return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1));
+        }
+
+        HPV_DXT_TARGET static inline vi vscale_trunc(vf x, vf magn)
+        {
+            __m256i lo = scale_trunc_half(_mm512_castps512_ps256(x), _mm512_castps512_ps256(magn));
+            __m256i hi = scale_trunc_half(high_half(x), high_half(magn));
+            return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+        }
+
+        /* Rows of blocks k, k + 4, k + 8 and k + 12 share a register, then a 4x4 transpose in each lane */
+        HPV_DXT_TARGET static inline vi load_quad(const __m128i * p, int k)
+        {
+            __m512i v = _mm512_castsi128_si512(_mm_loadu_si128(p + k));
+            v = _mm512_inserti32x4(v, _mm_loadu_si128(p + k + 4), 1);
+            v = _mm512_inserti32x4(v, _mm_loadu_si128(p + k + 8), 2);
+            return _mm512_inserti32x4(v, _mm_loadu_si128(p + k + 12), 3);
+        }
+
+        HPV_DXT_TARGET static inline void vload_blocks(const unsigned char * row, std::size_t stride, vi px[16])
+        {
+            for (int y = 0; y < 4; ++y, row += stride)
+            {
+                const __m128i * p = reinterpret_cast<const __m128i *>(row);
+                __m512i b0 = load_quad(p, 0);
+                __m512i b1 = load_quad(p, 1);
+                __m512i b2 = load_quad(p, 2);
+                __m512i b3 = load_quad(p, 3);
+                __m512i t0 = _mm512_unpacklo_epi32(b0, b1);
+                __m512i t1 = _mm512_unpacklo_epi32(b2, b3);
+                __m512i t2 = _mm512_unpackhi_epi32(b0, b1);
+                __m512i t3 = _mm512_unpackhi_epi32(b2, b3);
+
+                px[y * 4 + 0] = _mm512_unpacklo_epi64(t0, t1);
+                px[y * 4 + 1] = _mm512_unpackhi_epi64(t0, t1);
+                px[y * 4 + 2] = _mm512_unpacklo_epi64(t2, t3);
+                px[y * 4 + 3] = _mm512_unpackhi_epi64(t2, t3);
+            }
+        }
+
+#include "DXTSIMDBlock.inl"
+
+#undef HPV_DXT_TARGET
+
+    } /* namespace dxt_avx512 */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+    std::vector<HPVDXTKernel> hpv_dxt_kernels()
+    {
+        std::vector<HPVDXTKernel> kernels;
+
+        HPVDXTKernel stb = { HPV_SIMD_SCALAR, stb_compress };
+        kernels.push_back(stb);
+
+#if defined(HPV_ARCH_X86)
+        if (hpv_simd_supported(HPV_SIMD_SSE41))
+        {
+            HPVDXTKernel sse41 = { HPV_SIMD_SSE41, dxt_sse41::compress };
+            kernels.push_back(sse41);
+        }
+        if (hpv_simd_supported(HPV_SIMD_AVX2))
+        {
+            HPVDXTKernel avx2 = { HPV_SIMD_AVX2, dxt_avx2::compress };
+            kernels.push_back(avx2);
+        }
+        if (hpv_simd_supported(HPV_SIMD_AVX512))
+        {
+            HPVDXTKernel avx512 = { HPV_SIMD_AVX512, dxt_avx512::compress };
+            kernels.push_back(avx512);
+        }
+#endif
+
+        return kernels;
+    }
+
+    HPVDXTFunc hpv_dxt_kernel(int level)
+    {
+        std::vector<HPVDXTKernel> kernels = hpv_dxt_kernels();
+        if (level < 0)
+            return kernels.back().compress;
+
+        for (std::size_t i = 0; i < kernels.size(); ++i)
+        {
+            if (kernels[i].level == level)
+                return kernels[i].compress;
+        }
+        return nullptr;
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,40 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef DXT_SIMD_h
+#define DXT_SIMD_h
+
+#include <vector>
+
+#include "HPVSimd.hpp"
+
+namespace HPV {
+
+    /* Same arguments as rygCompress(): RGBA pixels in, DXT1 or DXT5 blocks out, both sides a multiple of 4 */
+    typedef void (*HPVDXTFunc)(unsigned char * dst, const unsigned char * src, int width, int height, int isDxt5);
+
+    /*
+     *  DXT1/DXT5 compressor for one instruction set. HPV_SIMD_SCALAR is the stb reference, the
+     *  others run its high quality mode on 4 (SSE4.1), 8 (AVX2) or 16 (AVX-512) blocks at once,
+     *  with the same integer and float steps, and give the same blocks.
+     */
+    struct HPVDXTKernel
+    {
+        HPVSimdLevel level;
+        HPVDXTFunc compress;
+    };
+
+    /* Every compressor in this build the CPU runs, stb first, fastest last */
+    std::vector<HPVDXTKernel> hpv_dxt_kernels();
+
+    /* The compressor of a level, -1 for the fastest; nullptr when this build or CPU doesn't have it */
+    HPVDXTFunc hpv_dxt_kernel(int level);
+
+} /* namespace HPV */
+
+#endif
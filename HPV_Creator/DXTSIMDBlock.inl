@@ -0,0 +1,451 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+
+/*
+ *  The stb_dxt high quality block compressor on LANES blocks at once, one block per 32-bit lane.
+ *  DXTSIMD.cpp includes this once per instruction set, inside its own namespace, after defining
+ *  HPV_DXT_TARGET, LANES, the vi (int32) and vf (float) vector types and the v* helpers on them.
+ *  Masks are vi lanes of all ones or all zeros.
+ *
+ *  Every step is the one in stb_dxt.h with its branches turned into selects, in the same order of
+ *  float operations, so the blocks match the stb ones bit for bit.
+ */
+
+/* stb__Mul8Bit */
+HPV_DXT_TARGET
+static inline vi mul8bit(vi a, int b)
+{
+    vi t = vadd(vmul(a, vset(b)), vset(128));
+    return vsra(vadd(t, vsra(t, 8)), 8);
+}
+
+/* stb__As16Bit */
+HPV_DXT_TARGET
+static inline vi as_16bit(vi r, vi g, vi b)
+{
+    return vor(vor(vsll(mul8bit(r, 31), 11), vsll(mul8bit(g, 63), 5)), mul8bit(b, 31));
+}
+
+/* stb__Lerp13, (2a + b) / 3 with the division done as a multiply, exact for these small values */
+HPV_DXT_TARGET
+static inline vi lerp13(vi a, vi b)
+{
+    return vsrl(vmul(vadd(vadd(a, a), b), vset(0xaaab)), 17);
+}
+
+/* stb__EvalColors: the four palette colours of each lane, color[palette index][channel] */
+HPV_DXT_TARGET
+static inline void eval_colors(vi c0, vi c1, vi color[4][3])
+{
+    const vi c[2] = { c0, c1 };
+    for (int i = 0; i < 2; ++i)
+    {
+        vi r = vand(vsrl(c[i], 11), vset(31));
+        vi g = vand(vsrl(c[i], 5), vset(63));
+        vi b = vand(c[i], vset(31));
+        color[i][0] = vor(vsll(r, 3), vsrl(r, 2));
+        color[i][1] = vor(vsll(g, 2), vsrl(g, 4));
+        color[i][2] = vor(vsll(b, 3), vsrl(b, 2));
+    }
+    for (int ch = 0; ch < 3; ++ch)
+    {
+        color[2][ch] = lerp13(color[0][ch], color[1][ch]);
+        color[3][ch] = lerp13(color[1][ch], color[0][ch]);
+    }
+}
+
+/* stb__MatchColorsBlock without dithering, indexMap written out as selects */
+HPV_DXT_TARGET
+static inline vi match_colors(const vi r[16], const vi g[16], const vi b[16], vi color[4][3])
+{
+    vi dir_r = vsub(color[0][0], color[1][0]);
+    vi dir_g = vsub(color[0][1], color[1][1]);
+    vi dir_b = vsub(color[0][2], color[1][2]);
+
+    vi stops[4];
+    for (int i = 0; i < 4; ++i)
+        stops[i] = vadd(vadd(vmul(color[i][0], dir_r), vmul(color[i][1], dir_g)), vmul(color[i][2], dir_b));
+
+    vi c0_point = vsra(vadd(stops[1], stops[3]), 1);
+    vi half_point = vsra(vadd(stops[3], stops[2]), 1);
+    vi c3_point = vsra(vadd(stops[2], stops[0]), 1);
+
+    vi mask = vset(0);
+    for (int i = 0; i < 16; ++i)
+    {
+        vi dot = vadd(vadd(vmul(r[i], dir_r), vmul(g[i], dir_g)), vmul(b[i], dir_b));
+
+        // below the half point it is 1 or 3, above it 2 or 0
+        vi upper = vsub(vset(3), vand(vcmpgt(c0_point, dot), vset(2)));
+        vi lower = vand(vcmpgt(c3_point, dot), vset(2));
+        vi index = vblend(lower, upper, vcmpgt(half_point, dot));
+
+        mask = vor(mask, vsll(index, 2 * i));
+    }
+    return mask;
+}
+
+/* stb__OMatch5/6 endpoints for an average colour, on the lanes of a mask; the tables need a lookup per lane */
+HPV_DXT_TARGET
+static inline void single_color(vi r, vi g, vi b, vi lanes, vi& max16, vi& min16)
+{
+    const HPVDXTTables& tables = dxt_tables();
+    int32_t rs[LANES], gs[LANES], bs[LANES], maxs[LANES], mins[LANES];
+    vstore(rs, r);
+    vstore(gs, g);
+    vstore(bs, b);
+
+    for (int k = 0; k < LANES; ++k)
+    {
+        maxs[k] = (tables.omatch5[rs[k]][0] << 11) | (tables.omatch6[gs[k]][0] << 5) | tables.omatch5[bs[k]][0];
+        mins[k] = (tables.omatch5[rs[k]][1] << 11) | (tables.omatch6[gs[k]][1] << 5) | tables.omatch5[bs[k]][1];
+    }
+
+    max16 = vblend(max16, vload(maxs), lanes);
+    min16 = vblend(min16, vload(mins), lanes);
+}
+
+/* stb__sclamp */
+HPV_DXT_TARGET
+static inline vi sclamp(vf y, int p0, int p1)
+{
+    return vmax(vmin(vcvtt(y), vset(p1)), vset(p0));
+}
+
+/* stb__OptimizeColorsBlock */
+HPV_DXT_TARGET
+static inline void optimize_colors(const vi r[16], const vi g[16], const vi b[16], vi& max16, vi& min16)
+{
+    const vi* px[3] = { r, g, b };
+    vi mu[3], mn[3], mx[3];
+
+    for (int ch = 0; ch < 3; ++ch)
+    {
+        vi sum = px[ch][0];
+        mn[ch] = mx[ch] = px[ch][0];
+        for (int i = 1; i < 16; ++i)
+        {
+            sum = vadd(sum, px[ch][i]);
+            mn[ch] = vmin(mn[ch], px[ch][i]);
+            mx[ch] = vmax(mx[ch], px[ch][i]);
+        }
+        mu[ch] = vsra(vadd(sum, vset(8)), 4);
+    }
+
+    vi cov[6];
+    for (int i = 0; i < 6; ++i)
+        cov[i] = vset(0);
+
+    for (int i = 0; i < 16; ++i)
+    {
+        vi dr = vsub(r[i], mu[0]);
+        vi dg = vsub(g[i], mu[1]);
+        vi db = vsub(b[i], mu[2]);
+
+        cov[0] = vadd(cov[0], vmul(dr, dr));
+        cov[1] = vadd(cov[1], vmul(dr, dg));
+        cov[2] = vadd(cov[2], vmul(dr, db));
+        cov[3] = vadd(cov[3], vmul(dg, dg));
+        cov[4] = vadd(cov[4], vmul(dg, db));
+        cov[5] = vadd(cov[5], vmul(db, db));
+    }
+
+    vf covf[6];
+    for (int i = 0; i < 6; ++i)
+        covf[i] = vfdiv(vcvt(cov[i]), vfset(255.0f));
+
+    vf vfr = vcvt(vsub(mx[0], mn[0]));
+    vf vfg = vcvt(vsub(mx[1], mn[1]));
+    vf vfb = vcvt(vsub(mx[2], mn[2]));
+
+    for (int iter = 0; iter < 4; ++iter)
+    {
+        vf fr = vfadd(vfadd(vfmul(vfr, covf[0]), vfmul(vfg, covf[1])), vfmul(vfb, covf[2]));
+        vf fg = vfadd(vfadd(vfmul(vfr, covf[1]), vfmul(vfg, covf[3])), vfmul(vfb, covf[4]));
+        vf fb = vfadd(vfadd(vfmul(vfr, covf[2]), vfmul(vfg, covf[4])), vfmul(vfb, covf[5]));
+
+        vfr = fr;
+        vfg = fg;
+        vfb = fb;
+    }
+
+    vf magn = vfmax(vfmax(vfabs(vfr), vfabs(vfg)), vfabs(vfb));
+
+    // too small an axis falls back to luminance, the scale itself is done in double like stb
+    vi luma = vfcmplt(magn, vfset(4.0f));
+    vi v_r = vblend(vscale_trunc(vfr, magn), vset(299), luma);
+    vi v_g = vblend(vscale_trunc(vfg, magn), vset(587), luma);
+    vi v_b = vblend(vscale_trunc(vfb, magn), vset(114), luma);
+
+    // colours at the extreme points, the first one of equal dots wins
+    vi mind = vadd(vadd(vmul(r[0], v_r), vmul(g[0], v_g)), vmul(b[0], v_b));
+    vi maxd = mind;
+    vi min_c[3] = { r[0], g[0], b[0] };
+    vi max_c[3] = { r[0], g[0], b[0] };
+
+    for (int i = 1; i < 16; ++i)
+    {
+        vi dot = vadd(vadd(vmul(r[i], v_r), vmul(g[i], v_g)), vmul(b[i], v_b));
+        vi lower = vcmpgt(mind, dot);
+        vi higher = vcmpgt(dot, maxd);
+
+        mind = vblend(mind, dot, lower);
+        maxd = vblend(maxd, dot, higher);
+        for (int ch = 0; ch < 3; ++ch)
+        {
+            min_c[ch] = vblend(min_c[ch], px[ch][i], lower);
+            max_c[ch] = vblend(max_c[ch], px[ch][i], higher);
+        }
+    }
+
+    max16 = as_16bit(max_c[0], max_c[1], max_c[2]);
+    min16 = as_16bit(min_c[0], min_c[1], min_c[2]);
+}
+
+/* stb__RefineBlock, returns the lanes whose endpoints changed */
+HPV_DXT_TARGET
+static inline vi refine(const vi r[16], const vi g[16], const vi b[16], vi& max16, vi& min16, vi mask)
+{
+    vi xx = vset(0), yy = vset(0), xy = vset(0);
+    vi at1_r = vset(0), at1_g = vset(0), at1_b = vset(0);
+    vi at2_r = vset(0), at2_g = vset(0), at2_b = vset(0);
+
+    for (int i = 0; i < 16; ++i)
+    {
+        // w1Tab { 3, 0, 2, 1 } from the two bits of the index
+        vi step = vand(vsrl(mask, 2 * i), vset(3));
+        vi bit0 = vand(step, vset(1));
+        vi bit1 = vsrl(step, 1);
+        vi w1 = vadd(vsub(vsub(vset(3), vmul(bit0, vset(3))), bit1), vsll(vand(bit0, bit1), 1));
+        vi w2 = vsub(vset(3), w1);
+
+        // the three fields of stb's packed prods
+        xx = vadd(xx, vmul(w1, w1));
+        yy = vadd(yy, vmul(w2, w2));
+        xy = vadd(xy, vmul(w1, w2));
+
+        at1_r = vadd(at1_r, vmul(w1, r[i]));
+        at1_g = vadd(at1_g, vmul(w1, g[i]));
+        at1_b = vadd(at1_b, vmul(w1, b[i]));
+        at2_r = vadd(at2_r, r[i]);
+        at2_g = vadd(at2_g, g[i]);
+        at2_b = vadd(at2_b, b[i]);
+    }
+
+    // all pixels on one index leave the system singular, those lanes use the average colour
+    vi same_index = vcmpeq(vsrl(vxor(mask, vsll(mask, 2)), 2), vset(0));
+
+    vi avg_r = vsra(vadd(at2_r, vset(8)), 4);
+    vi avg_g = vsra(vadd(at2_g, vset(8)), 4);
+    vi avg_b = vsra(vadd(at2_b, vset(8)), 4);
+
+    at2_r = vsub(vmul(at2_r, vset(3)), at1_r);
+    at2_g = vsub(vmul(at2_g, vset(3)), at1_g);
+    at2_b = vsub(vmul(at2_b, vset(3)), at1_b);
+
+    vf frb = vfdiv(vfset(3.0f * 31.0f / 255.0f), vcvt(vsub(vmul(xx, yy), vmul(xy, xy))));
+    vf fg = vfdiv(vfmul(frb, vfset(63.0f)), vfset(31.0f));
+    vf half = vfset(0.5f);
+
+    vi new_max = vor(vor(
+        vsll(sclamp(vfadd(vfmul(vcvt(vsub(vmul(at1_r, yy), vmul(at2_r, xy))), frb), half), 0, 31), 11),
+        vsll(sclamp(vfadd(vfmul(vcvt(vsub(vmul(at1_g, yy), vmul(at2_g, xy))), fg), half), 0, 63), 5)),
+        sclamp(vfadd(vfmul(vcvt(vsub(vmul(at1_b, yy), vmul(at2_b, xy))), frb), half), 0, 31));
+
+    vi new_min = vor(vor(
+        vsll(sclamp(vfadd(vfmul(vcvt(vsub(vmul(at2_r, xx), vmul(at1_r, xy))), frb), half), 0, 31), 11),
+        vsll(sclamp(vfadd(vfmul(vcvt(vsub(vmul(at2_g, xx), vmul(at1_g, xy))), fg), half), 0, 63), 5)),
+        sclamp(vfadd(vfmul(vcvt(vsub(vmul(at2_b, xx), vmul(at1_b, xy))), frb), half), 0, 31));
+
+    if (vany(same_index))
+        single_color(avg_r, avg_g, avg_b, same_index, new_max, new_min);
+
+    vi changed = vxor(vand(vcmpeq(new_max, max16), vcmpeq(new_min, min16)), vset(-1));
+    max16 = new_max;
+    min16 = new_min;
+    return changed;
+}
+
+/* stb__CompressColorBlock in high quality mode: endpoints in the low and high 16 bits of colors, indices in indices */
+HPV_DXT_TARGET
+static inline void compress_color(const vi px[16], const vi r[16], const vi g[16], const vi b[16], vi& colors, vi& indices)
+{
+    vi max16, min16;
+    optimize_colors(r, g, b, max16, min16);
+
+    vi color[4][3];
+    eval_colors(max16, min16, color);
+    vi mask = vandnot(vcmpeq(max16, min16), match_colors(r, g, b, color));
+
+    // two refinement passes, a lane leaves the loop where stb breaks out of it
+    vi active = vset(-1);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        vi last_mask = mask;
+        vi new_max = max16;
+        vi new_min = min16;
+        vi update = vand(active, refine(r, g, b, new_max, new_min, mask));
+
+        max16 = vblend(max16, new_max, update);
+        min16 = vblend(min16, new_min, update);
+
+        vi collapsed = vand(update, vcmpeq(max16, min16));
+        eval_colors(max16, min16, color);
+        mask = vblend(mask, match_colors(r, g, b, color), vandnot(collapsed, update));
+        mask = vandnot(collapsed, mask);
+
+        active = vandnot(collapsed, vandnot(vcmpeq(mask, last_mask), active));
+    }
+
+    // a constant block is one colour matched exactly, whatever the search above found
+    vi constant = vset(-1);
+    for (int i = 1; i < 16; ++i)
+        constant = vand(constant, vcmpeq(px[i], px[0]));
+
+    if (vany(constant))
+    {
+        single_color(r[0], g[0], b[0], constant, max16, min16);
+        mask = vblend(mask, vset(static_cast<int32_t>(0xaaaaaaaau)), constant);
+    }
+
+    vi swap = vcmpgt(min16, max16);
+    colors = vor(vblend(max16, min16, swap), vsll(vblend(min16, max16, swap), 16));
+    indices = vxor(mask, vand(swap, vset(0x55555555)));
+}
+
+/* stb__CompressAlphaBlock: endpoints in the low 16 bits of ends, the 48 bits of indices in lo and hi */
+HPV_DXT_TARGET
+static inline void compress_alpha(const vi a[16], vi& ends, vi& lo, vi& hi)
+{
+    vi mn = a[0], mx = a[0];
+    for (int i = 1; i < 16; ++i)
+    {
+        mn = vmin(mn, a[i]);
+        mx = vmax(mx, a[i]);
+    }
+
+    vi dist = vsub(mx, mn);
+    vi dist4 = vsll(dist, 2);
+    vi dist2 = vsll(dist, 1);
+    vi bias = vblend(vadd(vsrl(dist, 1), vset(2)), vsub(dist, vset(1)), vcmpgt(vset(8), dist));
+    bias = vsub(bias, vmul(mn, vset(7)));
+
+    lo = vset(0);
+    hi = vset(0);
+    for (int i = 0; i < 16; ++i)
+    {
+        vi v = vadd(vmul(a[i], vset(7)), bias);
+
+        // v >= d is not (d > v)
+        vi t = vandnot(vcmpgt(dist4, v), vset(-1));
+        vi ind = vand(t, vset(4));
+        v = vsub(v, vand(dist4, t));
+        t = vandnot(vcmpgt(dist2, v), vset(-1));
+        ind = vadd(ind, vand(t, vset(2)));
+        v = vsub(v, vand(dist2, t));
+        ind = vadd(ind, vandnot(vcmpgt(dist, v), vset(1)));
+
+        ind = vand(vsub(vset(0), ind), vset(7));
+        ind = vxor(ind, vand(vcmpgt(vset(2), ind), vset(1)));
+
+        if (i <= 10)
+            lo = vor(lo, vsll(ind, 3 * i));
+        if (i == 10)
+            hi = vor(hi, vsrl(ind, 2));
+        if (i >= 11)
+            hi = vor(hi, vsll(ind, 3 * i - 32));
+    }
+
+    // mono alpha keeps all indices at zero
+    vi mono = vcmpeq(mn, mx);
+    lo = vandnot(mono, lo);
+    hi = vandnot(mono, hi);
+    ends = vor(mx, vsll(mn, 8));
+}
+
+/* LANES neighbouring blocks of a block row; row points at the first pixel of the first block */
+HPV_DXT_TARGET
+static inline void compress_blocks(unsigned char * dst, const unsigned char * row, std::size_t stride, int isDxt5)
+{
+    vi px[16], r[16], g[16], b[16];
+    vload_blocks(row, stride, px);
+
+    for (int i = 0; i < 16; ++i)
+    {
+        r[i] = vand(px[i], vset(0xff));
+        g[i] = vand(vsrl(px[i], 8), vset(0xff));
+        b[i] = vand(vsrl(px[i], 16), vset(0xff));
+    }
+
+    vi colors, indices;
+    compress_color(px, r, g, b, colors, indices);
+
+    int32_t color_out[LANES], index_out[LANES];
+    vstore(color_out, colors);
+    vstore(index_out, indices);
+
+    if (isDxt5)
+    {
+        vi a[16];
+        for (int i = 0; i < 16; ++i)
+            a[i] = vsrl(px[i], 24);
+
+        vi ends, lo, hi;
+        compress_alpha(a, ends, lo, hi);
+
+        int32_t ends_out[LANES], lo_out[LANES], hi_out[LANES];
+        vstore(ends_out, ends);
+        vstore(lo_out, lo);
+        vstore(hi_out, hi);
+
+        for (int k = 0; k < LANES; ++k, dst += 16)
+        {
+            put_le(dst, static_cast<uint32_t>(ends_out[k]), 2);
+            put_le(dst + 2, static_cast<uint32_t>(lo_out[k]), 4);
+            put_le(dst + 6, static_cast<uint32_t>(hi_out[k]), 2);
+            put_le(dst + 8, static_cast<uint32_t>(color_out[k]), 4);
+            put_le(dst + 12, static_cast<uint32_t>(index_out[k]), 4);
+        }
+    }
+    else
+    {
+        for (int k = 0; k < LANES; ++k, dst += 8)
+        {
+            put_le(dst, static_cast<uint32_t>(color_out[k]), 4);
+            put_le(dst + 4, static_cast<uint32_t>(index_out[k]), 4);
+        }
+    }
+}
+
+/* The HPVDXTFunc: LANES blocks at a time, the rest of a block row block by block through stb */
+HPV_DXT_TARGET
+static void compress(unsigned char * dst, const unsigned char * src, int width, int height, int isDxt5)
+{
+    const std::size_t stride = static_cast<std::size_t>(width) * 4;
+    const int block_bytes = isDxt5 ? 16 : 8;
+    const int blocks_per_row = width / 4;
+
+    for (int y = 0; y + 4 <= height; y += 4)
+    {
+        const unsigned char * row = src + y * stride;
+        int x = 0;
+
+        for (; x + LANES <= blocks_per_row; x += LANES)
+        {
+            compress_blocks(dst, row + x * 16, stride, isDxt5);
+            dst += LANES * block_bytes;
+        }
+
+        for (; x < blocks_per_row; ++x)
+        {
+            compress_single_block(dst, row + x * 16, stride, isDxt5);
+            dst += block_bytes;
+        }
+    }
+}
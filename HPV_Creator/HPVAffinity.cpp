@@ -0,0 +1,163 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include "HPVAffinity.hpp"
+
+namespace HPV {
+
+    static thread_local std::size_t tls_node = 0;
+
+#if defined(__linux__)
+    /* "0-3,8-11" -> 0 1 2 3 8 9 10 11 */
+    static std::vector<int> parse_cpu_list(const char * list)
+    {
+        std::vector<int> cpus;
+        const char * p = list;
+
+        while (*p)
+        {
+            char * end = nullptr;
+            long first = strtol(p, &end, 10);
+            if (end == p)
+                break;
+
+            long last = first;
+            p = end;
+            if (*p == '-')
+            {
+                last = strtol(p + 1, &end, 10);
+                p = end;
+            }
+
+            for (long cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+
+            if (*p == ',')
+                ++p;
+            else
+                break;
+        }
+
+        return cpus;
+    }
+#endif
+
+    std::vector<int> hpv_process_cpus()
+    {
+        std::vector<int> cpus;
+
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            }
+        }
+#endif
+
+        return cpus;
+    }
+
+    std::vector<HPVNumaNode> hpv_numa_nodes()
+    {
+        std::vector<HPVNumaNode> nodes;
+        std::vector<int> usable = hpv_process_cpus();
+
+#if defined(__linux__)
+        // node ids can have holes, stop after a run of missing ones
+        for (int id = 0, missing = 0; missing < 64; ++id)
+        {
+            std::string path = "/sys/devices/system/node/node" + std::to_string(id) + "/cpulist";
+            FILE * fp = fopen(path.c_str(), "r");
+            if (!fp)
+            {
+                ++missing;
+                continue;
+            }
+            missing = 0;
+
+            char list[4096] = { 0 };
+            if (fgets(list, sizeof(list), fp))
+            {
+                HPVNumaNode node;
+                node.id = id;
+
+                std::vector<int> cpus = parse_cpu_list(list);
+                for (std::size_t i = 0; i < cpus.size(); ++i)
+                {
+                    if (std::find(usable.begin(), usable.end(), cpus[i]) != usable.end())
+                        node.cpus.push_back(cpus[i]);
+                }
+
+                if (!node.cpus.empty())
+                    nodes.push_back(node);
+            }
+            fclose(fp);
+        }
+#endif
+
+        if (nodes.empty())
+        {
+            HPVNumaNode node;
+            node.id = 0;
+            node.cpus = usable;
+            nodes.push_back(node);
+        }
+
+        return nodes;
+    }
+
+    bool hpv_pin_thread(std::thread& thread, const std::vector<int>& cpus)
+    {
+#if defined(__linux__)
+        if (cpus.empty())
+            return false;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (std::size_t i = 0; i < cpus.size(); ++i)
+        {
+            if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+                CPU_SET(cpus[i], &set);
+        }
+
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+        (void)thread;
+        (void)cpus;
+        return false;
+#endif
+    }
+
+    std::size_t hpv_current_node()
+    {
+        return tls_node;
+    }
+
+    void hpv_set_current_node(std::size_t node)
+    {
+        tls_node = node;
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,48 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_AFFINITY_H
+#define HPV_AFFINITY_H
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+
+/* NUMA nodes we keep statistics for, nodes beyond this share the last slot */
+#define HPV_MAX_NUMA_NODES 16
+
+namespace HPV {
+
+    struct HPVNumaNode
+    {
+        int id;                         /* the kernel's node number */
+        std::vector<int> cpus;          /* CPUs of this node the process may run on */
+    };
+
+    /*
+     *  The NUMA nodes that have CPUs this process may use, read from sysfs on Linux. Returns a
+     *  single node with all usable CPUs when the machine isn't NUMA or the topology is unknown.
+     */
+    std::vector<HPVNumaNode> hpv_numa_nodes();
+
+    /* The CPUs this process may run on, empty when unknown */
+    std::vector<int> hpv_process_cpus();
+
+    /* Restrict a thread to the given CPUs, returns false when not supported or it failed */
+    bool hpv_pin_thread(std::thread& thread, const std::vector<int>& cpus);
+
+    /*
+     *  Index (into hpv_numa_nodes()) of the node the calling thread is pinned to, 0 for threads
+     *  that aren't pinned. Buffer pools use it to hand out memory of the caller's node.
+     */
+    std::size_t hpv_current_node();
+    void hpv_set_current_node(std::size_t node);
+
+} /* namespace HPV */
+
+#endif
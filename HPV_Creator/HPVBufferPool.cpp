@@ -0,0 +1,466 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "HPVBufferPool.hpp"
+#include "HPVAffinity.hpp"
+#include "lz4hc.h"
+
+namespace HPV {
+
+    static std::atomic<uint64_t> frame_buffer_allocations(0);
+
+    unsigned char * hpv_aligned_alloc(std::size_t size)
+    {
+        void * ptr = nullptr;
+
+#ifdef _WIN32
+        ptr = _aligned_malloc(size, HPV_BUFFER_ALIGNMENT);
+#else
+        if (posix_memalign(&ptr, HPV_BUFFER_ALIGNMENT, size) != 0)
+            ptr = nullptr;
+#endif
+        if (ptr)
+            frame_buffer_allocations.fetch_add(1, std::memory_order_relaxed);
+
+        return static_cast<unsigned char *>(ptr);
+    }
+
+    void hpv_aligned_free(void * ptr)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    uint64_t hpv_frame_buffer_allocations()
+    {
+        return frame_buffer_allocations.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * stb_image block cache. Every block is prefixed with a header holding its capacity, so a
+     * cached block can serve any request that fits. The cache is thread local: stb_image frees
+     * everything it allocates on the thread that decodes, so no locking is needed.
+     */
+    struct StbiBlockHeader
+    {
+        std::size_t capacity;
+        std::size_t padding;    /* keep the returned pointer 16 byte aligned */
+    };
+
+    struct StbiBlockCache
+    {
+        StbiBlockHeader * blocks[HPV_STBI_CACHED_BLOCKS];
+        int num_blocks;
+
+        StbiBlockCache() : num_blocks(0) {}
+
+        ~StbiBlockCache()
+        {
+            for (int i = 0; i < num_blocks; ++i)
+                free(blocks[i]);
+        }
+    };
+
+    static thread_local StbiBlockCache stbi_cache;
+
+    void * hpv_stbi_malloc(std::size_t size)
+    {
+        // best fit from the cache
+        int best = -1;
+        for (int i = 0; i < stbi_cache.num_blocks; ++i)
+        {
+            if (stbi_cache.blocks[i]->capacity >= size &&
+                (best < 0 || stbi_cache.blocks[i]->capacity < stbi_cache.blocks[best]->capacity))
+            {
+                best = i;
+            }
+        }
+
+        if (best >= 0)
+        {
+            StbiBlockHeader * block = stbi_cache.blocks[best];
+            stbi_cache.blocks[best] = stbi_cache.blocks[--stbi_cache.num_blocks];
+            return block + 1;
+        }
+
+        StbiBlockHeader * block = static_cast<StbiBlockHeader *>(malloc(sizeof(StbiBlockHeader) + size));
+        if (!block)
+            return nullptr;
+
+        frame_buffer_allocations.fetch_add(1, std::memory_order_relaxed);
+        block->capacity = size;
+        return block + 1;
+    }
+
+    void hpv_stbi_free(void * ptr)
+    {
+        if (!ptr)
+            return;
+
+        StbiBlockHeader * block = static_cast<StbiBlockHeader *>(ptr) - 1;
+
+        if (stbi_cache.num_blocks < HPV_STBI_CACHED_BLOCKS)
+        {
+            stbi_cache.blocks[stbi_cache.num_blocks++] = block;
+            return;
+        }
+
+        // cache is full: keep the bigger blocks, they are the expensive ones
+        int smallest = 0;
+        for (int i = 1; i < stbi_cache.num_blocks; ++i)
+        {
+            if (stbi_cache.blocks[i]->capacity < stbi_cache.blocks[smallest]->capacity)
+                smallest = i;
+        }
+
+        if (stbi_cache.blocks[smallest]->capacity < block->capacity)
+        {
+            std::swap(stbi_cache.blocks[smallest], block);
+        }
+
+        free(block);
+    }
+
+    void * hpv_stbi_realloc(void * ptr, std::size_t size)
+    {
+        if (!ptr)
+            return hpv_stbi_malloc(size);
+
+        StbiBlockHeader * block = static_cast<StbiBlockHeader *>(ptr) - 1;
+        if (block->capacity >= size)
+            return ptr;
+
+        void * grown = hpv_stbi_malloc(size);
+        if (!grown)
+            return nullptr;
+
+        memcpy(grown, ptr, block->capacity);
+        hpv_stbi_free(ptr);
+        return grown;
+    }
+
+    int hpv_read_file(const std::string& path, unsigned char ** buf, std::size_t * capacity, std::size_t * size)
+    {
+        return hpv_read_file_head(path, 0, buf, capacity, size, nullptr);
+    }
+
+    int hpv_read_file_head(const std::string& path, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total)
+    {
+        // plain file descriptors: stdio and iostreams would allocate a stream buffer for every file
+#ifdef _WIN32
+        int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+#endif
+        if (fd < 0)
+            return HPV_RET_ERROR;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+#ifdef _WIN32
+            _close(fd);
+#else
+            close(fd);
+#endif
+            return HPV_RET_ERROR;
+        }
+
+        std::size_t file_size = static_cast<std::size_t>(st.st_size);
+        if (total)
+        {
+            *total = file_size;
+        }
+        if (max_bytes > 0 && file_size > max_bytes)
+        {
+            file_size = max_bytes;
+        }
+
+        if (*capacity < file_size)
+        {
+            hpv_aligned_free(*buf);
+            // round up so slightly bigger files in the sequence don't trigger a new allocation
+            *capacity = (file_size + (file_size >> 3) + HPV_BUFFER_ALIGNMENT - 1) & ~(std::size_t)(HPV_BUFFER_ALIGNMENT - 1);
+            *buf = hpv_aligned_alloc(*capacity);
+            if (!*buf)
+            {
+                *capacity = 0;
+            }
+        }
+
+        std::size_t done = 0;
+        while (*buf && done < file_size)
+        {
+#ifdef _WIN32
+            int ret = _read(fd, *buf + done, static_cast<unsigned int>(file_size - done));
+#else
+            ssize_t ret = read(fd, *buf + done, file_size - done);
+#endif
+            if (ret <= 0)
+                break;
+            done += static_cast<std::size_t>(ret);
+        }
+
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+
+        *size = done;
+        return (*buf && done == file_size) ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+    }
+
+    void hpv_prefetch_file(const std::string& path)
+    {
+#if defined(POSIX_FADV_WILLNEED)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        // only schedules the read-ahead, returns immediately
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+#else
+        (void)path;
+#endif
+    }
+
+    HPVBufferPool::HPVBufferPool() : buffer_size(0)
+    {
+
+    }
+
+    HPVBufferPool::~HPVBufferPool()
+    {
+        clear();
+    }
+
+    void HPVBufferPool::init(std::size_t _buffer_size)
+    {
+        if (_buffer_size != buffer_size)
+        {
+            clear();
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        buffer_size = _buffer_size;
+    }
+
+    unsigned char * HPVBufferPool::acquire()
+    {
+        std::size_t node = hpv_current_node();
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+
+            if (free_buffers.size() <= node)
+            {
+                free_buffers.resize(node + 1);
+            }
+
+            // own node first, then any other node
+            for (std::size_t i = 0; i < free_buffers.size(); ++i)
+            {
+                std::vector<unsigned char *>& list = free_buffers[(node + i) % free_buffers.size()];
+                if (!list.empty())
+                {
+                    unsigned char * buf = list.back();
+                    list.pop_back();
+                    return buf;
+                }
+            }
+        }
+
+        unsigned char * buf = hpv_aligned_alloc(buffer_size);
+        if (buf)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            buffer_nodes[buf] = node;
+        }
+
+        return buf;
+    }
+
+    void HPVBufferPool::release(unsigned char * buf)
+    {
+        if (!buf)
+            return;
+
+        std::lock_guard<std::mutex> lock(mtx);
+
+        std::size_t node = 0;
+        std::map<unsigned char *, std::size_t>::const_iterator it = buffer_nodes.find(buf);
+        if (it != buffer_nodes.end())
+        {
+            node = it->second;
+        }
+
+        if (free_buffers.size() <= node)
+        {
+            free_buffers.resize(node + 1);
+        }
+        free_buffers[node].push_back(buf);
+    }
+
+    void HPVBufferPool::clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (std::size_t n = 0; n < free_buffers.size(); ++n)
+        {
+            for (std::size_t i = 0; i < free_buffers[n].size(); ++i)
+            {
+                buffer_nodes.erase(free_buffers[n][i]);
+                hpv_aligned_free(free_buffers[n][i]);
+            }
+        }
+        free_buffers.clear();
+    }
+
+    std::size_t HPVBufferPool::get_buffer_size()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return buffer_size;
+    }
+
+    HPVWorkerArena::HPVWorkerArena()
+        : file_buf(nullptr)
+        , file_capacity(0)
+        , file_size(0)
+        , dxt(nullptr)
+        , dxt_size(0)
+        , lz4_state(nullptr)
+        , strip(nullptr)
+        , strip_size(0)
+        , variant_pixels(nullptr)
+        , variant_pixels_size(0)
+        , variant_sums(nullptr)
+        , variant_sums_count(0)
+        , variant_dxt(nullptr)
+        , variant_dxt_size(0)
+    {
+
+    }
+
+    HPVWorkerArena::~HPVWorkerArena()
+    {
+        hpv_aligned_free(file_buf);
+        hpv_aligned_free(dxt);
+        hpv_aligned_free(lz4_state);
+        hpv_aligned_free(strip);
+        hpv_aligned_free(variant_pixels);
+        hpv_aligned_free(variant_sums);
+        hpv_aligned_free(variant_dxt);
+    }
+
+    int HPVWorkerArena::reserve(std::size_t _dxt_size, std::size_t _strip_size)
+    {
+        if (dxt_size < _dxt_size)
+        {
+            hpv_aligned_free(dxt);
+            dxt = hpv_aligned_alloc(_dxt_size);
+            dxt_size = dxt ? _dxt_size : 0;
+        }
+
+        if (strip_size < _strip_size)
+        {
+            hpv_aligned_free(strip);
+            strip = hpv_aligned_alloc(_strip_size);
+            strip_size = strip ? _strip_size : 0;
+        }
+
+        if (!lz4_state)
+        {
+            lz4_state = hpv_aligned_alloc(LZ4_sizeofStateHC());
+        }
+
+        return (dxt && lz4_state && strip_size >= _strip_size) ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+    }
+
+    int HPVWorkerArena::reserve_variant(std::size_t pixels_size, std::size_t sums_count, std::size_t _dxt_size)
+    {
+        // the biggest output sets the size, the others re-use it
+        if (variant_pixels_size < pixels_size)
+        {
+            hpv_aligned_free(variant_pixels);
+            variant_pixels = hpv_aligned_alloc(pixels_size);
+            variant_pixels_size = variant_pixels ? pixels_size : 0;
+        }
+
+        if (variant_sums_count < sums_count)
+        {
+            hpv_aligned_free(variant_sums);
+            variant_sums = reinterpret_cast<uint16_t *>(hpv_aligned_alloc(sums_count * sizeof(uint16_t)));
+            variant_sums_count = variant_sums ? sums_count : 0;
+        }
+
+        if (variant_dxt_size < _dxt_size)
+        {
+            hpv_aligned_free(variant_dxt);
+            variant_dxt = hpv_aligned_alloc(_dxt_size);
+            variant_dxt_size = variant_dxt ? _dxt_size : 0;
+        }
+
+        return (variant_pixels_size >= pixels_size && variant_sums_count >= sums_count && variant_dxt_size >= _dxt_size) ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+    }
+
+    HPVFrameSlot::HPVFrameSlot()
+        : file_buf(nullptr)
+        , file_capacity(0)
+        , file_size(0)
+        , pixels(nullptr)
+        , pixels_size(0)
+        , dxt(nullptr)
+        , dxt_size(0)
+    {
+
+    }
+
+    HPVFrameSlot::~HPVFrameSlot()
+    {
+        hpv_aligned_free(file_buf);
+        hpv_aligned_free(pixels);
+        hpv_aligned_free(dxt);
+    }
+
+    int HPVFrameSlot::reserve(std::size_t _pixels_size, std::size_t _dxt_size)
+    {
+        if (pixels_size < _pixels_size)
+        {
+            hpv_aligned_free(pixels);
+            pixels = hpv_aligned_alloc(_pixels_size);
+            pixels_size = pixels ? _pixels_size : 0;
+        }
+
+        if (dxt_size < _dxt_size)
+        {
+            hpv_aligned_free(dxt);
+            dxt = hpv_aligned_alloc(_dxt_size);
+            dxt_size = dxt ? _dxt_size : 0;
+        }
+
+        return (pixels && dxt) ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+    }
+
+} /* namespace HPV */
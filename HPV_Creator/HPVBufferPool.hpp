@@ -0,0 +1,154 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_BUFFER_POOL_H
+#define HPV_BUFFER_POOL_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <map>
+
+#include "HPVHeader.hpp"
+
+/* All frame sized buffers are page aligned */
+#define HPV_BUFFER_ALIGNMENT 4096
+
+/* Amount of freed stb_image blocks every thread keeps around for re-use */
+#define HPV_STBI_CACHED_BLOCKS 8
+
+namespace HPV {
+
+    /*
+     * Page aligned allocations. Every one is counted, together with the stb_image blocks that
+     * miss the per thread cache, so hpv_frame_buffer_allocations() tells if an encode still
+     * allocates frame sized buffers once it reached steady state. Small allocations made by the
+     * containers and the standard library are not counted.
+     */
+    unsigned char * hpv_aligned_alloc(std::size_t size);
+    void hpv_aligned_free(void * ptr);
+    uint64_t hpv_frame_buffer_allocations();
+
+    /*
+     * Allocation hooks for stb_image (STBI_MALLOC, STBI_REALLOC and STBI_FREE). Freed blocks are
+     * cached per thread and handed out again for the next image, so decoding a sequence of equally
+     * sized frames stops allocating after the first one.
+     */
+    void * hpv_stbi_malloc(std::size_t size);
+    void * hpv_stbi_realloc(void * ptr, std::size_t size);
+    void hpv_stbi_free(void * ptr);
+
+    /*
+     * Read a complete file into *buf. The buffer is only (re)allocated when it is too small,
+     * *capacity is updated accordingly. Returns HPV_RET_ERROR_NONE on success.
+     */
+    int hpv_read_file(const std::string& path, unsigned char ** buf, std::size_t * capacity, std::size_t * size);
+
+    /* Same, but reads at most max_bytes (0 = all) of the file. *total gets the size of the whole file */
+    int hpv_read_file_head(const std::string& path, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total);
+
+    /*
+     * Tell the OS we are going to read this file soon, so it can start fetching it in the
+     * background. Does nothing on platforms without posix_fadvise().
+     */
+    void hpv_prefetch_file(const std::string& path);
+
+    /*
+     *  HPVBufferPool: recycles equally sized, page aligned buffers between threads. Workers acquire
+     *  a buffer for their compressed output, the writer releases it once it is on disk. The pool
+     *  only grows until it holds as many buffers as there are frames in flight.
+     *
+     *  Buffers remember the NUMA node of the worker that first acquired (and so first touched)
+     *  them and go back to that node's free list. A worker gets a buffer of its own node when
+     *  there is one, of another node before the pool grows.
+     */
+    class HPVBufferPool
+    {
+    public:
+        HPVBufferPool();
+        ~HPVBufferPool();
+
+        /* (Re)configure the buffer size, drops all cached buffers when the size changes */
+        void init(std::size_t buffer_size);
+        unsigned char * acquire();
+        void release(unsigned char * buf);
+        void clear();
+        std::size_t get_buffer_size();
+
+    private:
+        std::mutex mtx;
+        std::vector<std::vector<unsigned char *>> free_buffers;     /* per node */
+        std::map<unsigned char *, std::size_t> buffer_nodes;
+        std::size_t buffer_size;
+    };
+
+    /*
+     *  HPVWorkerArena: the scratch memory one worker thread re-uses for every frame it compresses:
+     *  the raw file contents, the DXT output, the LZ4 HC state, the RGBA strip that mapped
+     *  frames are expanded into and the pixels, downscale row sums and DXT output of the extra outputs.
+     */
+    class HPVWorkerArena
+    {
+    public:
+        HPVWorkerArena();
+        ~HPVWorkerArena();
+
+        int reserve(std::size_t dxt_size, std::size_t strip_size);
+        int reserve_variant(std::size_t pixels_size, std::size_t sums_count, std::size_t dxt_size);
+
+        unsigned char * file_buf;
+        std::size_t file_capacity;
+        std::size_t file_size;
+        unsigned char * dxt;
+        std::size_t dxt_size;
+        void * lz4_state;
+        unsigned char * strip;
+        std::size_t strip_size;
+        unsigned char * variant_pixels;
+        std::size_t variant_pixels_size;
+        uint16_t * variant_sums;
+        std::size_t variant_sums_count;
+        unsigned char * variant_dxt;
+        std::size_t variant_dxt_size;
+
+    private:
+        HPVWorkerArena(const HPVWorkerArena&);
+        HPVWorkerArena& operator=(const HPVWorkerArena&);
+    };
+
+    /*
+     *  HPVFrameSlot: the scratch memory of one frame travelling through the staged pipeline:
+     *  the raw file contents, the decoded pixels and the DXT output. A slot moves from stage to
+     *  stage together with its frame and is recycled once the frame is LZ4 compressed.
+     */
+    class HPVFrameSlot
+    {
+    public:
+        HPVFrameSlot();
+        ~HPVFrameSlot();
+
+        int reserve(std::size_t pixels_size, std::size_t dxt_size);
+
+        unsigned char * file_buf;
+        std::size_t file_capacity;
+        std::size_t file_size;
+        unsigned char * pixels;
+        std::size_t pixels_size;
+        unsigned char * dxt;
+        std::size_t dxt_size;
+
+    private:
+        HPVFrameSlot(const HPVFrameSlot&);
+        HPVFrameSlot& operator=(const HPVFrameSlot&);
+    };
+
+} /* namespace HPV */
+
+#endif
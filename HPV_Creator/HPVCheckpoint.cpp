@@ -0,0 +1,210 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <string.h>
+
+#include "HPVCheckpoint.hpp"
+#include "Log.hpp"
+
+namespace HPV {
+
+    uint64_t hpv_hash(const void * data, std::size_t size)
+    {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+
+        uint64_t h = 0x9747b28c9747b28cULL ^ (size * m);
+
+        const unsigned char * p = static_cast<const unsigned char *>(data);
+        const unsigned char * end = p + (size & ~static_cast<std::size_t>(7));
+
+        for (; p != end; p += 8)
+        {
+            uint64_t k;
+            memcpy(&k, p, sizeof(k));
+
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+
+            h ^= k;
+            h *= m;
+        }
+
+        switch (size & 7)
+        {
+        case 7: h ^= uint64_t(p[6]) << 48;
+            // fallthrough
+        case 6: h ^= uint64_t(p[5]) << 40;
+            // fallthrough
+        case 5: h ^= uint64_t(p[4]) << 32;
+            // fallthrough
+        case 4: h ^= uint64_t(p[3]) << 24;
+            // fallthrough
+        case 3: h ^= uint64_t(p[2]) << 16;
+            // fallthrough
+        case 2: h ^= uint64_t(p[1]) << 8;
+            // fallthrough
+        case 1: h ^= uint64_t(p[0]);
+                h *= m;
+        };
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+
+        return h;
+    }
+
+    HPVCheckpoint::HPVCheckpoint() : fp(nullptr), unflushed(0)
+    {
+
+    }
+
+    HPVCheckpoint::~HPVCheckpoint()
+    {
+        close();
+    }
+
+    std::size_t HPVCheckpoint::load(const std::string& path, const HPVCheckpointHeader& expected)
+    {
+        previous.clear();
+
+        FILE * in = fopen(path.c_str(), "rb");
+        if (!in)
+            return 0;
+
+        HPVCheckpointHeader header;
+        if (fread(&header, sizeof(header), 1, in) != 1 ||
+            header.magic != HPV_CHECKPOINT_MAGIC ||
+            header.version != HPV_CHECKPOINT_VERSION)
+        {
+            HPV_VERBOSE("%s is not a checkpoint, ignoring it", path.c_str());
+            fclose(in);
+            return 0;
+        }
+
+        if (header.video_width != expected.video_width ||
+            header.video_height != expected.video_height ||
+            header.compression_type != expected.compression_type)
+        {
+            HPV_VERBOSE("Checkpoint %s was made with different settings, ignoring it", path.c_str());
+            fclose(in);
+            return 0;
+        }
+
+        // a crash can leave a partial entry at the end, fread just stops there
+        HPVCheckpointEntry entry;
+        while (fread(&entry, sizeof(entry), 1, in) == 1)
+        {
+            previous[entry.source_hash] = entry;
+        }
+
+        fclose(in);
+
+        return previous.size();
+    }
+
+    bool HPVCheckpoint::lookup(uint64_t source_hash, HPVCheckpointEntry& entry) const
+    {
+        std::unordered_map<uint64_t, HPVCheckpointEntry>::const_iterator it = previous.find(source_hash);
+        if (it == previous.end())
+            return false;
+
+        entry = it->second;
+        return true;
+    }
+
+    void HPVCheckpoint::clear_previous()
+    {
+        previous.clear();
+    }
+
+    int HPVCheckpoint::open(const std::string& _path, const HPVCheckpointHeader& header)
+    {
+        close();
+
+        path = _path;
+        std::string temp_path = path + HPV_CHECKPOINT_TEMP_EXTENSION;
+
+        fp = fopen(temp_path.c_str(), "wb");
+        if (!fp)
+        {
+            HPV_ERROR("Couldn't create checkpoint %s", temp_path.c_str());
+            return 0;
+        }
+
+        if (fwrite(&header, sizeof(header), 1, fp) != 1 || fflush(fp) != 0)
+        {
+            HPV_ERROR("Couldn't write checkpoint %s", temp_path.c_str());
+            fclose(fp);
+            fp = nullptr;
+            return 0;
+        }
+
+        unflushed = 0;
+        return 1;
+    }
+
+    int HPVCheckpoint::append(const HPVCheckpointEntry& entry)
+    {
+        if (!fp)
+            return 0;
+
+        if (fwrite(&entry, sizeof(entry), 1, fp) != 1)
+        {
+            HPV_ERROR("Couldn't append to checkpoint");
+            return 0;
+        }
+
+        if (++unflushed >= HPV_CHECKPOINT_FLUSH_INTERVAL)
+        {
+            fflush(fp);
+            unflushed = 0;
+        }
+
+        return 1;
+    }
+
+    int HPVCheckpoint::commit()
+    {
+        if (!fp)
+            return 0;
+
+        bool written = (fflush(fp) == 0);
+        written = (fclose(fp) == 0) && written;
+        fp = nullptr;
+        unflushed = 0;
+
+        std::string temp_path = path + HPV_CHECKPOINT_TEMP_EXTENSION;
+        if (!written || rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            HPV_ERROR("Couldn't replace checkpoint %s", path.c_str());
+            return 0;
+        }
+
+        return 1;
+    }
+
+    void HPVCheckpoint::close()
+    {
+        if (fp)
+        {
+            fclose(fp);
+            fp = nullptr;
+        }
+
+        unflushed = 0;
+    }
+
+    bool HPVCheckpoint::is_open() const
+    {
+        return fp != nullptr;
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,97 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_CHECKPOINT_H
+#define HPV_CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+#define HPV_CHECKPOINT_MAGIC 0x48505643     /* "HPVC" */
+#define HPV_CHECKPOINT_VERSION 1
+#define HPV_CHECKPOINT_EXTENSION ".hpvc"
+
+/* The output of the previous run is kept under this name while it is being re-used */
+#define HPV_CHECKPOINT_PREVIOUS_EXTENSION ".prev"
+
+/* The checkpoint of a run in progress, it only replaces the previous one once the run completed */
+#define HPV_CHECKPOINT_TEMP_EXTENSION ".tmp"
+
+/* Checkpoint entries are flushed to disk after this many frames */
+#define HPV_CHECKPOINT_FLUSH_INTERVAL 64
+
+namespace HPV {
+
+    /*
+     * Fast 64-bit hash (MurmurHash64A) used to recognise source frames and to verify
+     * compressed frames read back from a previous encode.
+     */
+    uint64_t hpv_hash(const void * data, std::size_t size);
+
+    /* Parameters that must match before frames of a previous encode can be re-used */
+    struct HPVCheckpointHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t video_width;
+        uint32_t video_height;
+        uint32_t compression_type;
+        uint32_t reserved;
+    };
+
+    /* One written frame: where it lives in the output and what it was made from */
+    struct HPVCheckpointEntry
+    {
+        uint64_t source_hash;
+        uint64_t payload_hash;
+        uint64_t offset;
+        uint32_t frame_size;            /* with HPV_FRAME_RAW for a raw payload */
+        uint32_t frame_index;
+    };
+
+    /*
+     *  HPVCheckpoint: sidecar file (<output>.hpvc) that lists every frame written to the output.
+     *  Entries are appended while encoding, so after a crash or a change to a few source frames
+     *  the next run can copy every frame whose source hash is known from the previous output
+     *  instead of compressing it again.
+     *
+     *  load() and lookup() read the previous checkpoint; open(), append() and commit() write the
+     *  new one. It is written next to the previous one (HPV_CHECKPOINT_TEMP_EXTENSION) and only
+     *  commit() moves it over, so a run that crashes or fails keeps the previous checkpoint.
+     *  lookup() may be called from any thread once load() returned, append() only from the writer.
+     */
+    class HPVCheckpoint
+    {
+    public:
+        HPVCheckpoint();
+        ~HPVCheckpoint();
+
+        /* Returns the amount of usable entries, 0 if there is no matching checkpoint */
+        std::size_t load(const std::string& path, const HPVCheckpointHeader& expected);
+        bool lookup(uint64_t source_hash, HPVCheckpointEntry& entry) const;
+        void clear_previous();
+
+        int open(const std::string& path, const HPVCheckpointHeader& header);
+        int append(const HPVCheckpointEntry& entry);
+        int commit();
+        void close();
+        bool is_open() const;
+
+    private:
+        std::unordered_map<uint64_t, HPVCheckpointEntry> previous;
+        std::string path;
+        FILE * fp;
+        uint32_t unflushed;
+    };
+
+} /* namespace HPV */
+
+#endif
@@ -2,16 +2,24 @@
 #define STB_DXT_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 
+// Route stb_image allocations through the per-thread block cache
+#define STBI_MALLOC(sz)    HPV::hpv_stbi_malloc(sz)
+#define STBI_REALLOC(p,sz) HPV::hpv_stbi_realloc(p,sz)
+#define STBI_FREE(p)       HPV::hpv_stbi_free(p)
+
+#include <string.h>
 #include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
 
+#include "HPVBufferPool.hpp"
 #include "stb_dxt.h"
 #include "stb_image.h"
 #include "HPVCreator.hpp"
 
 namespace HPV {
 
-    static HPVCompressionProgress error;
-    
     bool file_supported(const std::string& path)
     {
         if (path.empty())
@@ -31,17 +39,118 @@ namespace HPV {
                 != HPV::supported_filetypes.end());
     }
 
+    HPVConcurrencyTuner::HPVConcurrencyTuner()
+        : workers(1)
+        , best_workers(1)
+        , best_fps(0)
+        , tune_start(0)
+        , window_start(0)
+        , window_frames(0)
+        , warmed_up(false)
+        , done(true)
+    {
+
+    }
+
+    void HPVConcurrencyTuner::start(uint32_t max_workers, uint64_t now)
+    {
+        workers = std::max<uint32_t>(1, max_workers);
+        best_workers = workers;
+        best_fps = 0;
+        tune_start = now;
+        window_start = now;
+        window_frames = 0;
+        warmed_up = false;
+        done = (workers == 1);
+    }
+
+    uint32_t HPVConcurrencyTuner::frame_written(uint64_t now)
+    {
+        ++window_frames;
+
+        // a window needs time and enough frames that every worker finished at least one
+        if (done || now - window_start < HPV_AUTO_TUNE_WINDOW_MS * 1000000ULL || window_frames < workers)
+            return workers;
+
+        double fps = window_frames / ((now - window_start) / 1e9);
+        window_start = now;
+        window_frames = 0;
+
+        if (!warmed_up)
+        {
+            warmed_up = true;
+            return workers;
+        }
+
+        if (fps >= best_fps * (1.0 - HPV_AUTO_TUNE_TOLERANCE))
+        {
+            // as fast (or nearly) with fewer workers: keep the smaller count
+            best_workers = workers;
+            best_fps = std::max(best_fps, fps);
+
+            if (workers > 1 && now - tune_start < HPV_AUTO_TUNE_SECONDS * 1000000000ULL)
+            {
+                workers -= std::max<uint32_t>(1, workers / 4);
+                return workers;
+            }
+        }
+
+        workers = best_workers;
+        done = true;
+        return workers;
+    }
+
     HPVCreator::HPVCreator(int _version) : version(_version)
 	{
-        frame_size_table = nullptr;
         progress_sink = nullptr;
+        bytes_read.store(0, std::memory_order_relaxed);
+        final_state = 0;
         file_names = nullptr;
+        source = &file_source;
+        bands_per_frame = 0;
+        map_input = false;
+        num_workers = 0;
+        writer_type = HPVWriterType::HPV_WRITER_STREAM;
+        resume = false;
+        reused_counter = 0;
+        share_held = false;
+        held_counter = 0;
+        raw_threshold = 0;
+        raw_limit = 0;
+        raw_counter = 0;
+        dxt_compress = nullptr;
+        streaming = false;
+        segment = false;
+        next_item = 0;
+        staged = false;
+        auto_concurrency = false;
+        max_memory = 0;
+        numa_affinity = false;
+        pool = &scheduler;
+        preflight_early = false;
+        ref_channels = 0;
+        channel_mismatches = 0;
+        preflight_next.store(0, std::memory_order_relaxed);
+        preflight_quit.store(false, std::memory_order_relaxed);
+        ref_file_size = 0;
+        peak_in_flight = 0;
+        std::fill(stage_threads, stage_threads + HPV_NUM_STAGES, 0);
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            stage_busy_ns[stage].store(0, std::memory_order_relaxed);
+        }
+        for (int node = 0; node < HPV_MAX_NUMA_NODES; ++node)
+        {
+            node_frames[node].store(0, std::memory_order_relaxed);
+        }
+        write_busy_ns.store(0, std::memory_order_relaxed);
+        idle_ns.store(0, std::memory_order_relaxed);
         should_coordinate.store(false, std::memory_order_relaxed);
 	}
 
 	HPVCreator::~HPVCreator()
 	{
-
+        stop_preflight();
 	}
 
     int HPVCreator::init(const HPVCreatorParams& _params, ThreadSafe_Queue<HPVCompressionProgress> * _progress_sink)
@@ -51,55 +160,51 @@ namespace HPV {
             reset();
         }
 
-        error.state = HPV_CREATOR_STATE_ERROR;
-
-        // this is where post progress messages
-        if (_progress_sink)
         {
-            progress_sink = _progress_sink;
+            std::lock_guard<std::mutex> lock(report_mtx);
+            final_state = 0;
         }
-        else
+        bytes_read.store(0, std::memory_order_relaxed);
+
+        // this is where post progress messages, a callback may take them instead
+        progress_sink = _progress_sink;
+        if (!progress_sink && !progress_callback)
         {
+            report_error("No progress sink or callback to report to");
             return HPV_RET_ERROR;
         }
 
         if (_params.in_path.size() == 0) {
-            error.done_item_name = std::string("Given input path is invalid, size is 0.");
-            progress_sink->push(error);
+            report_error("Given input path is invalid, size is 0.");
             return HPV_RET_ERROR;
 		}
 
         if (_params.out_path.size() == 0)
 		{
-            error.done_item_name = std::string("Given output path is invalid, size is 0.");
-            progress_sink->push(error);
+            report_error("Given output path is invalid, size is 0.");
             return HPV_RET_ERROR;
 		}
 
         if (_params.out_frame < _params.in_frame) {
-            error.done_item_name = std::string("Invalid start or end frame");
-            progress_sink->push(error);
+            report_error("Invalid start or end frame");
             return HPV_RET_ERROR;
 		}
 
 		if (0 >= _params.fps)
 		{
-            error.done_item_name = std::string("Frame rate cannot be <= 0!");
-            progress_sink->push(error);
+            report_error("Frame rate cannot be <= 0!");
             return HPV_RET_ERROR;
 		}
 
 		if (_params.type >= HPVCompressionType::HPV_NUM_TYPES)
 		{
-            error.done_item_name = std::string("Unrecognised compression type!");
-            progress_sink->push(error);
+            report_error("Unrecognised compression type!");
             return HPV_RET_ERROR;
 		}
 
         if (_params.file_names == nullptr)
         {
-            error.done_item_name = std::string("File list is null!");
-            progress_sink->push(error);
+            report_error("File list is null!");
             return HPV_RET_ERROR;
         }
 
@@ -110,53 +215,121 @@ namespace HPV {
 		this->end_idx = _params.out_frame;
 		this->fps = _params.fps;
 		this->type = _params.type;
+        this->bands_per_frame = _params.bands_per_frame;
+        // bands need the whole frame decoded, they split its DXT compression over several workers,
+        // the extra outputs are encoded from the decoded frame as well
+        this->map_input = bands_per_frame <= 1 && _params.extra_outputs.empty();
+        this->writer_type = _params.writer_type;
+        this->resume = _params.resume;
+        this->streaming = _params.streaming;
+        this->segment = _params.segment;
+        this->share_held = _params.share_held_frames;
+        this->raw_threshold = std::min<uint8_t>(_params.store_raw_below, 100);
+        this->dxt_compress = hpv_dxt_kernel(_params.dxt_level);
+        std::copy(_params.stage_threads, _params.stage_threads + HPV_NUM_STAGES, this->stage_threads);
+        this->staged = std::find(stage_threads, stage_threads + HPV_NUM_STAGES, 0) == stage_threads + HPV_NUM_STAGES;
+        this->max_memory = _params.max_memory;
+        this->numa_affinity = _params.numa_affinity;
+        this->pool = _params.worker_pool ? _params.worker_pool : &scheduler;
         this->file_names = _params.file_names;
+        this->source = _params.frame_source ? _params.frame_source : &file_source;
+
+        if (!_params.extra_outputs.empty() && (staged || resume))
+        {
+            report_error("Extra outputs can't be combined with the staged pipeline or resume");
+            return HPV_RET_ERROR;
+        }
+
+        if (!dxt_compress)
+        {
+            report_error(std::string("The ") + hpv_simd_name(static_cast<HPVSimdLevel>(_params.dxt_level)) + " DXT compressor isn't available on this CPU");
+            return HPV_RET_ERROR;
+        }
+
+        if (end_idx < start_idx || end_idx >= file_names->size())
+        {
+            report_error("Frame range is outside of the file list");
+            return HPV_RET_ERROR;
+        }
+
+        // Scan the image headers of all other frames in parallel while the first frame is
+        // loaded: on a network share the scan is mostly waiting for the disk.
+        stop_preflight();
+        preflight_frames.assign(end_idx - start_idx + 1, HPVFrameInfo());
+        preflight_next.store(1, std::memory_order_relaxed);
+        preflight_quit.store(false, std::memory_order_relaxed);
+        channel_mismatches = 0;
+
+        std::size_t num_scanners = std::min<std::size_t>(HPV_PREFLIGHT_THREADS, preflight_frames.size() - 1);
+        for (std::size_t i = 0; i < num_scanners; ++i)
+        {
+            preflight_threads.push_back(std::thread(&HPVCreator::scan_frames, this));
+        }
 
         // We need to load the first image to get it's dimenions. This will serve as a reference
 		// meaning that all other images will need to be the exact same size. 
-		// If not, we will skip that image and try to load the next
 		int w = 0;
 		int h = 0;
 		int ch = 0;
-        std::string name_str = file_names->at(0);
+        std::string name_str = file_names->at(start_idx);
 
 		// check existence of file
-		struct stat buffer;
-        if (stat(name_str.c_str(), &buffer) != 0)
+        if (!source->exists(name_str))
 		{
-            error.done_item_name = "Couldn't reference first file in directory " + name_str;
-            progress_sink->push(error);
+            stop_preflight();
+            report_error("Couldn't reference first file in directory " + name_str);
             return HPV_RET_ERROR;
 		}
 
 		// load the file, always load as RGBA
-        unsigned char * pixels = stbi_load(name_str.c_str(), &w, &h, &ch, 4);
+        unsigned char * first_buf = nullptr;
+        std::size_t first_capacity = 0;
+        std::size_t first_size = 0;
+        unsigned char * pixels = nullptr;
+
+        // peeked, a source that hands out its frames only once still has it for the encode
+        std::size_t first_total = 0;
+        if (source->peek(name_str, 0, &first_buf, &first_capacity, &first_size, &first_total))
+        {
+            pixels = source->decode(first_buf, first_size, &w, &h, &ch);
+            ref_file_size = first_size;
+
+            // the other frames are compared against what their header says
+            int info_w = 0;
+            int info_h = 0;
+            ref_channels = 0;
+            source->info(first_buf, first_size, &info_w, &info_h, &ref_channels);
+        }
+        hpv_aligned_free(first_buf);
 
 		if (!pixels)
 		{
-            error.done_item_name = "Couldn't load pixels for file";
-            progress_sink->push(error);
+            stop_preflight();
+            report_error("Couldn't load pixels for file");
             return HPV_RET_ERROR;
         }
 
+        // only the channel count was needed
+        stbi_image_free(pixels);
+
 		if (w == 0 || w > HPV_MAX_SIDE_SIZE)
 		{
-            error.done_item_name = "File has invalid width";
-            progress_sink->push(error);
+            stop_preflight();
+            report_error("File has invalid width");
             return HPV_RET_ERROR;
         }
 
 		if (h == 0 || h > HPV_MAX_SIDE_SIZE)
 		{
-            error.done_item_name = "File has invalid height";
-            progress_sink->push(error);
+            stop_preflight();
+            report_error("File has invalid height");
             return HPV_RET_ERROR;
         }
 
 		if ( (w % 4 != 0) || (h % 4 != 0))
 		{
-            error.done_item_name = "Input images are not a power of two or less than 4x4.";
-            progress_sink->push(error);
+            stop_preflight();
+            report_error("Input images are not a power of two or less than 4x4.");
             return HPV_RET_ERROR;
         }
 
@@ -184,61 +357,146 @@ namespace HPV {
 		}
 
         HPV_VERBOSE("Reference dimensions are %dx%d, type %s yielding %d bytes per frame", ref_width, ref_height, HPVCompressionTypeStrings[(int)type].c_str(), bytes_per_frame);
+        if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+        {
+            HPV_VERBOSE("CoCg_Y conversion uses the %s version", hpv_simd_name(hpv_ycocg_kernels().back().level));
+        }
+        else
+        {
+            HPVSimdLevel dxt_level = _params.dxt_level < 0 ? hpv_dxt_kernels().back().level : static_cast<HPVSimdLevel>(_params.dxt_level);
+            HPV_VERBOSE("DXT compression uses the %s version", dxt_level == HPV_SIMD_SCALAR ? "stb" : hpv_simd_name(dxt_level));
+        }
+
+        raw_limit = bytes_per_frame - bytes_per_frame * raw_threshold / 100;
+        if (raw_threshold > 0)
+        {
+            HPV_VERBOSE("Frames that LZ4 compresses to more than %d bytes are stored raw", raw_limit);
+        }
 
 		// save first file for later processing
         HPVCompressionWorkItem item;
         
         item.path = name_str;
         item.offset = 0;
-        compression_queue.push(item);
+        work_items.push_back(item);
         
         ++file_counter;
 
-		// go over all the remaining files to check if they are 'good'.
-		// If so, store path in vector to process later. 
-        for (uint32_t i = start_idx+1; i <= end_idx; ++i)
-		{
-            name_str = file_names->at(i);
-
-			// check existence of file
-			struct stat buffer;
-            if (stat(name_str.c_str(), &buffer) != 0)
-			{
-                error.done_item_name = "Couldn't load file" + name_str + ": skipping";
-                progress_sink->push(error);
-				continue;
-			}
-
-			// Valid file, store for later processing. 
-			// During processing we just check the dimensions against the reference dimensions.
-            item.path = name_str;
-            item.offset = file_counter;
-            compression_queue.push(item);
-
-            ++file_counter;
-		}
-        HPV_VERBOSE("Compression queue now has %d items to process.", compression_queue.size());
+        // Early start: the scan hands its frames to the running encode, so the amount of frames
+        // isn't known up front and the frame index goes after the last frame. Otherwise all
+        // frames are validated before anything is written.
+        preflight_early = _params.early_start && !streaming;
+        if (preflight_early)
+        {
+            streaming = true;
+            HPV_VERBOSE("Encoding starts while the remaining %d frames are scanned", preflight_frames.size() - 1);
+        }
+        else
+        {
+            for (uint32_t i = 1; i < preflight_frames.size(); ++i)
+            {
+                if (accept_frame(i) == HPV_RET_ERROR)
+                {
+                    stop_preflight();
+                    work_items.clear();
+                    return HPV_RET_ERROR;
+                }
+            }
+            stop_preflight();
+
+            if (channel_mismatches > 0)
+            {
+                HPV_VERBOSE("%d frames have a different amount of channels than the first frame", channel_mismatches);
+            }
+            HPV_VERBOSE("Compression queue now has %d items to process.", work_items.size());
+        }
+
+        // Keep a checkpoint of everything we write. If the previous encode left one that matches
+        // our settings, its output is moved aside so unchanged frames can be copied from it.
+        // Both stay until this encode completed, a run that crashes or fails resumes from them.
+        if (resume)
+        {
+            HPVCheckpointHeader cp_header;
+            cp_header.magic = HPV_CHECKPOINT_MAGIC;
+            cp_header.version = HPV_CHECKPOINT_VERSION;
+            cp_header.video_width = ref_width;
+            cp_header.video_height = ref_height;
+            cp_header.compression_type = static_cast<uint32_t>(type);
+            cp_header.reserved = 0;
+
+            std::string cp_path = outpath + HPV_CHECKPOINT_EXTENSION;
+            previous_path = outpath + HPV_CHECKPOINT_PREVIOUS_EXTENSION;
+
+            std::string cp_temp_path = cp_path + HPV_CHECKPOINT_TEMP_EXTENSION;
+            struct stat out_stat;
+
+            // A left over output of the previous run means that run was resuming and didn't
+            // complete: the checkpoint still describes that output. Without one, an unfinished
+            // checkpoint belongs to a run that started from scratch and describes our output.
+            bool have_previous = (stat(previous_path.c_str(), &out_stat) == 0);
+            if (!have_previous && stat(cp_temp_path.c_str(), &out_stat) == 0)
+            {
+                rename(cp_temp_path.c_str(), cp_path.c_str());
+            }
+
+            std::size_t known_frames = checkpoint.load(cp_path, cp_header);
+
+            if (known_frames > 0 && have_previous)
+            {
+                HPV_VERBOSE("Checkpoint knows %zu frames, re-using unchanged frames of the unfinished %s", known_frames, previous_path.c_str());
+            }
+            else if (known_frames > 0 && stat(outpath.c_str(), &out_stat) == 0 && rename(outpath.c_str(), previous_path.c_str()) == 0)
+            {
+                HPV_VERBOSE("Checkpoint knows %zu frames, re-using unchanged frames of %s", known_frames, outpath.c_str());
+            }
+            else
+            {
+                // nothing to re-use, the previous output doesn't match the checkpoint either
+                if (have_previous)
+                {
+                    remove(previous_path.c_str());
+                }
+                checkpoint.clear_previous();
+                previous_path = "";
+            }
+
+            if (!checkpoint.open(cp_path, cp_header))
+            {
+                stop_preflight();
+                report_error("Couldn't create checkpoint " + cp_path);
+                return HPV_RET_ERROR;
+            }
+        }
+
+		// open the file writer which will take care of all filewrite operations, frames
+		// rarely compress worse than their DXT size so that's a decent size estimate
+		fs = create_file_writer(writer_type);
 
-		// open the file stream writes which will take care of all filewrite operations 
-		fs = std::make_unique<HPVFileStreamWriter>();
+        uint64_t size_hint = sizeof(uint32_t) * amount_header_fields
+                           + preflight_frames.size() * (sizeof(uint32_t) + bytes_per_frame);
 
-		if (!fs->init(outpath))
+		if (!fs->init(outpath, size_hint, &write_pool))
 		{
 			HPV_ERROR("Error while opening output path %s", outpath.c_str());
+            stop_preflight();
+            checkpoint.close();
+            report_error("Couldn't open output " + outpath);
+            return HPV_RET_ERROR;
 		}
 
 		// fill DXT header struct
 		HPVHeader header;
         header.magic = HPV_MAGIC;
-		header.version = this->version;
+		header.version = (streaming || segment || share_held || raw_threshold > 0) ? std::max(this->version, HPV_VERSION_0_0_7) : this->version;
 		header.video_width = ref_width;
 		header.video_height = ref_height;
 		header.number_of_frames = 0;	// will fill in later, after all valid frames were processed
 		header.frame_rate = fps;
 		header.compression_type = type;
         header.crc_frame_sizes = 0;
-        header.reserved_1 = 0;
-        header.reserved_2 = 0;
+        header.flags = (streaming ? HPV_FLAG_TRAILER_INDEX : 0) | (segment ? HPV_FLAG_SEGMENT : 0) | (share_held ? HPV_FLAG_SHARED_FRAMES : 0)
+                     | (raw_threshold > 0 ? HPV_FLAG_RAW_FRAMES : 0);
+        header.reserved_2 = segment ? start_idx : 0;
 
 		// write the header
 		fs->write_header(header);
@@ -246,283 +504,1509 @@ namespace HPV {
 		// store how many bytes are in header
 		bytes_in_header = fs->get_current_pos();
 
-        // initialize frame size table
-        frame_size_table = new (std::nothrow) uint32_t[compression_queue.size()];
-        if (!frame_size_table)
+        if (streaming)
         {
-            error.done_item_name = "Error allocating memory";
-            progress_sink->push(error);
+            // the amount of frames isn't known yet, the table goes after the last frame
+            bytes_in_framesize_table = 0;
+            appended_items.reset(HPV_STREAM_PENDING_FRAMES);
         }
-
-        for (std::size_t i = 0; i < compression_queue.size(); ++i)
+        else
         {
-			frame_size_table[i] = 0;
+            // reserve room for the frame size table, write empty
+            frame_size_table.assign(work_items.size(), 0);
+            bytes_in_framesize_table = work_items.size() * sizeof(uint32_t);
+            fs->write_to_stream( (const char *)frame_size_table.data(), bytes_in_header, bytes_in_framesize_table);
         }
 
-        // write empty
-        bytes_in_framesize_table = compression_queue.size() * sizeof(uint32_t);
-        fs->write_to_stream( (const char *)frame_size_table, bytes_in_header, bytes_in_framesize_table);
+        // filled in by the writer, in frame order
+        frame_size_table.clear();
+        frame_size_table.reserve(work_items.size());
 
         // save current offset to start writing frame data later
         offset_runner = bytes_in_header + bytes_in_framesize_table;
 
+        // every extra output gets the same header, at its own size and compression type
+        for (std::size_t i = 0; i < _params.extra_outputs.size(); ++i)
+        {
+            std::unique_ptr<HPVOutputVariant> variant = std::make_unique<HPVOutputVariant>();
+            std::string variant_error;
+            if (variant->init(_params.extra_outputs[i], header, ch, streaming ? 0 : work_items.size(), writer_type, dxt_compress, variant_error) == HPV_RET_ERROR)
+            {
+                stop_preflight();
+                variants.clear();
+                fs->close();
+                fs.reset();
+                checkpoint.close();
+                report_error(variant_error);
+                return HPV_RET_ERROR;
+            }
+            variants.push_back(std::move(variant));
+        }
+
+        if (preflight_early)
+        {
+            preflight_emitter = std::make_unique<std::thread>(&HPVCreator::emit_frames, this);
+        }
+
         return HPV_RET_ERROR_NONE;
 	}
 
-    void HPVCreator::coordinate(uint8_t num_threads)
+    void HPVCreator::scan_frames()
     {
-        uint32_t length = static_cast<uint32_t>(compression_queue.size());
+        unsigned char * buf = nullptr;
+        std::size_t capacity = 0;
 
-        uint64_t start = ns();
+        for (;;)
+        {
+            uint32_t idx = preflight_next.fetch_add(1, std::memory_order_relaxed);
+            if (idx >= preflight_frames.size() || preflight_quit.load(std::memory_order_relaxed))
+                break;
 
-        // initialize threads
-        for (uint8_t i = 0; i < num_threads; ++i)
+            const std::string& name = file_names->at(start_idx + idx);
+            std::size_t size = 0;
+            std::size_t total = 0;
+            HPVFrameInfo info;
+
+            if (source->peek(name, HPV_PREFLIGHT_HEADER_BYTES, &buf, &capacity, &size, &total) != HPV_RET_ERROR_NONE)
+            {
+                info.state = HPV_FRAME_MISSING;
+            }
+            else
+            {
+                bool ok = source->info(buf, size, &info.width, &info.height, &info.channels);
+
+                // e.g. a JPEG with a big EXIF block in front of its frame header
+                if (!ok && size < total && source->read(name, &buf, &capacity, &size) == HPV_RET_ERROR_NONE)
+                {
+                    ok = source->info(buf, size, &info.width, &info.height, &info.channels);
+                }
+
+                info.state = ok ? HPV_FRAME_OK : HPV_FRAME_UNREADABLE;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(preflight_mtx);
+                preflight_frames[idx] = info;
+            }
+            preflight_cond.notify_all();
+        }
+
+        hpv_aligned_free(buf);
+    }
+
+    bool HPVCreator::wait_for_frame(uint32_t idx, HPVFrameInfo& info)
+    {
+        std::unique_lock<std::mutex> lock(preflight_mtx);
+        preflight_cond.wait(lock, [this, idx] {
+            return preflight_quit.load(std::memory_order_relaxed) || preflight_frames[idx].state != HPV_FRAME_PENDING;
+        });
+
+        info = preflight_frames[idx];
+        return info.state != HPV_FRAME_PENDING;
+    }
+
+    int HPVCreator::accept_frame(uint32_t idx)
+    {
+        HPVFrameInfo info;
+        if (!wait_for_frame(idx, info))
+            return HPV_RET_ERROR;
+
+        const std::string& name = file_names->at(start_idx + idx);
+
+        if (info.state == HPV_FRAME_MISSING)
         {
-            work_threads.push_back(std::thread(&HPVCreator::process_item, this, i));
+            report_error("Couldn't load file" + name + ": skipping");
+            return HPV_RET_ERROR_NONE;
         }
 
-        // each increment of our counter results in a key to look up a new valid compressed frame
-        items_done_counter = 0;
-        offset_runner = bytes_in_header + bytes_in_framesize_table;
-        uint32_t crc = 0;
+        if (info.state == HPV_FRAME_UNREADABLE)
+        {
+            report_error("Couldn't read the image header of " + name + ": skipping");
+            return HPV_RET_ERROR_NONE;
+        }
 
-        while (should_coordinate.load())
+        if (info.width != ref_width || info.height != ref_height)
         {
-            // Try to fetch item with next key from queue and wait if it's not yet in queue.
-            std::shared_ptr<HPVCompressedItem> item = filestream_queue.wait_and_pop(items_done_counter);
+            std::stringstream ss;
+            ss << "File "
+               << name
+               << " has incorrect dimensions: "
+               << info.width
+               << "x"
+               << info.height
+               << " Should be: "
+               << ref_width
+               << "x"
+               << ref_height;
+            report_error(ss.str());
+            return HPV_RET_ERROR;
+        }
 
-            if (item)
-            {
-                // Writing is key successive, so the writer doesn't have to seek to
-                // non-neighbouring frame positions
-                item->write_pos = offset_runner;
+        if (info.channels != ref_channels)
+        {
+            ++channel_mismatches;
+        }
 
-                fs->write_to_stream(item);
+        // the running encode numbers appended frames itself
+        if (preflight_early)
+        {
+            return appended_items.push(HPVCompressionWorkItem(name, 0)) ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+        }
 
-                if (!fs->is_good())
+        work_items.push_back(HPVCompressionWorkItem(name, file_counter));
+        ++file_counter;
+        return HPV_RET_ERROR_NONE;
+    }
+
+    void HPVCreator::emit_frames()
+    {
+        for (uint32_t i = 1; i < preflight_frames.size(); ++i)
+        {
+            if (accept_frame(i) == HPV_RET_ERROR)
+            {
+                if (!preflight_quit.load(std::memory_order_relaxed))
                 {
-                    error.done_item_name = "Error writing to disk for " + item->path;
-                    progress_sink->push(error);
-                    break;
+                    HPV_ERROR("Scan stopped, encoding the frames accepted so far");
                 }
+                break;
+            }
+        }
 
-                // free the out buffer once it's written to disk
-                free(item->write_out_buf);
-
-                ++items_done_counter;
+        if (channel_mismatches > 0)
+        {
+            HPV_VERBOSE("%d frames have a different amount of channels than the first frame", channel_mismatches);
+        }
 
-                offset_runner += item->frame_size;
-                crc += static_cast<uint32_t>(item->frame_size);
+        finish_input();
+    }
 
-                HPVCompressionProgress progress;
-                progress.state = HPV_CREATOR_STATE_BUSY;
-                progress.total_items = length;
-                progress.done_items = items_done_counter;
-                progress.done_item_name = item->path;
-                progress.compression_ratio = item->compression_ratio;
-                progress_sink->push(progress);
-            }
+    void HPVCreator::stop_preflight()
+    {
+        {
+            std::lock_guard<std::mutex> lock(preflight_mtx);
+            preflight_quit.store(true, std::memory_order_relaxed);
+        }
+        preflight_cond.notify_all();
 
-            // wrote all DXT frames to disk
-            if (items_done_counter == length && compression_queue.empty())
-            {
-                should_coordinate.store(false, std::memory_order_relaxed);
-            }
+        // an emitter blocked on a full queue is woken by closing it
+        if (preflight_emitter)
+        {
+            appended_items.close();
+            preflight_emitter->join();
+            preflight_emitter.reset();
         }
 
-        // join all threads
-        std::for_each(work_threads.begin(), work_threads.end(), std::mem_fn(&std::thread::join));
-        
-        uint64_t end = ns();
+        for (std::size_t i = 0; i < preflight_threads.size(); ++i)
+        {
+            preflight_threads[i].join();
+        }
+        preflight_threads.clear();
+    }
 
-        uint64_t compressed_total_size = 0;
+    int HPVCreator::append_frame(const std::string& path)
+    {
+        if (!streaming)
+        {
+            HPV_ERROR("Frames can only be appended to a streaming encode");
+            return HPV_RET_ERROR;
+        }
 
-        for (uint32_t i = 0; i < items_done_counter; ++i)
+        // blocks while HPV_STREAM_PENDING_FRAMES frames are waiting to be encoded
+        if (!appended_items.push(HPVCompressionWorkItem(path, 0)))
         {
-            compressed_total_size += frame_size_table[i];
+            HPV_ERROR("Input was already finished, can't append %s", path.c_str());
+            return HPV_RET_ERROR;
         }
 
-        // rewrite our successful frames in the header
-        fs->write_to_stream((const char *)&length, 16, 4);
+        return HPV_RET_ERROR_NONE;
+    }
 
-        // in the end: rewrite crc of frame sizes table
-        fs->write_to_stream((const char *)&crc, 28, 4);
+    void HPVCreator::finish_input()
+    {
+        // the encode completes once the appended frames are written
+        appended_items.close();
+    }
 
-        // rewrite our frame sizes table
-        fs->write_to_stream((const char *)frame_size_table, bytes_in_header, bytes_in_framesize_table);
+    bool HPVCreator::next_work_item(HPVCompressionWorkItem& item, bool wait)
+    {
+        // the frames known at init() go first
+        if (next_item < work_items.size())
+        {
+            item = work_items[next_item++];
+            return true;
+        }
 
-        // close the file stream
-        fs->close();
+        if (!streaming)
+            return false;
 
-        HPVCompressionProgress done;
-        std::stringstream ss;
-        ss  << "Done converting images to "
-            << outpath
-            << std::endl
-            << "Converting took: "
-            << (end-start) / 1e9
-            << " seconds"
-            << std::endl
-            << "Final size (LZ4 HQ level 9) is: "
-            << compressed_total_size / 1e9
-            << " GB";
+        // wait for a new frame only when the pipeline ran dry, returns false once the input is finished
+        if (!(wait ? appended_items.pop(item) : appended_items.try_pop(item)))
+            return false;
 
-        done.state = HPV_CREATOR_STATE_DONE;
-        done.done_item_name = ss.str();
-        progress_sink->push(done);
+        item.offset = next_item++;
+        return true;
     }
 
-    void HPVCreator::process_item(uint8_t thread_idx)
+    void HPVCreator::coordinate(uint8_t num_threads)
     {
-        // wait thread_idx * 100ms before starting, to avoid all threads rushing to
-        // start fetching items from compression queue
-        std::this_thread::sleep_for(std::chrono::milliseconds(thread_idx * 100));
+        uint64_t start = ns();
 
-        // if our output stream doesn't exist, quit
-        if (!fs->is_good())
+        // The compression queue only ever holds the frames that are allowed to be in flight. The
+        // writer hands out a new work item for every frame it has written, so the workers block
+        // on an empty queue exactly when the writer falls behind.
+        std::size_t max_in_flight = static_cast<std::size_t>(num_threads) * IN_FLIGHT_ITEMS_PER_THREAD;
+        std::size_t in_flight = 0;
+        next_item = 0;
+
+        if (staged)
         {
-            error.done_item_name = "No filestream writer!";
-            progress_sink->push(error);
-            return;
+            // every stage worker holds one frame and a few wait in front of every stage
+            max_in_flight = HPV_NUM_STAGES * IN_FLIGHT_ITEMS_PER_STAGE;
+            for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+            {
+                max_in_flight += stage_threads[stage];
+            }
         }
 
-        // otherwise:
-        // - do some checking on the file
-        // - load pixels
-        // - compress pixels to corresponding BC format
-        // - write to thread-safe FileStreamWriter
-        int w = 0;
-        int h = 0;
-        int channels = 0;
-
-        while (!compression_queue.empty())
+        // The memory budget caps the frames in flight, the writer's backpressure does the rest. At
+        // least one frame is always allowed, a budget below that just encodes frame by frame.
+        std::size_t max_workers = num_threads;
+        if (max_memory > 0)
         {
-            // wait a bit when file stream writer already has a lot of work
-            if (filestream_queue.size() > PROCESSED_SIZE_BARRIER)
+            std::size_t budget_frames = static_cast<std::size_t>(std::max<uint64_t>(1, max_memory / frame_memory()));
+            if (max_memory < frame_memory())
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(PROCESSED_BARRIER_SLEEPTIME));
+                HPV_VERBOSE("Memory budget of %.2f MB is below the %.2f MB one frame needs, encoding one frame at a time",
+                            max_memory / 1048576.0, frame_memory() / 1048576.0);
             }
 
-            // try to load one item from the compression queue
-            std::shared_ptr<HPVCompressionWorkItem> item = compression_queue.try_pop();
+            max_in_flight = std::min(max_in_flight, budget_frames);
+
+            // a worker keeps its frame buffers around, so there's no use in more of them than frames
+            max_workers = std::min(max_workers, budget_frames);
+
+            HPV_VERBOSE("Memory budget of %.2f MB allows %d frames of %.2f MB in flight",
+                        max_memory / 1048576.0, max_in_flight, frame_memory() / 1048576.0);
+        }
+        peak_in_flight = 0;
+
+        // only the staged pipeline takes its frames from the compression queue
+        compression_queue.reset(max_in_flight);
+        filestream_queue.reset(max_in_flight);
+        write_pool.init(LZ4_COMPRESSBOUND(bytes_per_frame));
+        for (std::size_t i = 0; i < variants.size(); ++i)
+        {
+            variants[i]->start(max_in_flight);
+        }
+        num_workers = num_threads;
+
+        // stb_dxt builds its lookup tables on first use, do that before the workers race for it
+        unsigned char dummy_block[64] = { 0 };
+        unsigned char dummy_dxt[16];
+        stb_compress_dxt_block(dummy_dxt, dummy_block, 1, 10);
 
-            if (item)
+        // initialize threads
+        if (staged)
+        {
+            // one slot per frame in flight, their buffers are allocated on first use
+            frame_slots.clear();
+            free_slots.reset(max_in_flight);
+            for (std::size_t i = 0; i < max_in_flight; ++i)
+            {
+                frame_slots.push_back(std::unique_ptr<HPVFrameSlot>(new HPVFrameSlot()));
+                free_slots.push(frame_slots.back().get());
+            }
+
+            for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
             {
-                unsigned char* pixels = nullptr;
-                std::size_t compressed_size = 0;
+                stage_queues[stage].reset(max_in_flight);
 
-                unsigned char* dxt = new(std::nothrow) unsigned char[bytes_per_frame];
-                if (!dxt)
+                for (uint8_t i = 0; i < stage_threads[stage]; ++i)
                 {
-                    error.done_item_name = "Failed to allocate the texture compressed buffer.";
-                    progress_sink->push(error);
-                    break;
+                    work_threads.push_back(std::thread(&HPVCreator::process_stage, this, static_cast<HPVPipelineStage>(stage)));
                 }
+            }
 
-                std::size_t write_buf_size = LZ4_COMPRESSBOUND(bytes_per_frame);
-                char* write_buf = new(std::nothrow) char[write_buf_size];
-                if (!write_buf)
+            HPV_VERBOSE("Staged pipeline: %d load, %d convert, %d dxt, %d lz4 workers, %d frames in flight",
+                        stage_threads[HPV_STAGE_LOAD], stage_threads[HPV_STAGE_CONVERT], stage_threads[HPV_STAGE_DXT], stage_threads[HPV_STAGE_LZ4], max_in_flight);
+            if (numa_affinity)
+            {
+                HPV_VERBOSE("NUMA affinity only applies to the fused pipeline, ignored");
+            }
+        }
+        else
+        {
+            if (pool == &scheduler)
+            {
+                // workers are pinned round-robin per node: a frame is decoded, DXT and LZ4 compressed
+                // by one worker, so all its memory is first touched on, and stays on, that node
+                std::vector<HPVNumaNode> nodes;
+                if (numa_affinity)
                 {
-                    error.done_item_name = "Failed to allocate the L4Z compressed write buffer.";
-                    progress_sink->push(error);
-                    break;
+                    nodes = hpv_numa_nodes();
+                    for (std::size_t i = 0; i < nodes.size(); ++i)
+                    {
+                        HPV_VERBOSE("NUMA node %d: %d CPUs", nodes[i].id, static_cast<int>(nodes[i].cpus.size()));
+                    }
                 }
 
-                // load the file, always load as RGBA
-                pixels = stbi_load(item->path.c_str(), &w, &h, &channels, 4);
-
-                if (!pixels)
+                // arenas were first touched by workers of another placement, let them be allocated again
+                if (nodes.size() != numa_nodes.size())
                 {
-                    error.done_item_name = "Failed to load pixel data from " + item->path;
-                    progress_sink->push(error);
-                    delete [] dxt;
-                    delete [] write_buf;
-                    break;
+                    frame_workers.clear();
                 }
+                numa_nodes = nodes;
+                scheduler.set_affinity(numa_nodes);
 
-                if (w != ref_width && h != ref_height)
+                // the scheduler's workers outlive this encode, their scratch memory too
+                scheduler.set_workers(num_threads);
+                scheduler.set_active(max_workers);
+                if (auto_concurrency)
                 {
-                    std::stringstream ss;
-                    ss << "File "
-                       << item->path
-                       << " has incorrect dimensions: "
-                       << w
-                       << "x"
-                       << h
-                       << " Should be: "
-                       << ref_width
-                       << "x"
-                       << ref_height
-                       << std::endl
-                       << "Signaling stop";
-                    error.done_item_name = ss.str();
-                    progress_sink->push(error);
-                    stbi_image_free(pixels);
-                    delete [] dxt;
-                    delete [] write_buf;
-                    break;
+                    tuner.start(static_cast<uint32_t>(max_workers), start);
                 }
+            }
+            else
+            {
+                // a shared pool is set up by its owner, other encodes are running on it
+                numa_nodes.clear();
+            }
+            while (frame_workers.size() < num_threads)
+            {
+                frame_workers.push_back(std::unique_ptr<HPVFrameWorker>(new HPVFrameWorker()));
+            }
 
-                // We are ready to compress our input pixels. Different methods apply:
-                //
-                // - RGB pixels can be compressed as
-                //		* DXT1:			[RGB input]:	ok image quality, no alpha, 0.5 bpp
-                //		* scaled DXT5:	[CoCg_Y input]:	good image quality, no alpha, 1bpp
-                //
-                // - RGBA pixels can be compressed as:
-                //		* DXT5:			[RGBA input]:	ok image quality, alpha with good gradients, 1bpp
-                if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type)
+            for (uint8_t i = 0; i < num_threads; ++i)
+            {
+                HPVFrameWorker& worker = *frame_workers[i];
+                worker.last_task_end = start;
+                worker.previous.close();
+                worker.previous.clear();
+                if (!previous_path.empty())
                 {
-                    rygCompress(dxt, pixels, w, h, false);
+                    worker.previous.open(previous_path.c_str(), std::ios::binary | std::ios::in);
                 }
-                else if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == type)
-                {
-                    rygCompress(dxt, pixels, w, h, true);
+            }
+        }
+
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            stage_busy_ns[stage].store(0, std::memory_order_relaxed);
+        }
+        write_busy_ns.store(0, std::memory_order_relaxed);
+        idle_ns.store(0, std::memory_order_relaxed);
+        for (int node = 0; node < HPV_MAX_NUMA_NODES; ++node)
+        {
+            node_frames[node].store(0, std::memory_order_relaxed);
+        }
+
+        // each increment of our counter results in a key to look up a new valid compressed frame
+        items_done_counter = 0;
+        reused_counter = 0;
+        held_counter = 0;
+        raw_counter = 0;
+        held_hashes.clear();
+        shared_payloads.clear();
+        reused_payloads.clear();
+        offset_runner = bytes_in_header + bytes_in_framesize_table;
+        uint64_t first_frame_pos = offset_runner;
+        uint32_t crc = 0;
+        bool output_failed = false;
+
+        HPVCompressedItem item;
+        HPVCompressionWorkItem work_item;
+
+        while (should_coordinate.load())
+        {
+            // keep the pipeline filled, while streaming wait for new input when it ran dry
+            while (in_flight < max_in_flight && next_work_item(work_item, in_flight == 0))
+            {
+                // read-ahead: the file is fetched while the frame waits for a loader
+                if (staged)
+                {
+                    hpv_prefetch_file(work_item.path);
+                }
+
+                if (staged)
+                {
+                    compression_queue.push(work_item);
+                }
+                else
+                {
+                    submit_task(work_item);
+                }
+                ++in_flight;
+                peak_in_flight = std::max(peak_in_flight, in_flight);
+            }
+
+            // wrote all DXT frames to disk
+            if (in_flight == 0)
+            {
+                break;
+            }
+
+            // Fetch the item with the next key in line, wait if it is not there yet.
+            // Only fails when the queue was closed by stop().
+            if (!filestream_queue.wait_and_pop(item))
+            {
+                break;
+            }
+
+            --in_flight;
+
+            // A frame with the same DXT data as one that is on disk already only gets a table
+            // entry that points at that frame. Workers only skip the LZ4 stage for frames behind
+            // the first one with their DXT data, so that frame has been written by now.
+            // Frames re-used from the previous encode weren't DXT compressed, equal payloads
+            // tell those apart.
+            uint32_t table_entry = static_cast<uint32_t>(item.frame_size) | (item.raw ? HPV_FRAME_RAW : 0);
+            const HPVSharedPayload * shared = nullptr;
+            if (share_held)
+            {
+                std::unordered_map<uint64_t, HPVSharedPayload>::const_iterator it;
+                if (item.dxt_hash != 0 && (it = shared_payloads.find(item.dxt_hash)) != shared_payloads.end())
+                {
+                    shared = &it->second;
+                }
+                else if (item.reused && (it = reused_payloads.find(item.payload_hash)) != reused_payloads.end())
+                {
+                    shared = &it->second;
+                }
+            }
+
+            if (shared)
+            {
+                write_pool.release(reinterpret_cast<unsigned char *>(item.write_out_buf));
+                item.write_pos = shared->offset;
+                item.frame_size = shared->frame_size;
+                item.payload_hash = shared->payload_hash;
+                item.raw = shared->raw;
+                table_entry = HPV_FRAME_REFERENCE | shared->frame_index;
+                ++held_counter;
+            }
+            else if (!item.write_out_buf)
+            {
+                report_error("Lost the frame that " + item.path + " is a copy of");
+                output_failed = true;
+                break;
+            }
+            else
+            {
+                // Writing is key successive, so the writer doesn't have to seek to
+                // non-neighbouring frame positions
+                item.write_pos = offset_runner;
+
+                // the writer recycles the out buffer once it's on disk
+                uint64_t write_start = ns();
+                fs->write_to_stream(item);
+                write_busy_ns.fetch_add(ns() - write_start, std::memory_order_relaxed);
+
+                if (!fs->is_good())
+                {
+                    report_error("Error writing to disk for " + item.path);
+                    output_failed = true;
+                    break;
+                }
+
+                if (share_held)
+                {
+                    HPVSharedPayload payload;
+                    payload.frame_index = items_done_counter;
+                    payload.offset = item.write_pos;
+                    payload.frame_size = static_cast<uint32_t>(item.frame_size);
+                    payload.payload_hash = item.payload_hash;
+                    payload.raw = item.raw;
+                    if (item.dxt_hash != 0)
+                    {
+                        shared_payloads[item.dxt_hash] = payload;
+                    }
+                    if (item.payload_hash != 0)
+                    {
+                        reused_payloads.insert(std::make_pair(item.payload_hash, payload));
+                    }
+                }
+
+                offset_runner += item.frame_size;
+                if (item.raw)
+                {
+                    ++raw_counter;
                 }
-                else if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+            }
+
+            if (checkpoint.is_open())
+            {
+                HPVCheckpointEntry entry;
+                entry.source_hash = item.source_hash;
+                entry.payload_hash = item.payload_hash;
+                entry.offset = item.write_pos;
+                entry.frame_size = static_cast<uint32_t>(item.frame_size) | (item.raw ? HPV_FRAME_RAW : 0);
+                entry.frame_index = items_done_counter;
+                checkpoint.append(entry);
+            }
+
+            if (item.reused)
+            {
+                ++reused_counter;
+            }
+
+            ++items_done_counter;
+
+            crc += table_entry;
+            frame_size_table.push_back(table_entry);
+
+            HPVCompressionProgress progress;
+            progress.state = HPV_CREATOR_STATE_BUSY;
+            progress.total_items = static_cast<int32_t>(std::max(next_item, work_items.size()));
+            progress.done_items = items_done_counter;
+            progress.done_item_name = item.path;
+            progress.compression_ratio = item.compression_ratio;
+            progress.frame_buffer_allocations = hpv_frame_buffer_allocations();
+            progress.times = get_stage_times();
+            std::copy(item.stage_ns, item.stage_ns + HPV_NUM_STAGES, progress.frame_ns);
+            progress.compression_queue_depth = static_cast<uint32_t>(staged ? compression_queue.size() : pool->pending());
+            progress.filestream_queue_depth = static_cast<uint32_t>(filestream_queue.size());
+            progress.active_workers = static_cast<uint32_t>(staged ? work_threads.size() : pool->get_workers());
+            progress.bytes_read = bytes_read.load(std::memory_order_relaxed);
+            progress.bytes_written = offset_runner - first_frame_pos;
+            progress.elapsed_seconds = (ns() - start) / 1e9;
+            progress.bytes_per_second = progress.bytes_written / progress.elapsed_seconds;
+            progress.read_bytes_per_second = progress.bytes_read / progress.elapsed_seconds;
+            progress.frames_per_second = items_done_counter / progress.elapsed_seconds;
+            if (!streaming)
+            {
+                progress.eta_seconds = (progress.total_items - progress.done_items) / progress.frames_per_second;
+            }
+            report(progress);
+
+            if (auto_concurrency && !tuner.is_done())
+            {
+                scheduler.set_active(tuner.frame_written(ns()));
+
+                if (tuner.is_done())
                 {
-                    // YCoCg conversion if DXT5
-                    ConvertRGBToCoCg_Y(pixels, w, h);
+                    HPV_VERBOSE("Auto concurrency settled on %d workers at %.1f frames/s", tuner.get_workers(), tuner.get_best_fps());
+                }
+            }
+        }
+
+        should_coordinate.store(false, std::memory_order_relaxed);
+
+        // all frames are written (or we bailed out early): release the waiting workers
+        compression_queue.close();
+        filestream_queue.close();
+        free_slots.close();
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            stage_queues[stage].close();
+        }
+
+        // every frame the main output got is in the extra outputs too, completing them ends their
+        // writers, which releases the workers still waiting to hand them a frame
+        for (std::size_t i = 0; i < variants.size(); ++i)
+        {
+            if (variants[i]->finish(items_done_counter) == HPV_RET_ERROR)
+            {
+                report_error("Error writing to disk for " + variants[i]->get_path());
+            }
+        }
+
+        // join all threads, wait for the tasks that are still running or cancelled
+        std::for_each(work_threads.begin(), work_threads.end(), std::mem_fn(&std::thread::join));
+        work_threads.clear();
+        frame_slots.clear();
+        frame_tasks.wait();
+        for (std::size_t i = 0; i < frame_workers.size(); ++i)
+        {
+            frame_workers[i]->previous.close();
+        }
+        
+        uint64_t end = ns();
+
+        uint64_t compressed_total_size = 0;
+
+        for (uint32_t i = 0; i < items_done_counter; ++i)
+        {
+            // held frames have no payload of their own
+            if (!share_held || !(frame_size_table[i] & HPV_FRAME_REFERENCE))
+            {
+                compressed_total_size += frame_size_table[i] & ~(raw_threshold > 0 ? HPV_FRAME_RAW : 0);
+            }
+        }
+
+        uint32_t length = items_done_counter;
+        bool written = !output_failed;
+
+        if (streaming)
+        {
+            // append the frame sizes table as trailer
+            bytes_in_framesize_table = frame_size_table.size() * sizeof(uint32_t);
+            written = (fs->write_to_stream((const char *)frame_size_table.data(), offset_runner, bytes_in_framesize_table) == 1) && written;
+        }
+        else
+        {
+            // the table was sized for all frames, frames that didn't make it keep size 0
+            length = static_cast<uint32_t>(work_items.size());
+            frame_size_table.resize(length, 0);
+
+            // rewrite our frame sizes table
+            written = (fs->write_to_stream((const char *)frame_size_table.data(), bytes_in_header, bytes_in_framesize_table) == 1) && written;
+        }
+
+        // rewrite our successful frames in the header
+        written = (fs->write_to_stream((const char *)&length, 16, 4) == 1) && written;
+
+        // in the end: rewrite crc of frame sizes table
+        written = (fs->write_to_stream((const char *)&crc, 28, 4) == 1) && written;
+
+        // close the file stream, frame writes still in flight only report their errors here
+        written = (fs->close() == HPV_RET_ERROR_NONE) && written;
+
+        if (!written)
+        {
+            // keep the checkpoint and the previous output, the next run resumes from them
+            checkpoint.close();
+            report_error("Error writing to disk for " + outpath);
+            return;
+        }
+
+        // everything worth keeping of the previous encode is in the new output by now
+        if (checkpoint.is_open() && !checkpoint.commit())
+        {
+            report_error("Couldn't replace the checkpoint of " + outpath);
+            return;
+        }
+        checkpoint.clear_previous();
+        if (!previous_path.empty())
+        {
+            remove(previous_path.c_str());
+        }
+
+        HPVCompressionProgress done;
+        std::stringstream ss;
+        ss  << "Done converting images to "
+            << outpath
+            << std::endl
+            << "Converting took: "
+            << (end-start) / 1e9
+            << " seconds"
+            << std::endl
+            << "Final size (LZ4 HQ level 9) is: "
+            << compressed_total_size / 1e9
+            << " GB"
+            << std::endl
+            << "Frame buffer allocations: "
+            << hpv_frame_buffer_allocations();
+
+        if (auto_concurrency)
+        {
+            ss  << std::endl
+                << "Auto concurrency: "
+                << scheduler.get_workers()
+                << " of "
+                << static_cast<int>(num_threads)
+                << " workers";
+            if (tuner.get_best_fps() > 0)
+            {
+                ss << " at " << tuner.get_best_fps() << " frames/s";
+            }
+            if (!tuner.is_done())
+            {
+                ss << " (encode finished before tuning did)";
+            }
+        }
 
-                    // DXT compress
-                    CompressYCoCgDXT5(pixels, dxt, w, h, w * 4);
+        if (staged)
+        {
+            // The tuner only parks workers of the fused pipeline. What every stage keeps up with at
+            // its worker count shows where more workers pay off; frames that were re-used or held
+            // skipped the later stages, so those rates are a bit optimistic.
+            HPVStageTimes stage_times = get_stage_times();
+            double rates[HPV_NUM_STAGES];
+            int slowest = HPV_STAGE_LOAD;
+            for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+            {
+                rates[stage] = stage_times.busy_ns[stage] > 0 ? items_done_counter * stage_threads[stage] / (stage_times.busy_ns[stage] / 1e9) : 0;
+                if (rates[stage] > 0 && (rates[slowest] == 0 || rates[stage] < rates[slowest]))
+                {
+                    slowest = stage;
                 }
+            }
+
+            ss  << std::endl
+                << "Stage workers "
+                << static_cast<int>(stage_threads[HPV_STAGE_LOAD]) << ","
+                << static_cast<int>(stage_threads[HPV_STAGE_CONVERT]) << ","
+                << static_cast<int>(stage_threads[HPV_STAGE_DXT]) << ","
+                << static_cast<int>(stage_threads[HPV_STAGE_LZ4])
+                << " keep up with "
+                << std::fixed << std::setprecision(1);
+            for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+            {
+                ss << (stage > 0 ? ", " : "") << HPVPipelineStageStrings[stage] << " " << rates[stage];
+            }
+            ss  << " frames/s, "
+                << HPVPipelineStageStrings[slowest]
+                << " is the bottleneck";
+        }
+
+        ss  << std::endl
+            << "Peak frame memory: "
+            << std::fixed << std::setprecision(2)
+            << (peak_in_flight * frame_memory()) / 1048576.0
+            << " MB ("
+            << peak_in_flight
+            << " frames in flight)";
+        if (max_memory > 0)
+        {
+            ss << " of a " << max_memory / 1048576.0 << " MB budget";
+        }
+#if !defined(_WIN32)
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+            // kilobytes on Linux, bytes on macOS
+#if defined(__APPLE__)
+            ss << ", peak RSS " << usage.ru_maxrss / 1048576.0 << " MB";
+#else
+            ss << ", peak RSS " << usage.ru_maxrss / 1024.0 << " MB";
+#endif
+        }
+#endif
+
+        if (!staged && !numa_nodes.empty())
+        {
+            for (std::size_t i = 0; i < numa_nodes.size() && i < HPV_MAX_NUMA_NODES; ++i)
+            {
+                uint64_t frames = node_frames[i].load(std::memory_order_relaxed);
+                ss  << std::endl
+                    << "NUMA node "
+                    << numa_nodes[i].id
+                    << ": "
+                    << frames
+                    << " frames, "
+                    << frames / ((end - start) / 1e9)
+                    << " frames/s";
+            }
+        }
+
+        if (resume)
+        {
+            ss  << std::endl
+                << "Re-used "
+                << reused_counter
+                << " frames of the previous encode";
+        }
+
+        ss  << std::endl
+            << "Frames stored with LZ4: "
+            << items_done_counter - held_counter - raw_counter
+            << ", raw: "
+            << raw_counter;
+
+        if (share_held)
+        {
+            ss  << std::endl
+                << "Held frames: "
+                << held_counter
+                << " of "
+                << items_done_counter
+                << " frames share the payload of an earlier frame";
+        }
+
+        for (std::size_t i = 0; i < variants.size(); ++i)
+        {
+            ss  << std::endl
+                << "Extra output "
+                << variants[i]->get_path()
+                << ": "
+                << variants[i]->get_width()
+                << "x"
+                << variants[i]->get_height()
+                << " "
+                << HPVCompressionTypeStrings[(int)variants[i]->get_type()]
+                << ", "
+                << variants[i]->get_compressed_size() / 1048576.0
+                << " MB";
+        }
+
+        done.state = HPV_CREATOR_STATE_DONE;
+        done.done_item_name = ss.str();
+        done.total_items = items_done_counter;
+        done.done_items = items_done_counter;
+        done.frame_buffer_allocations = hpv_frame_buffer_allocations();
+        done.times = get_stage_times();
+        done.active_workers = static_cast<uint32_t>(staged ? work_threads.size() : pool->get_workers());
+        done.bytes_read = bytes_read.load(std::memory_order_relaxed);
+        done.bytes_written = compressed_total_size;
+        done.elapsed_seconds = (end - start) / 1e9;
+        done.bytes_per_second = done.bytes_written / done.elapsed_seconds;
+        done.read_bytes_per_second = done.bytes_read / done.elapsed_seconds;
+        done.frames_per_second = items_done_counter / done.elapsed_seconds;
+        done.eta_seconds = 0;
+        report(done);
+    }
+
+    void HPVCreator::submit_task(const HPVCompressionWorkItem& item)
+    {
+        pool->submit(frame_tasks, [this, item](std::size_t worker_idx) { run_task(item, worker_idx); });
+    }
+
+    void HPVCreator::run_task(const HPVCompressionWorkItem& item, std::size_t worker_idx)
+    {
+        HPVFrameWorker& worker = *frame_workers[worker_idx];
+        idle_ns.fetch_add(ns() - worker.last_task_end, std::memory_order_relaxed);
 
-                // compress resulting DXT buffer more with LZ4
-                compressed_size = LZ4_compress_HC((const char *)dxt, write_buf, static_cast<int>(bytes_per_frame), static_cast<int>(bytes_per_frame), HPV_LZ4_COMPRESSION_LEVEL);
+        // stopped while this task was waiting, the writer won't take anything anymore
+        if (should_coordinate.load(std::memory_order_relaxed))
+        {
+            if (item.band_job)
+            {
+                // another worker split up its frame, help compressing it
+                uint64_t band_stamp = ns();
+                compress_bands(*item.band_job);
+                account(HPV_STAGE_DXT, band_stamp);
+            }
+            else
+            {
+                process_item(item, worker);
+                node_frames[std::min<std::size_t>(hpv_current_node(), HPV_MAX_NUMA_NODES - 1)].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        worker.last_task_end = ns();
+    }
+
+    void HPVCreator::process_item(HPVCompressionWorkItem item, HPVFrameWorker& worker)
+    {
+        // if our output stream doesn't exist, quit
+        if (!fs->is_good())
+        {
+            report_error("No filestream writer!");
+            return;
+        }
+
+        // otherwise:
+        // - do some checking on the file
+        // - load pixels
+        // - compress pixels to corresponding BC format
+        // - write to thread-safe FileStreamWriter
+        int w = 0;
+        int h = 0;
+        int channels = 0;
+
+        // all scratch memory of this worker is allocated once and re-used for every frame
+        HPVWorkerArena& arena = worker.arena;
+        if (!arena.reserve(bytes_per_frame, static_cast<std::size_t>(ref_width) * 4 * 4))
+        {
+            report_error("Failed to allocate the texture compressed buffer.");
+            return;
+        }
+
+        // output of the previous encode, unchanged frames are copied from it
+        std::ifstream& previous = worker.previous;
+
+        uint64_t stamp = ns();
 
-                if (compressed_size == 0)
+        unsigned char* pixels = nullptr;
+        unsigned char* dxt = arena.dxt;
+
+        // recycled buffer, handed back to the pool by the writer
+        char* write_buf = reinterpret_cast<char *>(write_pool.acquire());
+        if (!write_buf)
+        {
+            report_error("Failed to allocate the L4Z compressed write buffer.");
+            return;
+        }
+
+        uint64_t source_hash = 0;
+
+        // Uncompressed files are mapped and compressed in place: no read buffer and no decoded
+        // copy of the frame, the rows are expanded to RGBA a block row at a time.
+        HPVMappedImage image;
+        bool mapped = map_input && source->map(item.path, image);
+
+        // load the file, always load as RGBA
+        if (mapped || source->read(item.path, &arena.file_buf, &arena.file_capacity, &arena.file_size))
+        {
+            account(HPV_STAGE_LOAD, stamp, item.stage_ns);
+            bytes_read.fetch_add(mapped ? image.size() : arena.file_size, std::memory_order_relaxed);
+
+            if (resume)
+            {
+                source_hash = mapped ? hpv_hash(image.data(), image.size()) : hpv_hash(arena.file_buf, arena.file_size);
+
+                // source didn't change since the previous encode: no need to compress it again
+                if (reuse_previous_frame(item, previous, source_hash, write_buf, stamp))
                 {
-                    HPV_VERBOSE("Error LZ4 compressing DXT frame");
-                    continue;
+                    return;
                 }
+            }
+
+            if (mapped)
+            {
+                w = image.get_width();
+                h = image.get_height();
+            }
+            else
+            {
+                pixels = source->decode(arena.file_buf, arena.file_size, &w, &h, &channels);
+                account(HPV_STAGE_CONVERT, stamp, item.stage_ns);
+            }
+        }
 
-                // write compressed size to frame size index table
-                frame_size_table[item->offset] = static_cast<uint32_t>(compressed_size);
+        if (!pixels && !mapped)
+        {
+            report_error("Failed to load pixel data from " + item.path);
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+            return;
+        }
 
-                HPVCompressedItem compressed_item;
-                compressed_item.write_out_buf       = write_buf;
-                compressed_item.frame_size          = compressed_size;
-                compressed_item.path                = item->path;
-                compressed_item.compression_ratio   = (compressed_size / (float)bytes_per_frame) * 100.f;
-                filestream_queue.push(compressed_item, item->offset);
+        if (w != ref_width || h != ref_height)
+        {
+            std::stringstream ss;
+            ss << "File "
+               << item.path
+               << " has incorrect dimensions: "
+               << w
+               << "x"
+               << h
+               << " Should be: "
+               << ref_width
+               << "x"
+               << ref_height
+               << std::endl
+               << "Signaling stop";
+            report_error(ss.str());
+            stbi_image_free(pixels);
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+            return;
+        }
 
-                // clear pixels and dxt buffers for next image, write buffer will be freed by writer
+        // the extra outputs go first, the main output's YCoCg conversion overwrites the pixels
+        for (std::size_t i = 0; i < variants.size(); ++i)
+        {
+            if (!variants[i]->encode(pixels, w, h, item.offset, arena))
+            {
+                report_error("Failed to compress " + item.path + " for " + variants[i]->get_path());
                 stbi_image_free(pixels);
-                delete [] dxt;
+                write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+                return;
+            }
+        }
+        if (!variants.empty())
+        {
+            account(HPV_STAGE_DXT, stamp, item.stage_ns);
+        }
+
+        // We are ready to compress our input pixels. Different methods apply:
+        //
+        // - RGB pixels can be compressed as
+        //		* DXT1:			[RGB input]:	ok image quality, no alpha, 0.5 bpp
+        //		* scaled DXT5:	[CoCg_Y input]:	good image quality, no alpha, 1bpp
+        //
+        // - RGBA pixels can be compressed as:
+        //		* DXT5:			[RGBA input]:	ok image quality, alpha with good gradients, 1bpp
+        if (mapped)
+        {
+            compress_mapped(image, arena.strip, dxt);
+            image.close();
+        }
+        else if (bands_per_frame > 1)
+        {
+            std::shared_ptr<HPVBandJob> job = std::make_shared<HPVBandJob>();
+            job->pixels = pixels;
+            job->dxt = dxt;
+            job->width = w;
+            job->height = h;
+            job->type = type;
+            // bands cover whole block rows
+            job->rows_per_band = ((h / 4 + bands_per_frame - 1) / bands_per_frame) * 4;
+            job->num_bands = static_cast<uint32_t>((h + job->rows_per_band - 1) / job->rows_per_band);
+            job->next_band.store(0, std::memory_order_relaxed);
+            job->bands_done.store(0, std::memory_order_relaxed);
+
+            // Ask idle workers for help: the requests sit in this worker's deque for others to
+            // steal. The bands nobody picks up in time are compressed by this thread.
+            HPVCompressionWorkItem help_request;
+            help_request.band_job = job;
+            uint32_t helpers = std::min<uint32_t>(job->num_bands, num_workers) - 1;
+            for (uint32_t i = 0; i < helpers; ++i)
+            {
+                submit_task(help_request);
+            }
+
+            compress_bands(*job);
+
+            // wait for the bands claimed by the helpers
+            while (job->bands_done.load(std::memory_order_acquire) < job->num_bands)
+            {
+                std::this_thread::yield();
+            }
+        }
+        else if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type)
+        {
+            dxt_compress(dxt, pixels, w, h, false);
+        }
+        else if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == type)
+        {
+            dxt_compress(dxt, pixels, w, h, true);
+        }
+        else if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+        {
+            // YCoCg conversion if DXT5
+            ConvertRGBToCoCg_Y(pixels, w, h);
+            account(HPV_STAGE_CONVERT, stamp, item.stage_ns);
+
+            // DXT compress
+            CompressYCoCgDXT5(pixels, dxt, w, h, w * 4);
+        }
+
+        account(HPV_STAGE_DXT, stamp, item.stage_ns);
+
+        // pixels go back to this thread's stb_image block cache
+        stbi_image_free(pixels);
+
+        store_frame(item, dxt, arena.lz4_state, write_buf, source_hash, stamp);
+    }
+
+    bool HPVCreator::reuse_previous_frame(HPVCompressionWorkItem& item, std::ifstream& previous, uint64_t source_hash, char * write_buf, uint64_t& stamp)
+    {
+        HPVCheckpointEntry entry;
+        if (!previous.is_open() || !checkpoint.lookup(source_hash, entry))
+            return false;
+
+        // a raw frame can only be re-used when this output may hold raw frames too
+        bool raw = (entry.frame_size & HPV_FRAME_RAW) != 0;
+        entry.frame_size &= ~HPV_FRAME_RAW;
+        if ((raw && raw_threshold == 0) || entry.frame_size == 0 || entry.frame_size > write_pool.get_buffer_size())
+            return false;
+
+        previous.clear();
+        previous.seekg(entry.offset);
+        previous.read(write_buf, entry.frame_size);
+        if (!previous.good())
+            return false;
+
+        // the checkpoint is ahead of the output when the previous encode crashed, verify what we read
+        if (hpv_hash(write_buf, entry.frame_size) != entry.payload_hash)
+            return false;
+
+        account(HPV_STAGE_LOAD, stamp, item.stage_ns);
+        queue_for_writer(item, write_buf, entry.frame_size, source_hash, entry.payload_hash, true, 0, raw);
+        return true;
+    }
+
+    void HPVCreator::store_frame(HPVCompressionWorkItem& item, const unsigned char * dxt, void * lz4_state, char * write_buf, uint64_t source_hash, uint64_t& stamp)
+    {
+        // a held frame only needs a reference to the first frame with the same DXT data
+        uint64_t dxt_hash = share_held ? hpv_hash(dxt, bytes_per_frame) : 0;
+        if (share_held && is_held_frame(dxt_hash, item.offset))
+        {
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+            account(HPV_STAGE_LZ4, stamp, item.stage_ns);
+            queue_for_writer(item, nullptr, 0, source_hash, 0, false, dxt_hash);
+            return;
+        }
+
+        // recycled buffer, handed back to the pool by the writer
+        if (!write_buf)
+        {
+            write_buf = reinterpret_cast<char *>(write_pool.acquire());
+        }
+        if (!write_buf)
+        {
+            report_error("Failed to allocate the L4Z compressed write buffer.");
+            return;
+        }
+
+        // compress resulting DXT buffer more with LZ4
+        std::size_t compressed_size = LZ4_compress_HC_extStateHC(lz4_state, (const char *)dxt, write_buf, static_cast<int>(bytes_per_frame), static_cast<int>(write_pool.get_buffer_size()), HPV_LZ4_COMPRESSION_LEVEL);
+        bool raw = store_raw(dxt, write_buf, compressed_size);
+        account(HPV_STAGE_LZ4, stamp, item.stage_ns);
+
+        if (compressed_size == 0)
+        {
+            HPV_VERBOSE("Error LZ4 compressing DXT frame");
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+            return;
+        }
+
+        queue_for_writer(item, write_buf, compressed_size, source_hash, resume ? hpv_hash(write_buf, compressed_size) : 0, false, dxt_hash, raw);
+    }
+
+    void HPVCreator::queue_for_writer(const HPVCompressionWorkItem& item, char * write_buf, std::size_t compressed_size, uint64_t source_hash, uint64_t payload_hash, bool reused, uint64_t dxt_hash, bool raw)
+    {
+        HPVCompressedItem compressed_item;
+        compressed_item.write_out_buf       = write_buf;
+        compressed_item.frame_size          = compressed_size;
+        compressed_item.path                = item.path;
+        compressed_item.compression_ratio   = (compressed_size / (float)bytes_per_frame) * 100.f;
+        compressed_item.source_hash         = source_hash;
+        compressed_item.payload_hash        = payload_hash;
+        compressed_item.reused              = reused;
+        compressed_item.dxt_hash            = dxt_hash;
+        compressed_item.raw                 = raw;
+        std::copy(item.stage_ns, item.stage_ns + HPV_NUM_STAGES, compressed_item.stage_ns);
+        if (!filestream_queue.push(compressed_item, item.offset))
+        {
+            // stopped while we were compressing
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+        }
+    }
+
+    bool HPVCreator::is_held_frame(uint64_t dxt_hash, uint64_t offset)
+    {
+        std::lock_guard<std::mutex> lock(held_mtx);
+
+        // the first frame with this DXT data keeps the payload, even when a later one got here first
+        std::pair<std::unordered_map<uint64_t, uint64_t>::iterator, bool> inserted = held_hashes.insert(std::make_pair(dxt_hash, offset));
+        if (inserted.second)
+            return false;
+
+        if (inserted.first->second < offset)
+            return true;
+
+        inserted.first->second = offset;
+        return false;
+    }
+
+    bool HPVCreator::store_raw(const unsigned char * dxt, char * write_buf, std::size_t& compressed_size)
+    {
+        // noisy content barely compresses, the player copies a raw frame instead of decompressing it
+        if (raw_threshold == 0 || (compressed_size > 0 && compressed_size <= raw_limit))
+            return false;
+
+        memcpy(write_buf, dxt, bytes_per_frame);
+        compressed_size = bytes_per_frame;
+        return true;
+    }
+
+    void HPVCreator::compress_bands(HPVBandJob& job)
+    {
+        uint32_t band;
+
+        while ((band = job.next_band.fetch_add(1, std::memory_order_relaxed)) < job.num_bands)
+        {
+            int y = static_cast<int>(band) * job.rows_per_band;
+            int rows = std::min(job.rows_per_band, job.height - y);
+            unsigned char* src = job.pixels + static_cast<std::size_t>(y) * job.width * 4;
+            std::size_t block_row_offset = static_cast<std::size_t>(y / 4) * (job.width / 4);
+
+            // every band is a self-contained strip of 4x4 blocks, so it can be
+            // compressed straight into its part of the frame's DXT buffer
+            if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == job.type)
+            {
+                dxt_compress(job.dxt + block_row_offset * 8, src, job.width, rows, false);
+            }
+            else if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == job.type)
+            {
+                dxt_compress(job.dxt + block_row_offset * 16, src, job.width, rows, true);
+            }
+            else if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == job.type)
+            {
+                ConvertRGBToCoCg_Y(src, job.width, rows);
+                CompressYCoCgDXT5(src, job.dxt + block_row_offset * 16, job.width, rows, job.width * 4);
+            }
+
+            job.bands_done.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    void HPVCreator::compress_mapped(const HPVMappedImage& image, unsigned char * strip, unsigned char * dxt)
+    {
+        // a strip of one block row stays in cache from expansion to DXT compression
+        const std::size_t block_row_size = static_cast<std::size_t>(ref_width / 4) * (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type ? 8 : 16);
+
+        for (int y = 0; y < ref_height; y += 4)
+        {
+            image.expand_rows(y, 4, strip);
+
+            if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type)
+            {
+                dxt_compress(dxt, strip, ref_width, 4, false);
+            }
+            else if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == type)
+            {
+                dxt_compress(dxt, strip, ref_width, 4, true);
+            }
+            else if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+            {
+                ConvertRGBToCoCg_Y(strip, ref_width, 4);
+                CompressYCoCgDXT5(strip, dxt, ref_width, 4, ref_width * 4);
+            }
+
+            dxt += block_row_size;
+        }
+    }
+
+    void HPVCreator::process_stage(HPVPipelineStage stage)
+    {
+        // LZ4 HC state of this worker
+        void * lz4_state = nullptr;
+        if (HPV_STAGE_LZ4 == stage)
+        {
+            lz4_state = hpv_aligned_alloc(LZ4_sizeofStateHC());
+            if (!lz4_state)
+            {
+                report_error("Failed to allocate the LZ4 state.");
+                return;
+            }
+        }
+
+        // output of the previous encode, unchanged frames are copied from it
+        std::ifstream previous;
+        if (HPV_STAGE_LOAD == stage && !previous_path.empty())
+        {
+            previous.open(previous_path.c_str(), std::ios::binary | std::ios::in);
+        }
+
+        HPVStageItem item;
+        HPVCompressionWorkItem work;
+
+        for (;;)
+        {
+            uint64_t wait_start = ns();
+
+            // blocks while there's nothing to do, returns false once all frames were written
+            if (HPV_STAGE_LOAD == stage)
+            {
+                if (!compression_queue.pop(work))
+                    break;
+
+                item = HPVStageItem();
+                item.work = work;
+            }
+            else if (!stage_queues[stage].pop(item))
+            {
+                break;
+            }
+
+            bool forward = false;
+            uint64_t stamp = ns();
+            idle_ns.fetch_add(stamp - wait_start, std::memory_order_relaxed);
+
+            switch (stage)
+            {
+            case HPV_STAGE_LOAD:
+                forward = load_frame(item, previous, stamp);
+                break;
+            case HPV_STAGE_CONVERT:
+                forward = convert_frame(item);
+                break;
+            case HPV_STAGE_DXT:
+                forward = dxt_frame(item);
+                break;
+            case HPV_STAGE_LZ4:
+                lz4_frame(item, lz4_state, stamp);
+                break;
+            default:
+                break;
+            }
+
+            // frames that left the pipeline early were accounted for before they went to the writer
+            account(stage, stamp, forward ? item.work.stage_ns : nullptr);
+
+            // hand the frame to the next stage, it's only refused when we were stopped
+            if (forward && !stage_queues[stage + 1].push(item))
+            {
+                release_slot(item);
+            }
+        }
+
+        hpv_aligned_free(lz4_state);
+    }
+
+    bool HPVCreator::load_frame(HPVStageItem& item, std::ifstream& previous, uint64_t& stamp)
+    {
+        // blocks until the LZ4 stage recycles a slot
+        if (!free_slots.pop(item.slot))
+            return false;
+
+        HPVFrameSlot& slot = *item.slot;
+        if (!slot.reserve(static_cast<std::size_t>(ref_width) * ref_height * 4, bytes_per_frame))
+        {
+            report_error("Failed to allocate the frame buffers.");
+            release_slot(item);
+            return false;
+        }
+
+        if (!source->read(item.work.path, &slot.file_buf, &slot.file_capacity, &slot.file_size))
+        {
+            report_error("Failed to load pixel data from " + item.work.path);
+            release_slot(item);
+            return false;
+        }
+        bytes_read.fetch_add(slot.file_size, std::memory_order_relaxed);
+
+        if (resume)
+        {
+            item.source_hash = hpv_hash(slot.file_buf, slot.file_size);
+
+            // source didn't change since the previous encode: no need to compress it again
+            if (previous.is_open())
+            {
+                char * write_buf = reinterpret_cast<char *>(write_pool.acquire());
+                if (write_buf && reuse_previous_frame(item.work, previous, item.source_hash, write_buf, stamp))
+                {
+                    release_slot(item);
+                    return false;
+                }
+
+                write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
             }
         }
+
+        return true;
+    }
+
+    bool HPVCreator::convert_frame(HPVStageItem& item)
+    {
+        HPVFrameSlot& slot = *item.slot;
+        int w = 0;
+        int h = 0;
+        int channels = 0;
+
+        // load the file, always load as RGBA
+        unsigned char * pixels = source->decode(slot.file_buf, slot.file_size, &w, &h, &channels);
+
+        if (!pixels)
+        {
+            report_error("Failed to load pixel data from " + item.work.path);
+            release_slot(item);
+            return false;
+        }
+
+        if (w != ref_width || h != ref_height)
+        {
+            std::stringstream ss;
+            ss << "File "
+               << item.work.path
+               << " has incorrect dimensions: "
+               << w
+               << "x"
+               << h
+               << " Should be: "
+               << ref_width
+               << "x"
+               << ref_height;
+            report_error(ss.str());
+            stbi_image_free(pixels);
+            release_slot(item);
+            return false;
+        }
+
+        // the pixels travel on in the slot, the stb_image block stays with this thread's cache
+        memcpy(slot.pixels, pixels, static_cast<std::size_t>(w) * h * 4);
+        stbi_image_free(pixels);
+
+        if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+        {
+            ConvertRGBToCoCg_Y(slot.pixels, w, h);
+        }
+
+        return true;
+    }
+
+    bool HPVCreator::dxt_frame(HPVStageItem& item)
+    {
+        HPVFrameSlot& slot = *item.slot;
+
+        if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type)
+        {
+            dxt_compress(slot.dxt, slot.pixels, ref_width, ref_height, false);
+        }
+        else if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == type)
+        {
+            dxt_compress(slot.dxt, slot.pixels, ref_width, ref_height, true);
+        }
+        else if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+        {
+            // converted to CoCg_Y by the previous stage
+            CompressYCoCgDXT5(slot.pixels, slot.dxt, ref_width, ref_height, ref_width * 4);
+        }
+
+        return true;
+    }
+
+    void HPVCreator::lz4_frame(HPVStageItem& item, void * lz4_state, uint64_t& stamp)
+    {
+        // the writer holds a room in its queue for every frame in flight, so queueing doesn't
+        // block and the slot can be recycled afterwards
+        store_frame(item.work, item.slot->dxt, lz4_state, nullptr, item.source_hash, stamp);
+        release_slot(item);
+    }
+
+    void HPVCreator::account(HPVPipelineStage stage, uint64_t& stamp, uint64_t * frame_ns)
+    {
+        uint64_t now = ns();
+        stage_busy_ns[stage].fetch_add(now - stamp, std::memory_order_relaxed);
+        if (frame_ns)
+        {
+            frame_ns[stage] += now - stamp;
+        }
+        stamp = now;
+    }
+
+    uint64_t HPVCreator::frame_memory() const
+    {
+        // the source file, the decoded pixels (the staged pipeline keeps a copy in the frame's
+        // slot next to stb_image's), the DXT output and the LZ4 output
+        uint64_t pixels = static_cast<uint64_t>(ref_width) * ref_height * 4;
+        return ref_file_size + pixels * (staged ? 2 : 1) + bytes_per_frame + LZ4_COMPRESSBOUND(bytes_per_frame);
+    }
+
+    HPVStageTimes HPVCreator::get_stage_times()
+    {
+        HPVStageTimes times;
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            times.busy_ns[stage] = stage_busy_ns[stage].load(std::memory_order_relaxed);
+        }
+        times.write_ns = write_busy_ns.load(std::memory_order_relaxed);
+        times.idle_ns = idle_ns.load(std::memory_order_relaxed);
+
+        return times;
+    }
+
+    void HPVCreator::release_slot(HPVStageItem& item)
+    {
+        if (item.slot)
+        {
+            free_slots.push(item.slot);
+            item.slot = nullptr;
+        }
     }
 
 	int HPVCreator::process_sequence(std::size_t amount_of_concurrency)
 	{
-        if (!compression_queue.size())
+        if (work_items.empty())
             return HPV_RET_ERROR;
 
-		unsigned int const max_threads = static_cast<unsigned int const>(amount_of_concurrency);
-		unsigned int const hardware_threads = std::thread::hardware_concurrency();
-		unsigned int const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-		HPV_VERBOSE("Dividing work over %d threads", num_threads);
+        // the ceiling respects affinity masks and container CPU quotas
+		unsigned int const available_threads = std::min(hpv_available_cpus(), 255u);
+        auto_concurrency = (amount_of_concurrency == HPV_CONCURRENCY_AUTO) && !staged && pool == &scheduler;
+
+		unsigned int const max_threads = auto_concurrency ? available_threads : static_cast<unsigned int>(amount_of_concurrency);
+		unsigned int num_threads = std::max(1u, std::min(available_threads, max_threads));
+
+        if (pool != &scheduler && !staged)
+        {
+            // every worker of the shared pool may pick up one of our frames
+            num_threads = static_cast<unsigned int>(std::max<std::size_t>(1, std::min<std::size_t>(pool->get_threads(), 255)));
+            HPV_VERBOSE("Sharing a pool of %d workers", num_threads);
+        }
+        else if (auto_concurrency)
+        {
+            HPV_VERBOSE("Tuning the amount of workers, at most %d threads", num_threads);
+        }
+        else if (staged && amount_of_concurrency == HPV_CONCURRENCY_AUTO)
+        {
+            HPV_VERBOSE("The staged pipeline runs the given stage worker counts, no tuning");
+        }
+        else
+        {
+            HPV_VERBOSE("Dividing work over %d threads", num_threads);
+        }
 
         should_coordinate.store(true, std::memory_order_relaxed);
         coordinator_thread = std::make_unique<std::thread>(&HPVCreator::coordinate, this, num_threads);
@@ -530,18 +2014,82 @@ namespace HPV {
         return HPV_RET_ERROR_NONE;
 	}
 
+    void HPVCreator::set_progress_callback(const HPVProgressCallback& callback)
+    {
+        std::lock_guard<std::mutex> lock(report_mtx);
+        progress_callback = callback;
+    }
+
+    int HPVCreator::wait(HPVCompressionProgress * result)
+    {
+        std::unique_lock<std::mutex> lock(report_mtx);
+        report_cond.wait(lock, [this] { return final_state != 0; });
+
+        if (result)
+        {
+            *result = final_progress;
+        }
+
+        return (final_state == HPV_CREATOR_STATE_DONE) ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+    }
+
+    void HPVCreator::report(const HPVCompressionProgress& progress)
+    {
+        if (progress_sink)
+        {
+            progress_sink->push(progress);
+        }
+
+        std::lock_guard<std::mutex> lock(report_mtx);
+        if (progress_callback)
+        {
+            progress_callback(progress);
+        }
+
+        // the first error ends the encode for wait(), like it does for the readers of the sink
+        if (progress.state != HPV_CREATOR_STATE_BUSY && final_state == 0)
+        {
+            final_state = progress.state;
+            final_progress = progress;
+            report_cond.notify_all();
+        }
+    }
+
+    void HPVCreator::report_error(const std::string& message)
+    {
+        // creators share the workers of a batch and the preflight threads report too, every
+        // error gets its own progress
+        HPVCompressionProgress error;
+        error.state = HPV_CREATOR_STATE_ERROR;
+        error.done_item_name = message;
+        report(error);
+    }
+
     void HPVCreator::stop()
     {
         // must obey specific order!
         should_coordinate.store(false, std::memory_order_relaxed);
 
-        compression_queue.clear();
+        compression_queue.close();
+        filestream_queue.close();
+        appended_items.close();
+        free_slots.close();
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            stage_queues[stage].close();
+        }
+        for (std::size_t i = 0; i < variants.size(); ++i)
+        {
+            variants[i]->stop();
+        }
 
         if (coordinator_thread && coordinator_thread->joinable())
         {
             coordinator_thread->join();
             coordinator_thread.reset();
         }
+
+        stop_preflight();
     }
 
     void HPVCreator::reset()
@@ -552,19 +2100,21 @@ namespace HPV {
         }
         else
         {
-            if (compression_queue.size()) compression_queue.clear();
+            if (work_items.size()) work_items.clear();
             if (work_threads.size()) work_threads.clear();
-            if (filestream_queue.size()) filestream_queue.clear();
+            filestream_queue.reset(1);
         }
+        stop_preflight();
 
         offset_runner = 0;
         file_counter = 0;
 
-        if (frame_size_table)
-        {
-            delete[] frame_size_table;
-            frame_size_table = nullptr;
-        }
+        frame_size_table.clear();
+        streaming = false;
+        segment = false;
+        next_item = 0;
+        staged = false;
+        std::fill(stage_threads, stage_threads + HPV_NUM_STAGES, 0);
         
         inpath = "";
         outpath = "";
@@ -574,12 +2124,24 @@ namespace HPV {
         end_idx = 0;
         fps = 0;
         type = HPVCompressionType::HPV_NUM_TYPES;
+        bands_per_frame = 0;
+        map_input = false;
+        variants.clear();
+        share_held = false;
+        held_hashes.clear();
+        shared_payloads.clear();
+        reused_payloads.clear();
+        resume = false;
+        checkpoint.close();
+        checkpoint.clear_previous();
+        previous_path = "";
         fs = nullptr;
         bytes_per_frame = 0;
         bytes_in_header = 0;
         bytes_in_framesize_table = 0;
         offset_runner = 0;
         file_names = nullptr;
+        source = &file_source;
         file_counter = 0;
     }
 } /* namespace HPV */
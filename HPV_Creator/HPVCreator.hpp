@@ -31,18 +31,50 @@
 #include <atomic>
 #include <memory>
 #include <sstream>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <condition_variable>
 
 #include "ThreadSafeContainers.hpp"
+#include "HPVBufferPool.hpp"
+#include "HPVFileWriter.hpp"
+#include "HPVCheckpoint.hpp"
+#include "HPVFrameSource.hpp"
+#include "HPVTaskScheduler.hpp"
+#include "HPVOutputVariant.hpp"
 #include "Timer.h"
 #include "Log.hpp"
 #include "HPVHeader.hpp"
 #include "YCoCg.h"
+#include "YCoCgSIMD.h"
+#include "DXTSIMD.h"
 #include "YCoCgDXT.h"
 #include "lz4.h"
 #include "lz4hc.h"
 
-#define PROCESSED_SIZE_BARRIER 5
-#define PROCESSED_BARRIER_SLEEPTIME 250
+/* Frames that may be in flight (queued, compressing or waiting for the writer) per worker thread */
+#define IN_FLIGHT_ITEMS_PER_THREAD 2
+
+/* Frames that can be appended to a streaming encode before append_frame() blocks */
+#define HPV_STREAM_PENDING_FRAMES 256
+
+/* Threads reading image headers before the encode, they wait on the disk rather than the CPU */
+#define HPV_PREFLIGHT_THREADS 16
+
+/* Bytes read of every frame to find its dimensions, the whole file when its header lies beyond */
+#define HPV_PREFLIGHT_HEADER_BYTES 65536
+
+/* Frames that may wait in front of every stage of the staged pipeline */
+#define IN_FLIGHT_ITEMS_PER_STAGE 2
+
+/* process_sequence() argument: pick the amount of workers by measuring frames/s */
+#define HPV_CONCURRENCY_AUTO 0
+
+/* Auto concurrency: length of one measurement, tuning time, frames/s a smaller worker count may lose */
+#define HPV_AUTO_TUNE_WINDOW_MS 500
+#define HPV_AUTO_TUNE_SECONDS 5
+#define HPV_AUTO_TUNE_TOLERANCE 0.02
 
 #define HPV_CREATOR_STATE_ERROR 0x01
 #define HPV_CREATOR_STATE_DONE  0x02
@@ -69,19 +101,51 @@ namespace HPV {
     { "png", "jpeg", "jpg", "tga", "gif", "bmp", "psd", "gif", "hdr", "pic", "ppm", "pgm" };
     
     bool file_supported(const std::string& path);
-    
+
 	struct HPVCreatorParams
 	{
         std::string in_path;
 		std::string out_path;
-        std::vector<std::string> * file_names;
-		uint32_t in_frame;
-		uint32_t out_frame;
-		uint8_t fps;
-        uint8_t num_threads;
-		HPVCompressionType type;
+        std::vector<std::string> * file_names = nullptr;
+        HPVFrameSource * frame_source = nullptr;    /* nullptr: file_names are image files on disk */
+		uint32_t in_frame = 0;
+		uint32_t out_frame = 0;
+		uint8_t fps = 0;
+        uint8_t num_threads = HPV_CONCURRENCY_AUTO;
+		HPVCompressionType type = HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA;
+        uint16_t bands_per_frame = 0;   /* > 1: split every frame in block-row bands compressed in parallel */
+        HPVWriterType writer_type = HPVWriterType::HPV_WRITER_POSITIONAL;  /* output backend */
+        bool resume = false;            /* keep a checkpoint next to the output, re-use unchanged frames of the previous encode */
+        bool streaming = false;         /* more frames follow through append_frame(), the frame index is written as trailer */
+        uint8_t stage_threads[HPV_NUM_STAGES] = {};    /* all > 0: staged pipeline with these worker counts, otherwise every worker does all stages */
+        uint64_t max_memory = 0;        /* bytes the frames in flight may use, 0 = no limit */
+        bool numa_affinity = false;     /* pin the workers per NUMA node, keep every frame's memory on its node */
+        bool early_start = false;       /* start encoding while the input is scanned, the frame index is written as trailer */
+        HPVTaskScheduler * worker_pool = nullptr;  /* nullptr: the creator's own workers, otherwise a pool shared with other creators */
+        bool segment = false;           /* the output is one segment of a longer encode, see hpv_merge() */
+        std::vector<HPVOutputParams> extra_outputs;    /* more outputs encoded from the same decoded frames */
+        bool share_held_frames = false; /* store identical frames once, the others reference that frame (HPV_FLAG_SHARED_FRAMES) */
+        uint8_t store_raw_below = 0;    /* percent: frames LZ4 shrinks by less are stored raw (HPV_FLAG_RAW_FRAMES), 0 = always LZ4 */
+        int8_t dxt_level = -1;          /* HPVSimdLevel of the DXT1/DXT5 compressor, HPV_SIMD_SCALAR = stb, -1 = the fastest the CPU runs */
 	};
 
+    /*
+     * A frame whose DXT compression is split over several workers. Bands are claimed through
+     * next_band, so the owner and every helper just keep compressing until none are left.
+     */
+    struct HPVBandJob
+    {
+        unsigned char * pixels;
+        unsigned char * dxt;
+        int width;
+        int height;
+        int rows_per_band;
+        uint32_t num_bands;
+        HPVCompressionType type;
+        std::atomic<uint32_t> next_band;
+        std::atomic<uint32_t> bands_done;
+    };
+
     class HPVCompressionWorkItem
     {
     public:
@@ -89,28 +153,119 @@ namespace HPV {
         {
             path = "";
             offset = 0;
+            std::fill(stage_ns, stage_ns + HPV_NUM_STAGES, 0);
+        }
+		HPVCompressionWorkItem(const std::string& _path, uint64_t _offset) : path(_path) ,offset(_offset)
+        {
+            std::fill(stage_ns, stage_ns + HPV_NUM_STAGES, 0);
         }
-		HPVCompressionWorkItem(const std::string& _path, uint64_t _offset) : path(_path) ,offset(_offset) {}
         
         std::string path;
         uint64_t offset;
+        uint64_t stage_ns[HPV_NUM_STAGES];      /* time spent on this frame so far, per stage */
+        std::shared_ptr<HPVBandJob> band_job;   /* set when this is a request to help out with a split frame */
     };
     
-    class HPVCompressedItem
+    /*
+     * Time spent in every stage summed over all workers; the writer is the coordinator thread.
+     * idle_ns is the time workers were waiting for a frame to work on.
+     */
+    struct HPVStageTimes
+    {
+        HPVStageTimes()
+        {
+            std::fill(busy_ns, busy_ns + HPV_NUM_STAGES, 0);
+            write_ns = 0;
+            idle_ns = 0;
+        }
+        uint64_t busy_ns[HPV_NUM_STAGES];
+        uint64_t write_ns;
+        uint64_t idle_ns;
+    };
+
+    enum HPVFrameState
+    {
+        HPV_FRAME_PENDING = 0,
+        HPV_FRAME_OK,
+        HPV_FRAME_MISSING,
+        HPV_FRAME_UNREADABLE
+    };
+
+    /* What the pre-flight scan learned from a frame's image header */
+    struct HPVFrameInfo
+    {
+        HPVFrameInfo() : state(HPV_FRAME_PENDING), width(0), height(0), channels(0) {}
+
+        HPVFrameState state;
+        int width;
+        int height;
+        int channels;
+    };
+
+    /* A frame that was written with its payload, held frames with the same DXT data point at it */
+    struct HPVSharedPayload
+    {
+        uint32_t frame_index;
+        uint64_t offset;
+        uint32_t frame_size;
+        uint64_t payload_hash;
+        bool raw;
+    };
+
+    /* A frame on its way through the staged pipeline */
+    class HPVStageItem
     {
     public:
-		HPVCompressedItem()
+        HPVStageItem()
         {
-            write_out_buf = nullptr;
-            write_pos = 0;
-            frame_size = 0;
-            path = "";
+            slot = nullptr;
+            source_hash = 0;
         }
-        char * write_out_buf;
-        uint64_t write_pos;
-        uint64_t frame_size;
-        std::string path;
-        float compression_ratio;
+        HPVCompressionWorkItem work;
+        HPVFrameSlot * slot;
+        uint64_t source_hash;
+    };
+
+    /*
+     * Picks the amount of active workers during the first seconds of an auto encode. It starts with
+     * all of them and keeps dropping a quarter as long as frames/s stays within the tolerance of
+     * the best measurement: more workers than the disk or the cores can feed only cost memory
+     * and hyperthread contention. The first window is the warm-up and not measured.
+     */
+    class HPVConcurrencyTuner
+    {
+    public:
+        HPVConcurrencyTuner();
+
+        void start(uint32_t max_workers, uint64_t now);
+
+        /* call for every written frame, returns the amount of workers to use from now on */
+        uint32_t frame_written(uint64_t now);
+
+        bool is_done() const { return done; }
+        uint32_t get_workers() const { return workers; }
+        double get_best_fps() const { return best_fps; }
+
+    private:
+        uint32_t workers;
+        uint32_t best_workers;
+        double best_fps;
+        uint64_t tune_start;
+        uint64_t window_start;
+        uint32_t window_frames;
+        bool warmed_up;
+        bool done;
+    };
+
+    /* Scratch memory and state of one scheduler worker, kept across encodes */
+    class HPVFrameWorker
+    {
+    public:
+        HPVFrameWorker() : last_task_end(0) {}
+
+        HPVWorkerArena arena;
+        std::ifstream previous;         /* output of the previous encode, unchanged frames are copied from it */
+        uint64_t last_task_end;         /* for the idle time */
     };
 
     class HPVCompressionProgress
@@ -122,174 +277,41 @@ namespace HPV {
             done_items = 0;
             done_item_name = "";
             compression_ratio = 0;
+            frame_buffer_allocations = 0;
+            std::fill(frame_ns, frame_ns + HPV_NUM_STAGES, 0);
+            compression_queue_depth = 0;
+            filestream_queue_depth = 0;
+            active_workers = 0;
+            bytes_per_second = 0;
+            bytes_read = 0;
+            bytes_written = 0;
+            elapsed_seconds = 0;
+            frames_per_second = 0;
+            read_bytes_per_second = 0;
+            eta_seconds = -1;
         }
         uint8_t state;
         int32_t total_items;
         int32_t done_items;
         std::string done_item_name;
         float compression_ratio;
+        uint64_t frame_buffer_allocations; /* frame sized buffers allocated so far, stops growing in steady state */
+        HPVStageTimes times;            /* cumulative since the start of the encode */
+        uint64_t frame_ns[HPV_NUM_STAGES];  /* time the done frame spent in every stage */
+        uint32_t compression_queue_depth;   /* frames waiting for a worker */
+        uint32_t filestream_queue_depth;    /* compressed frames waiting for the writer */
+        uint32_t active_workers;
+        double bytes_per_second;        /* written to the output since the start */
+        uint64_t bytes_read;            /* source data loaded so far */
+        uint64_t bytes_written;         /* frame data written to the output so far */
+        double elapsed_seconds;         /* since the start of the encode */
+        double frames_per_second;       /* done frames since the start */
+        double read_bytes_per_second;   /* loaded from the input since the start */
+        double eta_seconds;             /* until the last frame at the current rate, -1 while the amount of frames is open */
     };
-    
-	/*
-	*	This class will take care of writing all data to the hard drive. We will have one instantation 
-	*	of this class that will be used throughout the different threads. For this reason, the write 
-	*	operation is secured by means of a std::mutex encapsulated in a std::lock_guard. When the write
-	*	operation has completed, the mutex will automatically be unlocked so another thread can start
-	*	writing to the stream.
-	*
-	*/
-	class HPVFileStreamWriter
-	{
-	private:
-		std::unique_ptr<std::ofstream> ofs;
-		bool bInit;
-
-	public:
-		HPVFileStreamWriter() : bInit(false) {}
-
-		~HPVFileStreamWriter() 
-		{ 
-			if (ofs->is_open()) ofs->close(); 
-
-			ofs.reset();
-		}
-
-		int init(const std::string& _path)
-		{
-            ofs = std::make_unique<std::ofstream>();
-			ofs->open(_path.c_str(), std::ios::binary | std::ios::out);
-
-            bInit = (is_good() == 1) ? true : false;
-
-			return bInit;
-		}
-
-		int is_good()
-		{
-			return (ofs->is_open() && ofs->good() && !ofs->fail());
-		}
-        
-        /*
-         * Write a Compressed item to disk, already contains all info
-         */
-        int write_to_stream(const std::shared_ptr<HPVCompressedItem>& item)
-        {
-            bool bOK = true;
-			if (bInit)
-			{
-				//DXT_VERBOSE("Writing %d bytes to pos %d", item->frame_size, (item->write_pos-40)/item->frame_size);
-
-				// write operation
-				if (is_good())
-				{
-					//uint64_t b = ns();
-					ofs->seekp(item->write_pos);
-					//uint64_t a = ns();
-				}
-				else 
-					bOK = false;
-
-				if (is_good())
-				{
-					//uint64_t b = ns();
-                    ofs->write((const char *)item->write_out_buf, item->frame_size);
-					//uint64_t a = ns();
-				}
-				else 
-					bOK = false;
-
-				if (is_good())
-				{
-					//uint64_t b = ns();
-					ofs->flush();
-					//uint64_t a = ns();
-				}
-				else 
-					bOK = false;
-
-				if (!bOK)
-					HPV_ERROR("Error writing frame @ pos %d", item->write_pos);
-			}
-			else
-			{
-				HPV_ERROR("Writing frame to non existing stream.");
-                bOK = false;
-			}
-
-            return bOK;
-        }
 
-        /*
-         * Manually pass information to file streamer
-         */
-        int write_to_stream(const char * buf, uint64_t pos, uint64_t frame_size)
-		{
-			if (bInit)
-			{
-				bool bOK = true;
-
-				//DXT_VERBOSE("Writing %d bytes to pos %d", frame_size, pos);
-
-				// write operation
-				if (is_good()) ofs->seekp(pos); else bOK = false;
-				if (is_good()) ofs->write(buf, frame_size); else bOK = false;
-				if (is_good()) ofs->flush(); else bOK = false;
-				if (!is_good()) bOK = false;
-
-				if (!bOK)
-					HPV_ERROR("Error writing frame @ pos %d", pos);
-
-				return bOK;
-			}
-			else
-			{
-				HPV_ERROR("Writing frame to non existing stream.");
-				return -1;
-			}
-		}
-
-		int write_header(const HPVHeader& header)
-		{
-			if (bInit)
-			{
-				int header_size = sizeof(uint32_t) * amount_header_fields;
-
-				ofs->write((char *)&header, header_size);
-
-				if (!is_good())
-					return -1;
-
-				ofs->flush();
-
-				return 0;
-			}
-			else
-			{
-				HPV_ERROR("Writing header to non existing stream.");
-				return -1;
-			}
-
-		}
-
-		uint64_t get_current_pos()
-		{
-			return static_cast<uint64_t>(ofs->tellp());
-		}
-
-		void close()
-		{
-			if (ofs->is_open())
-			{
-				ofs->flush();
-				ofs->close();
-			}
-			else
-			{
-				HPV_ERROR("Trying to close non existing stream");
-			}
-		}
-	};
-    
+    /* Receives every progress report, see HPVCreator::set_progress_callback() */
+    typedef std::function<void(const HPVCompressionProgress&)> HPVProgressCallback;
     
     class HPVCreator
 	{
@@ -298,12 +320,56 @@ namespace HPV {
         ~HPVCreator();
         int init(const HPVCreatorParams& params, ThreadSafe_Queue<HPVCompressionProgress> * progress_sink);
 		int process_sequence(std::size_t amount_of_concurrency);
-        void process_item(uint8_t thread_idx);
-        void coordinate(uint8_t num_threads);
+
+        /*
+         *  Progress without polling. The callback gets every report that also goes to the progress
+         *  sink (which may be null then), on the thread that makes it: the writer for progress and
+         *  done, a worker for errors. Keep it short and don't call wait() or stop() from it.
+         *  Set it before init().
+         */
+        void set_progress_callback(const HPVProgressCallback& callback);
+
+        /*
+         *  Blocks until the encode started by init() is done or failed and returns
+         *  HPV_RET_ERROR_NONE or HPV_RET_ERROR. The last report goes to result. Like after a DONE
+         *  or ERROR from the sink, stop() the creator afterwards.
+         */
+        int wait(HPVCompressionProgress * result = nullptr);
+        int append_frame(const std::string& path);
+        void finish_input();
+        HPVStageTimes get_stage_times();
         void stop();
         void reset();
 
     private:
+        void submit_task(const HPVCompressionWorkItem& item);
+        void run_task(const HPVCompressionWorkItem& item, std::size_t worker_idx);
+        void process_item(HPVCompressionWorkItem item, HPVFrameWorker& worker);
+        void process_stage(HPVPipelineStage stage);
+        void coordinate(uint8_t num_threads);
+        void compress_bands(HPVBandJob& job);
+        void compress_mapped(const HPVMappedImage& image, unsigned char * strip, unsigned char * dxt);
+        bool next_work_item(HPVCompressionWorkItem& item, bool wait);
+        void scan_frames();
+        bool wait_for_frame(uint32_t idx, HPVFrameInfo& info);
+        int accept_frame(uint32_t idx);
+        void emit_frames();
+        void stop_preflight();
+        bool load_frame(HPVStageItem& item, std::ifstream& previous, uint64_t& stamp);
+        bool convert_frame(HPVStageItem& item);
+        bool dxt_frame(HPVStageItem& item);
+        void lz4_frame(HPVStageItem& item, void * lz4_state, uint64_t& stamp);
+        void release_slot(HPVStageItem& item);
+        uint64_t frame_memory() const;
+        void account(HPVPipelineStage stage, uint64_t& stamp, uint64_t * frame_ns = nullptr);
+        bool reuse_previous_frame(HPVCompressionWorkItem& item, std::ifstream& previous, uint64_t source_hash, char * write_buf, uint64_t& stamp);
+        void store_frame(HPVCompressionWorkItem& item, const unsigned char * dxt, void * lz4_state, char * write_buf, uint64_t source_hash, uint64_t& stamp);
+        void queue_for_writer(const HPVCompressionWorkItem& item, char * write_buf, std::size_t compressed_size, uint64_t source_hash, uint64_t payload_hash, bool reused, uint64_t dxt_hash = 0, bool raw = false);
+        bool store_raw(const unsigned char * dxt, char * write_buf, std::size_t& compressed_size);
+        bool is_held_frame(uint64_t dxt_hash, uint64_t offset);
+        void report(const HPVCompressionProgress& progress);
+        void report_error(const std::string& message);
+
         int version;
         std::string inpath;
         std::string outpath;
@@ -313,10 +379,49 @@ namespace HPV {
 		uint32_t end_idx;
 		uint8_t fps;
 		HPVCompressionType type;
-
-        std::unique_ptr<HPVFileStreamWriter> fs;
-
-        uint32_t* frame_size_table;
+        uint16_t bands_per_frame;
+        bool map_input;                 /* compress uncompressed source files straight from a file mapping */
+        uint8_t num_workers;
+        HPVWriterType writer_type;
+
+        bool resume;
+        HPVCheckpoint checkpoint;
+        std::string previous_path;
+        uint32_t reused_counter;
+
+        // held frames: identical DXT data is written once, the other frames reference it
+        bool share_held;
+        std::mutex held_mtx;
+        std::unordered_map<uint64_t, uint64_t> held_hashes;                 /* workers: DXT hash -> first frame with it */
+        std::unordered_map<uint64_t, HPVSharedPayload> shared_payloads;     /* writer: DXT hash -> frame with the payload */
+        std::unordered_map<uint64_t, HPVSharedPayload> reused_payloads;     /* writer, resume: payload hash -> frame with the payload */
+        uint32_t held_counter;
+
+        // raw frames: DXT data LZ4 can't shrink by at least raw_threshold percent is stored as is
+        uint8_t raw_threshold;
+        std::size_t raw_limit;          /* payloads above this size are stored raw */
+        uint32_t raw_counter;
+
+        HPVDXTFunc dxt_compress;        /* DXT1/DXT5 compressor picked by dxt_level */
+
+        bool streaming;
+        bool segment;
+        std::size_t next_item;
+        ThreadSafe_RingBuffer<HPVCompressionWorkItem> appended_items;
+
+        bool staged;
+        uint8_t stage_threads[HPV_NUM_STAGES];
+        std::vector<std::unique_ptr<HPVFrameSlot>> frame_slots;
+        ThreadSafe_RingBuffer<HPVFrameSlot *> free_slots;
+        ThreadSafe_RingBuffer<HPVStageItem> stage_queues[HPV_NUM_STAGES];  /* input of every stage but the first */
+
+        std::atomic<uint64_t> stage_busy_ns[HPV_NUM_STAGES];
+        std::atomic<uint64_t> write_busy_ns;
+        std::atomic<uint64_t> idle_ns;
+
+        std::unique_ptr<HPVFileWriter> fs;
+
+        std::vector<uint32_t> frame_size_table;
         std::size_t bytes_per_frame;
         std::size_t bytes_in_header;
         std::size_t bytes_in_framesize_table;
@@ -325,16 +430,57 @@ namespace HPV {
         uint64_t file_counter;
 
         std::vector<std::string> * file_names;
+        HPVFrameSource * source;
+        HPVFileFrameSource file_source;
 
         std::atomic<bool> should_coordinate;
         std::unique_ptr<std::thread> coordinator_thread;
 
         std::vector<std::thread> work_threads;
-        ThreadSafe_Queue<HPVCompressionWorkItem>   compression_queue;
-		ThreadSafe_Map<HPVCompressedItem>          filestream_queue;
+        HPVBufferPool write_pool;
+        std::vector<std::unique_ptr<HPVOutputVariant>> variants;    /* extra outputs, fed by the workers */
+        std::vector<HPVCompressionWorkItem>         work_items;
+        ThreadSafe_RingBuffer<HPVCompressionWorkItem> compression_queue;
+		ThreadSafe_ReorderBuffer<HPVCompressedItem> filestream_queue;
 
         uint32_t items_done_counter;
         ThreadSafe_Queue<HPVCompressionProgress> * progress_sink;
+        std::atomic<uint64_t> bytes_read;
+
+        // completion: wait() blocks until a DONE or ERROR report
+        HPVProgressCallback progress_callback;
+        std::mutex report_mtx;
+        std::condition_variable report_cond;
+        uint8_t final_state;            /* 0 while the encode runs */
+        HPVCompressionProgress final_progress;
+
+        // fused pipeline: frames and bands are tasks, the workers are kept across encodes
+        std::vector<std::unique_ptr<HPVFrameWorker>> frame_workers;
+        HPVTaskGroup frame_tasks;
+        uint64_t max_memory;
+        uint64_t ref_file_size;         /* encoded size of the first frame, estimate for all of them */
+        std::size_t peak_in_flight;
+
+        bool auto_concurrency;
+        HPVConcurrencyTuner tuner;
+
+        // pre-flight: image headers are read in parallel, frames are accepted in order
+        std::vector<HPVFrameInfo> preflight_frames;     /* index 0 is the reference frame */
+        std::atomic<uint32_t> preflight_next;
+        std::atomic<bool> preflight_quit;
+        std::mutex preflight_mtx;
+        std::condition_variable preflight_cond;
+        std::vector<std::thread> preflight_threads;
+        std::unique_ptr<std::thread> preflight_emitter;  /* early start: hands the frames to the running encode */
+        bool preflight_early;
+        int ref_channels;
+        uint32_t channel_mismatches;
+
+        bool numa_affinity;
+        std::vector<HPVNumaNode> numa_nodes;                    /* empty: workers aren't pinned */
+        std::atomic<uint64_t> node_frames[HPV_MAX_NUMA_NODES];  /* frames encoded per node */
+        HPVTaskScheduler * pool;        /* &scheduler or a pool shared with other creators */
+        HPVTaskScheduler scheduler;    /* last, so its threads are joined first */
 	};  
 } /* namespace HPV */
   
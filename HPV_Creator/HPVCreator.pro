@@ -6,9 +6,22 @@ HEADERS	     += \
     stb_image.h \
     Timer.h \
     YCoCg.h \
+    YCoCgSIMD.h \
     YCoCgDXT.h \
+    DXTSIMD.h \
+    DXTSIMDBlock.inl \
     HPVCreator.hpp \
     HPVHeader.hpp \
+    HPVAffinity.hpp \
+    HPVSimd.hpp \
+    HPVBufferPool.hpp \
+    HPVFileWriter.hpp \
+    HPVCheckpoint.hpp \
+    HPVFrameSource.hpp \
+    HPVMappedImage.hpp \
+    HPVMerge.hpp \
+    HPVOutputVariant.hpp \
+    HPVTaskScheduler.hpp \
     Log.hpp \
     lz4.h \
     lz4hc.h \
@@ -18,8 +31,20 @@ HEADERS	     += \
     kuhn_munkres.hpp
 SOURCES	     += \
     HPVCreator.cpp \
+    HPVAffinity.cpp \
+    HPVSimd.cpp \
+    HPVBufferPool.cpp \
+    HPVFileWriter.cpp \
+    HPVCheckpoint.cpp \
+    HPVFrameSource.cpp \
+    HPVMappedImage.cpp \
+    HPVMerge.cpp \
+    HPVOutputVariant.cpp \
+    HPVTaskScheduler.cpp \
     YCoCg.cpp \
+    YCoCgSIMD.cpp \
     YCoCgDXT.cpp \
+    DXTSIMD.cpp \
     Log.cpp \
     lz4.c \
     lz4hc.c \
@@ -0,0 +1,219 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <functional>
+
+#include "HPVFileWriter.hpp"
+
+namespace HPV {
+
+    std::unique_ptr<HPVFileWriter> create_file_writer(HPVWriterType type)
+    {
+#ifndef _WIN32
+        if (HPVWriterType::HPV_WRITER_POSITIONAL == type)
+        {
+            return std::unique_ptr<HPVFileWriter>(new HPVPositionalWriter());
+        }
+#else
+        if (HPVWriterType::HPV_WRITER_POSITIONAL == type)
+        {
+            HPV_VERBOSE("Positional writer not available on this platform, using the stream writer.");
+        }
+#endif
+        return std::unique_ptr<HPVFileWriter>(new HPVFileStreamWriter());
+    }
+
+#ifndef _WIN32
+
+    HPVPositionalWriter::HPVPositionalWriter() : fd(-1), pool(nullptr)
+    {
+        failed.store(false, std::memory_order_relaxed);
+        end_pos.store(0, std::memory_order_relaxed);
+    }
+
+    HPVPositionalWriter::~HPVPositionalWriter()
+    {
+        if (fd >= 0)
+        {
+            close();
+        }
+    }
+
+    int HPVPositionalWriter::init(const std::string& path, uint64_t size_hint, HPVBufferPool * _pool)
+    {
+        pool = _pool;
+        failed.store(false, std::memory_order_relaxed);
+        end_pos.store(0, std::memory_order_relaxed);
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            HPV_ERROR("Couldn't open %s: %s", path.c_str(), strerror(errno));
+            failed.store(true, std::memory_order_relaxed);
+            return 0;
+        }
+
+#ifdef __linux__
+        // reserve the blocks up front so the file system can lay the file out in one go,
+        // close() truncates whatever the estimate was too big
+        if (size_hint > 0 && fallocate(fd, 0, 0, static_cast<off_t>(size_hint)) != 0)
+        {
+            HPV_VERBOSE("Couldn't pre-allocate %llu bytes, writing without", static_cast<unsigned long long>(size_hint));
+        }
+#else
+        (void)size_hint;
+#endif
+
+        pending.reset(HPV_WRITER_PENDING_WRITES);
+
+        for (int i = 0; i < HPV_WRITER_IO_THREADS; ++i)
+        {
+            io_threads.push_back(std::thread(&HPVPositionalWriter::io_loop, this));
+        }
+
+        return 1;
+    }
+
+    int HPVPositionalWriter::is_good()
+    {
+        return (fd >= 0 && !failed.load(std::memory_order_relaxed));
+    }
+
+    int HPVPositionalWriter::write_fully(const char * buf, uint64_t pos, uint64_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::pwrite(fd, buf, static_cast<std::size_t>(size), static_cast<off_t>(pos));
+
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                HPV_ERROR("Error writing %llu bytes @ pos %llu: %s", static_cast<unsigned long long>(size), static_cast<unsigned long long>(pos), strerror(errno));
+                failed.store(true, std::memory_order_relaxed);
+                return 0;
+            }
+
+            buf += written;
+            pos += static_cast<uint64_t>(written);
+            size -= static_cast<uint64_t>(written);
+        }
+
+        // remember where the data ends, that's the size of the file at close
+        uint64_t end = end_pos.load(std::memory_order_relaxed);
+        while (pos > end && !end_pos.compare_exchange_weak(end, pos, std::memory_order_relaxed)) {}
+
+        return 1;
+    }
+
+    void HPVPositionalWriter::io_loop()
+    {
+        HPVCompressedItem item;
+
+        while (pending.pop(item))
+        {
+            if (!failed.load(std::memory_order_relaxed))
+            {
+                write_fully(item.write_out_buf, item.write_pos, item.frame_size);
+            }
+
+            if (pool)
+                pool->release(reinterpret_cast<unsigned char *>(item.write_out_buf));
+        }
+    }
+
+    int HPVPositionalWriter::write_to_stream(const HPVCompressedItem& item)
+    {
+        if (fd < 0 || !pending.push(item))
+        {
+            HPV_ERROR("Writing frame to non existing stream.");
+
+            if (pool)
+                pool->release(reinterpret_cast<unsigned char *>(item.write_out_buf));
+
+            return 0;
+        }
+
+        return is_good();
+    }
+
+    int HPVPositionalWriter::write_to_stream(const char * buf, uint64_t pos, uint64_t size)
+    {
+        if (fd < 0)
+        {
+            HPV_ERROR("Writing frame to non existing stream.");
+            return -1;
+        }
+
+        // header and frame size table never overlap with the frames in flight
+        return write_fully(buf, pos, size);
+    }
+
+    int HPVPositionalWriter::write_header(const HPVHeader& header)
+    {
+        if (fd < 0)
+        {
+            HPV_ERROR("Writing header to non existing stream.");
+            return -1;
+        }
+
+        return write_fully(reinterpret_cast<const char *>(&header), 0, sizeof(uint32_t) * amount_header_fields) ? 0 : -1;
+    }
+
+    uint64_t HPVPositionalWriter::get_current_pos()
+    {
+        return end_pos.load(std::memory_order_relaxed);
+    }
+
+    int HPVPositionalWriter::close()
+    {
+        if (fd < 0)
+        {
+            HPV_ERROR("Trying to close non existing stream");
+            return HPV_RET_ERROR;
+        }
+
+        // let the I/O threads finish the queued frames
+        pending.close();
+        std::for_each(io_threads.begin(), io_threads.end(), std::mem_fn(&std::thread::join));
+        io_threads.clear();
+
+        // drop the part of the pre-allocation that wasn't used, only files have one
+        struct stat out_stat;
+        if (fstat(fd, &out_stat) == 0 && S_ISREG(out_stat.st_mode) &&
+            ftruncate(fd, static_cast<off_t>(end_pos.load(std::memory_order_relaxed))) != 0)
+        {
+            HPV_ERROR("Couldn't truncate output: %s", strerror(errno));
+            failed.store(true, std::memory_order_relaxed);
+        }
+
+        if (::close(fd) != 0)
+        {
+            HPV_ERROR("Error closing output: %s", strerror(errno));
+            failed.store(true, std::memory_order_relaxed);
+        }
+
+        fd = -1;
+
+        return failed.load(std::memory_order_relaxed) ? HPV_RET_ERROR : HPV_RET_ERROR_NONE;
+    }
+
+#endif
+
+} /* namespace HPV */
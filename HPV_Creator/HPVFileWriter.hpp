@@ -0,0 +1,288 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_FILE_WRITER_H
+#define HPV_FILE_WRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "ThreadSafeContainers.hpp"
+#include "HPVBufferPool.hpp"
+#include "HPVHeader.hpp"
+#include "Log.hpp"
+
+/* Amount of threads issuing positional writes, i.e. frame writes in flight at the same time */
+#define HPV_WRITER_IO_THREADS 2
+
+/* Frame writes that may wait for an I/O thread before write_to_stream() blocks */
+#define HPV_WRITER_PENDING_WRITES 16
+
+namespace HPV {
+
+    enum class HPVWriterType : std::uint8_t
+    {
+        HPV_WRITER_STREAM = 0,          /* std::ofstream, seek + write + flush per frame */
+        HPV_WRITER_POSITIONAL,          /* pwrite from I/O threads, flushed at close */
+        HPV_NUM_WRITERS
+    };
+
+    const std::vector<std::string> HPVWriterTypeStrings =
+    { "stream", "pwrite" };
+
+    /*
+     * Stages a frame goes through before it reaches the writer. In the staged pipeline every
+     * stage has its own workers and a bounded queue in front of it; the writer (the coordinator
+     * thread) is the final stage.
+     */
+    enum HPVPipelineStage
+    {
+        HPV_STAGE_LOAD = 0,         /* read the source file, re-use frames from a checkpoint */
+        HPV_STAGE_CONVERT,          /* decode the image, YCoCg conversion */
+        HPV_STAGE_DXT,              /* DXT compression */
+        HPV_STAGE_LZ4,              /* LZ4 HC compression */
+        HPV_NUM_STAGES
+    };
+
+    const std::string HPVPipelineStageStrings[] =
+    {
+        "load",
+        "convert",
+        "dxt",
+        "lz4"
+    };
+
+    class HPVCompressedItem
+    {
+    public:
+		HPVCompressedItem()
+        {
+            write_out_buf = nullptr;
+            write_pos = 0;
+            frame_size = 0;
+            path = "";
+            source_hash = 0;
+            payload_hash = 0;
+            reused = false;
+            dxt_hash = 0;
+            raw = false;
+            std::fill(stage_ns, stage_ns + HPV_NUM_STAGES, 0);
+        }
+        char * write_out_buf;
+        uint64_t write_pos;
+        uint64_t frame_size;
+        std::string path;
+        float compression_ratio;
+        uint64_t source_hash;           /* only filled in when a checkpoint is kept */
+        uint64_t payload_hash;
+        bool reused;                    /* copied from the previous encode instead of compressed */
+        uint64_t dxt_hash;              /* only filled in when held frames are shared, no write_out_buf: held frame */
+        bool raw;                       /* the payload is the DXT data, LZ4 didn't pay off */
+        uint64_t stage_ns[HPV_NUM_STAGES];  /* time this frame spent in every stage */
+    };
+
+    /*
+     *  Interface for the output backends. All writes are positional: frames go to item.write_pos,
+     *  header and frame size table are patched at their fixed offsets when the encode finishes.
+     *
+     *  A frame handed to write_to_stream(item) is owned by the writer until it is on disk, the
+     *  writer gives item.write_out_buf back to the pool passed to init().
+     */
+    class HPVFileWriter
+    {
+    public:
+        virtual ~HPVFileWriter() {}
+
+        /* size_hint: expected size of the complete file, 0 when unknown */
+        virtual int init(const std::string& path, uint64_t size_hint, HPVBufferPool * pool) = 0;
+        virtual int is_good() = 0;
+        virtual int write_to_stream(const HPVCompressedItem& item) = 0;
+        virtual int write_to_stream(const char * buf, uint64_t pos, uint64_t size) = 0;
+        virtual int write_header(const HPVHeader& header) = 0;
+        virtual uint64_t get_current_pos() = 0;
+        /* Waits for the writes still in flight, HPV_RET_ERROR when any of them or the close failed */
+        virtual int close() = 0;
+    };
+
+    std::unique_ptr<HPVFileWriter> create_file_writer(HPVWriterType type);
+
+	/*
+	*	The original std::ofstream based writer. Every frame is written with a seek, a write and a
+	*	flush, the writes are serialized by the caller (the coordinator thread).
+	*
+	*/
+	class HPVFileStreamWriter : public HPVFileWriter
+	{
+	private:
+		std::unique_ptr<std::ofstream> ofs;
+        HPVBufferPool * pool;
+		bool bInit;
+
+	public:
+		HPVFileStreamWriter() : pool(nullptr), bInit(false) {}
+
+		~HPVFileStreamWriter()
+		{
+			if (ofs && ofs->is_open()) ofs->close();
+
+			ofs.reset();
+		}
+
+		int init(const std::string& _path, uint64_t size_hint, HPVBufferPool * _pool)
+		{
+            (void)size_hint;
+
+            pool = _pool;
+            ofs.reset(new std::ofstream());
+			ofs->open(_path.c_str(), std::ios::binary | std::ios::out);
+
+            bInit = (is_good() == 1) ? true : false;
+
+			return bInit;
+		}
+
+		int is_good()
+		{
+			return (ofs && ofs->is_open() && ofs->good() && !ofs->fail());
+		}
+
+        /*
+         * Write a Compressed item to disk, already contains all info
+         */
+        int write_to_stream(const HPVCompressedItem& item)
+        {
+            int ret = write_to_stream(item.write_out_buf, item.write_pos, item.frame_size);
+
+            if (pool)
+                pool->release(reinterpret_cast<unsigned char *>(item.write_out_buf));
+
+            return ret;
+        }
+
+        /*
+         * Manually pass information to file streamer
+         */
+        int write_to_stream(const char * buf, uint64_t pos, uint64_t frame_size)
+		{
+			if (bInit)
+			{
+				bool bOK = true;
+
+				// write operation
+				if (is_good()) ofs->seekp(pos); else bOK = false;
+				if (is_good()) ofs->write(buf, frame_size); else bOK = false;
+				if (is_good()) ofs->flush(); else bOK = false;
+				if (!is_good()) bOK = false;
+
+				if (!bOK)
+					HPV_ERROR("Error writing frame @ pos %d", pos);
+
+				return bOK;
+			}
+			else
+			{
+				HPV_ERROR("Writing frame to non existing stream.");
+				return -1;
+			}
+		}
+
+		int write_header(const HPVHeader& header)
+		{
+			if (bInit)
+			{
+				int header_size = sizeof(uint32_t) * amount_header_fields;
+
+				ofs->write((char *)&header, header_size);
+
+				if (!is_good())
+					return -1;
+
+				ofs->flush();
+
+				return 0;
+			}
+			else
+			{
+				HPV_ERROR("Writing header to non existing stream.");
+				return -1;
+			}
+
+		}
+
+		uint64_t get_current_pos()
+		{
+			return static_cast<uint64_t>(ofs->tellp());
+		}
+
+		int close()
+		{
+			if (ofs && ofs->is_open())
+			{
+				ofs->flush();
+				ofs->close();
+
+				if (ofs->fail())
+				{
+					HPV_ERROR("Error closing output stream");
+					return HPV_RET_ERROR;
+				}
+
+				return HPV_RET_ERROR_NONE;
+			}
+			else
+			{
+				HPV_ERROR("Trying to close non existing stream");
+				return HPV_RET_ERROR;
+			}
+		}
+	};
+
+    /*
+     *  Positional writer: frames are queued to a few I/O threads that pwrite() them straight to
+     *  their final offset, so several frame writes are in flight and nothing is flushed until
+     *  close(). The output is pre-allocated from the size hint and truncated to the real size
+     *  when it is closed.
+     *
+     *  Only available on POSIX systems, create_file_writer() falls back to the stream writer
+     *  elsewhere.
+     */
+    class HPVPositionalWriter : public HPVFileWriter
+    {
+    public:
+        HPVPositionalWriter();
+        ~HPVPositionalWriter();
+
+        int init(const std::string& path, uint64_t size_hint, HPVBufferPool * pool);
+        int is_good();
+        int write_to_stream(const HPVCompressedItem& item);
+        int write_to_stream(const char * buf, uint64_t pos, uint64_t size);
+        int write_header(const HPVHeader& header);
+        uint64_t get_current_pos();
+        int close();
+
+    private:
+        void io_loop();
+        int write_fully(const char * buf, uint64_t pos, uint64_t size);
+
+        int fd;
+        HPVBufferPool * pool;
+        std::atomic<bool> failed;
+        std::atomic<uint64_t> end_pos;
+        std::vector<std::thread> io_threads;
+        ThreadSafe_RingBuffer<HPVCompressedItem> pending;
+    };
+
+} /* namespace HPV */
+
+#endif
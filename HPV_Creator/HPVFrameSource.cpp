@@ -0,0 +1,302 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <string.h>
+#include <sys/stat.h>
+
+#include "HPVFrameSource.hpp"
+#include "HPVBufferPool.hpp"
+#include "stb_image.h"
+
+namespace HPV {
+
+    /* Hands out a copy of data with the read() contract: buf only grows when too small */
+    static int copy_frame(const std::vector<unsigned char>& data, unsigned char ** buf, std::size_t * capacity, std::size_t * size)
+    {
+        if (*capacity < data.size())
+        {
+            hpv_aligned_free(*buf);
+            *capacity = (data.size() + HPV_BUFFER_ALIGNMENT - 1) & ~(std::size_t)(HPV_BUFFER_ALIGNMENT - 1);
+            *buf = hpv_aligned_alloc(*capacity);
+            if (!*buf)
+            {
+                *capacity = 0;
+                return HPV_RET_ERROR;
+            }
+        }
+
+        memcpy(*buf, data.data(), data.size());
+        *size = data.size();
+        return HPV_RET_ERROR_NONE;
+    }
+
+    int HPVFrameSource::peek(const std::string& name, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total)
+    {
+        (void)max_bytes;
+
+        int ret = read(name, buf, capacity, size);
+        *total = *size;
+        return ret;
+    }
+
+    unsigned char * HPVFrameSource::decode(const unsigned char * buf, std::size_t size, int * width, int * height, int * channels)
+    {
+        return stbi_load_from_memory(buf, static_cast<int>(size), width, height, channels, 4);
+    }
+
+    bool HPVFrameSource::info(const unsigned char * buf, std::size_t size, int * width, int * height, int * channels)
+    {
+        return stbi_info_from_memory(buf, static_cast<int>(size), width, height, channels) != 0;
+    }
+
+    bool HPVFrameSource::map(const std::string& name, HPVMappedImage& image)
+    {
+        (void)name;
+        (void)image;
+        return false;
+    }
+
+    bool HPVFileFrameSource::exists(const std::string& name)
+    {
+        struct stat buffer;
+        return stat(name.c_str(), &buffer) == 0;
+    }
+
+    int HPVFileFrameSource::read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size)
+    {
+        return hpv_read_file(name, buf, capacity, size);
+    }
+
+    int HPVFileFrameSource::peek(const std::string& name, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total)
+    {
+        return hpv_read_file_head(name, max_bytes, buf, capacity, size, total);
+    }
+
+    bool HPVFileFrameSource::map(const std::string& name, HPVMappedImage& image)
+    {
+        return image.open(name);
+    }
+
+    void HPVMemoryFrameSource::add(const std::string& name, const std::vector<unsigned char>& data)
+    {
+        frames[name] = data;
+    }
+
+    void HPVMemoryFrameSource::clear()
+    {
+        frames.clear();
+    }
+
+    bool HPVMemoryFrameSource::exists(const std::string& name)
+    {
+        return frames.find(name) != frames.end();
+    }
+
+    int HPVMemoryFrameSource::read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size)
+    {
+        std::unordered_map<std::string, std::vector<unsigned char>>::const_iterator it = frames.find(name);
+        if (it == frames.end() || it->second.empty())
+            return HPV_RET_ERROR;
+
+        return copy_frame(it->second, buf, capacity, size);
+    }
+
+    std::size_t hpv_raw_frame_size(HPVRawFormat format, int width, int height)
+    {
+        std::size_t pixels = static_cast<std::size_t>(width) * height;
+
+        switch (format)
+        {
+            case HPVRawFormat::HPV_RAW_RGBA:
+                return pixels * 4;
+            case HPVRawFormat::HPV_RAW_RGB:
+                return pixels * 3;
+            case HPVRawFormat::HPV_RAW_YUV420:
+                return pixels + 2 * static_cast<std::size_t>((width + 1) / 2) * ((height + 1) / 2);
+            case HPVRawFormat::HPV_RAW_YUV444:
+                return pixels * 3;
+            default:
+                return 0;
+        }
+    }
+
+    static inline unsigned char clamp_u8(int v)
+    {
+        return static_cast<unsigned char>(v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+
+    /* One row of planar YUV to RGBA, u and v hold one sample per chroma_step pixels (BT.601, 8 bit fixed point) */
+    static void yuv_row_to_rgba(const unsigned char * y, const unsigned char * u, const unsigned char * v, int chroma_step, int width, bool full_range, unsigned char * out)
+    {
+        const int ky = full_range ? 256 : 298;
+        const int y_offset = full_range ? 0 : 16;
+        const int kr_v = full_range ? 359 : 409;
+        const int kg_u = full_range ? 88 : 100;
+        const int kg_v = full_range ? 183 : 208;
+        const int kb_u = full_range ? 454 : 516;
+
+        for (int x = 0; x < width; ++x)
+        {
+            int c = ky * (y[x] - y_offset) + 128;
+            int d = u[x / chroma_step] - 128;
+            int e = v[x / chroma_step] - 128;
+
+            out[0] = clamp_u8((c + kr_v * e) >> 8);
+            out[1] = clamp_u8((c - kg_u * d - kg_v * e) >> 8);
+            out[2] = clamp_u8((c + kb_u * d) >> 8);
+            out[3] = 255;
+            out += 4;
+        }
+    }
+
+    HPVRawFrameSource::HPVRawFrameSource(HPVRawFormat format, int width, int height, bool full_range, std::size_t max_frames)
+        : format(format)
+        , width(width)
+        , height(height)
+        , full_range(full_range)
+        , frame_bytes(hpv_raw_frame_size(format, width, height))
+        , max_frames(max_frames > 0 ? max_frames : 1)
+        , closed(false)
+    {
+    }
+
+    bool HPVRawFrameSource::add(const std::string& name, std::vector<unsigned char>& data)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [this] { return closed || frames.size() < max_frames; });
+        if (closed)
+            return false;
+
+        frames[name].swap(data);
+        return true;
+    }
+
+    void HPVRawFrameSource::close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        cond.notify_all();
+    }
+
+    bool HPVRawFrameSource::exists(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return frames.find(name) != frames.end();
+    }
+
+    int HPVRawFrameSource::copy_out(const std::string& name, bool take, unsigned char ** buf, std::size_t * capacity, std::size_t * size)
+    {
+        std::vector<unsigned char> taken;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            std::unordered_map<std::string, std::vector<unsigned char>>::iterator it = frames.find(name);
+            if (it == frames.end())
+                return HPV_RET_ERROR;
+
+            if (!take)
+                return copy_frame(it->second, buf, capacity, size);
+
+            taken.swap(it->second);
+            frames.erase(it);
+        }
+        cond.notify_all();
+
+        // copied outside the lock, the producer can already fill the freed place
+        return copy_frame(taken, buf, capacity, size);
+    }
+
+    int HPVRawFrameSource::read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size)
+    {
+        return copy_out(name, true, buf, capacity, size);
+    }
+
+    int HPVRawFrameSource::peek(const std::string& name, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total)
+    {
+        (void)max_bytes;
+
+        int ret = copy_out(name, false, buf, capacity, size);
+        *total = *size;
+        return ret;
+    }
+
+    unsigned char * HPVRawFrameSource::decode(const unsigned char * buf, std::size_t size, int * out_width, int * out_height, int * channels)
+    {
+        if (size != frame_bytes)
+            return nullptr;
+
+        // through stb_image's allocator, so the caller releases it like any decoded image
+        std::size_t pixels = static_cast<std::size_t>(width) * height;
+        unsigned char * rgba = static_cast<unsigned char *>(hpv_stbi_malloc(pixels * 4));
+        if (!rgba)
+            return nullptr;
+
+        switch (format)
+        {
+            case HPVRawFormat::HPV_RAW_RGBA:
+                memcpy(rgba, buf, pixels * 4);
+                break;
+
+            case HPVRawFormat::HPV_RAW_RGB:
+                for (std::size_t i = 0; i < pixels; ++i)
+                {
+                    rgba[i * 4 + 0] = buf[i * 3 + 0];
+                    rgba[i * 4 + 1] = buf[i * 3 + 1];
+                    rgba[i * 4 + 2] = buf[i * 3 + 2];
+                    rgba[i * 4 + 3] = 255;
+                }
+                break;
+
+            case HPVRawFormat::HPV_RAW_YUV420:
+            {
+                const int chroma_width = (width + 1) / 2;
+                const unsigned char * u_plane = buf + pixels;
+                const unsigned char * v_plane = u_plane + static_cast<std::size_t>(chroma_width) * ((height + 1) / 2);
+                for (int y = 0; y < height; ++y)
+                {
+                    std::size_t chroma_row = static_cast<std::size_t>(y / 2) * chroma_width;
+                    yuv_row_to_rgba(buf + static_cast<std::size_t>(y) * width, u_plane + chroma_row, v_plane + chroma_row, 2, width, full_range,
+                                    rgba + static_cast<std::size_t>(y) * width * 4);
+                }
+                break;
+            }
+
+            case HPVRawFormat::HPV_RAW_YUV444:
+                for (int y = 0; y < height; ++y)
+                {
+                    std::size_t row = static_cast<std::size_t>(y) * width;
+                    yuv_row_to_rgba(buf + row, buf + pixels + row, buf + 2 * pixels + row, 1, width, full_range, rgba + row * 4);
+                }
+                break;
+
+            default:
+                hpv_stbi_free(rgba);
+                return nullptr;
+        }
+
+        *out_width = width;
+        *out_height = height;
+        *channels = (format == HPVRawFormat::HPV_RAW_RGBA) ? 4 : 3;
+        return rgba;
+    }
+
+    bool HPVRawFrameSource::info(const unsigned char * buf, std::size_t size, int * out_width, int * out_height, int * channels)
+    {
+        (void)buf;
+
+        if (size != frame_bytes)
+            return false;
+
+        *out_width = width;
+        *out_height = height;
+        *channels = (format == HPVRawFormat::HPV_RAW_RGBA) ? 4 : 3;
+        return true;
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,151 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_FRAME_SOURCE_H
+#define HPV_FRAME_SOURCE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+
+#include "HPVMappedImage.hpp"
+
+namespace HPV {
+
+    /*
+     *  Where the creator gets its encoded source images from. Frames are identified by the names
+     *  in HPVCreatorParams::file_names; read() has the same contract as hpv_read_file(): the
+     *  buffer is only (re)allocated when it is too small. Must be safe to call from several
+     *  threads at once.
+     *
+     *  Sources whose frames can only be handed out once, like a pipe, drop a frame on read();
+     *  peek() always leaves it in place.
+     */
+    class HPVFrameSource
+    {
+    public:
+        virtual ~HPVFrameSource() {}
+
+        virtual bool exists(const std::string& name) = 0;
+        virtual int read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size) = 0;
+
+        /*
+         *  Read only the first max_bytes of a frame, enough for its image header, *total gets the
+         *  size of the whole frame, max_bytes 0 reads all of it. Fails for frames that don't
+         *  exist. Sources that can't read partially just read the whole frame.
+         */
+        virtual int peek(const std::string& name, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total);
+
+        /*
+         *  Turn what read() returned into RGBA pixels, *channels gets the amount of channels the
+         *  frame itself has. The pixels are released with stbi_image_free(). The default decodes
+         *  image files with stb_image.
+         */
+        virtual unsigned char * decode(const unsigned char * buf, std::size_t size, int * width, int * height, int * channels);
+
+        /* Dimensions and channels from (the start of) a frame without decoding it, false when unknown */
+        virtual bool info(const unsigned char * buf, std::size_t size, int * width, int * height, int * channels);
+
+        /*
+         *  Map an uncompressed frame so it can be compressed in place, without read() and
+         *  decode(). Returns false when the frame can't be mapped, it is read as usual then.
+         */
+        virtual bool map(const std::string& name, HPVMappedImage& image);
+    };
+
+    /* Frames are image files on disk, the default */
+    class HPVFileFrameSource : public HPVFrameSource
+    {
+    public:
+        bool exists(const std::string& name);
+        int read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size);
+        int peek(const std::string& name, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total);
+        bool map(const std::string& name, HPVMappedImage& image);
+    };
+
+    /*
+     *  Frames are encoded images held in memory, e.g. synthetic frames for benchmarking. All
+     *  frames have to be added before the encode starts.
+     */
+    class HPVMemoryFrameSource : public HPVFrameSource
+    {
+    public:
+        void add(const std::string& name, const std::vector<unsigned char>& data);
+        void clear();
+
+        bool exists(const std::string& name);
+        int read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size);
+
+    private:
+        std::unordered_map<std::string, std::vector<unsigned char>> frames;
+    };
+
+    /* Pixel layouts of raw frames */
+    enum class HPVRawFormat : std::uint32_t
+    {
+        HPV_RAW_RGBA = 0,               /* 8 bit R, G, B, A interleaved */
+        HPV_RAW_RGB,                    /* 8 bit R, G, B interleaved */
+        HPV_RAW_YUV420,                 /* planar Y, U, V with half width and height chroma (Y4M C420) */
+        HPV_RAW_YUV444,                 /* planar Y, U, V at full resolution (Y4M C444) */
+        HPV_NUM_RAW_FORMATS = 4
+    };
+
+    /* Bytes of one raw frame of the given format and dimensions */
+    std::size_t hpv_raw_frame_size(HPVRawFormat format, int width, int height);
+
+    /*
+     *  Uncompressed frames that arrive one by one, e.g. read from stdin or a named pipe, so the
+     *  encoder gets them without an image file round trip. A producer add()s every frame under
+     *  its name before appending that name to the streaming encode, the encoder's read() takes
+     *  the frame out again. add() blocks while max_frames frames are waiting, so a fast producer
+     *  can't run ahead of the encoder by more than that.
+     *
+     *  YUV frames are converted with the BT.601 matrix, studio swing (16-235) unless full_range.
+     */
+    class HPVRawFrameSource : public HPVFrameSource
+    {
+    public:
+        HPVRawFrameSource(HPVRawFormat format, int width, int height, bool full_range, std::size_t max_frames);
+
+        /* Takes over the contents of data, returns false once closed */
+        bool add(const std::string& name, std::vector<unsigned char>& data);
+
+        /* Wakes up a blocked add() and refuses further frames, e.g. when the encode failed */
+        void close();
+
+        std::size_t frame_size() const { return frame_bytes; }
+
+        bool exists(const std::string& name);
+        int read(const std::string& name, unsigned char ** buf, std::size_t * capacity, std::size_t * size);
+        int peek(const std::string& name, std::size_t max_bytes, unsigned char ** buf, std::size_t * capacity, std::size_t * size, std::size_t * total);
+        unsigned char * decode(const unsigned char * buf, std::size_t size, int * width, int * height, int * channels);
+        bool info(const unsigned char * buf, std::size_t size, int * width, int * height, int * channels);
+
+    private:
+        int copy_out(const std::string& name, bool take, unsigned char ** buf, std::size_t * capacity, std::size_t * size);
+
+        HPVRawFormat format;
+        int width;
+        int height;
+        bool full_range;
+        std::size_t frame_bytes;
+        std::size_t max_frames;
+        bool closed;
+
+        std::mutex mtx;
+        std::condition_variable cond;
+        std::unordered_map<std::string, std::vector<unsigned char>> frames;
+    };
+
+} /* namespace HPV */
+
+#endif
@@ -21,6 +21,21 @@
 #define HPV_VERSION_0_0_4 4     /* Added some reserved field for later use */
 #define HPV_VERSION_0_0_5 5     /* Added DXT5_SCALED_CoCgY for better quality */
 #define HPV_VERSION_0_0_6 6     /* Added LZ4 compression/decompression stage */
+#define HPV_VERSION_0_0_7 7     /* Replaced reserved_1 by flags, the frame size table can follow the last frame */
+
+/* Header flags (VERSION 7) */
+#define HPV_FLAG_TRAILER_INDEX 0x01  /* the frame size table is stored after the last frame instead of after the header */
+#define HPV_FLAG_SEGMENT       0x02  /* one segment of a longer encode, reserved_2 is the number of its first frame */
+#define HPV_FLAG_SHARED_FRAMES 0x04  /* frame size table entries with HPV_FRAME_REFERENCE show the payload of an earlier frame */
+#define HPV_FLAG_RAW_FRAMES    0x08  /* frame size table entries with HPV_FRAME_RAW are stored without LZ4 */
+
+/* Frame size table entry of a held frame (HPV_FLAG_SHARED_FRAMES): the lower bits are the index of the
+   earlier frame whose payload it shares, the frame has no payload of its own */
+#define HPV_FRAME_REFERENCE 0x80000000u
+
+/* Frame size table entry of a raw frame (HPV_FLAG_RAW_FRAMES): the payload is the DXT data itself,
+   the lower bits are its size */
+#define HPV_FRAME_RAW 0x40000000u
 
 #define HPV_MAX_SIDE_SIZE 8192
 #define HPV_LZ4_COMPRESSION_LEVEL 9
@@ -72,8 +87,10 @@ namespace HPV
 
         /* VERSION 4 - 6 */
         uint32_t crc_frame_sizes;       /* CRC for the frame size table */
-        uint32_t reserved_1;
-        uint32_t reserved_2;
+
+        /* VERSION 7 */
+        uint32_t flags;                 /* HPV_FLAG_* bits, was reserved_1 */
+        uint32_t reserved_2;            /* first frame of a segment (HPV_FLAG_SEGMENT), otherwise 0 */
     };
 
     // amount of defined header fields
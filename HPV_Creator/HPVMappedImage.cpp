@@ -0,0 +1,349 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "HPVMappedImage.hpp"
+
+namespace HPV {
+
+    static inline uint32_t get16le(const unsigned char * p)
+    {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8);
+    }
+
+    static inline uint32_t get32le(const unsigned char * p)
+    {
+        return get16le(p) | (get16le(p + 2) << 16);
+    }
+
+    static inline bool pnm_isspace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    HPVMappedImage::HPVMappedImage()
+        : file_data(nullptr)
+        , file_size(0)
+#ifdef _WIN32
+        , file_handle(INVALID_HANDLE_VALUE)
+        , mapping_handle(nullptr)
+#endif
+        , width(0)
+        , height(0)
+        , channels(0)
+        , layout(HPV_MAPPED_RGB)
+        , first_row(nullptr)
+        , stride(0)
+    {
+
+    }
+
+    HPVMappedImage::~HPVMappedImage()
+    {
+        close();
+    }
+
+    bool HPVMappedImage::open(const std::string& path)
+    {
+        close();
+
+#ifdef _WIN32
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_handle, &size) || size.QuadPart <= 0)
+        {
+            close();
+            return false;
+        }
+
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_handle)
+        {
+            close();
+            return false;
+        }
+
+        file_data = static_cast<const unsigned char *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        file_size = static_cast<std::size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        // all of it is read right away, fault the pages in with one call
+        flags |= MAP_POPULATE;
+#endif
+        void * data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, flags, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+            return false;
+
+        file_data = static_cast<const unsigned char *>(data);
+        file_size = static_cast<std::size_t>(st.st_size);
+#endif
+
+        if (!file_data || !parse(path))
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void HPVMappedImage::close()
+    {
+#ifdef _WIN32
+        if (file_data)
+            UnmapViewOfFile(file_data);
+        if (mapping_handle)
+            CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if (file_data)
+            munmap(const_cast<unsigned char *>(file_data), file_size);
+#endif
+        file_data = nullptr;
+        file_size = 0;
+        first_row = nullptr;
+    }
+
+    bool HPVMappedImage::parse(const std::string& path)
+    {
+        if (file_size < 2)
+            return false;
+
+        if (file_data[0] == 'P' && (file_data[1] == '5' || file_data[1] == '6'))
+            return parse_pnm();
+
+        if (file_data[0] == 'B' && file_data[1] == 'M')
+            return parse_bmp();
+
+        // TGA has no signature, stb_image only takes it for one when nothing else matched
+        std::size_t dot = path.find_last_of('.');
+        std::string ext = (dot == std::string::npos) ? std::string() : path.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        static const char * signatures[] = { "\x89PNG", "\xFF\xD8", "GIF8", "8BPS", "#?" };
+        for (std::size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); ++i)
+        {
+            std::size_t len = strlen(signatures[i]);
+            if (file_size >= len && memcmp(file_data, signatures[i], len) == 0)
+                return false;
+        }
+
+        return ext == "tga" && parse_tga();
+    }
+
+    /* Same header parsing as stb_image, which doesn't know comments either */
+    bool HPVMappedImage::parse_pnm()
+    {
+        std::size_t pos = 2;
+        bool grey = file_data[1] == '5';
+
+        auto get = [this, &pos]() -> char { return pos < file_size ? static_cast<char>(file_data[pos++]) : 0; };
+        auto skip_whitespace = [this, &pos, &get](char& c) { while (pos < file_size && pnm_isspace(c)) c = get(); };
+        auto get_integer = [this, &pos, &get](char& c) -> int {
+            int value = 0;
+            while (pos < file_size && c >= '0' && c <= '9' && value < (1 << 24))
+            {
+                value = value * 10 + (c - '0');
+                c = get();
+            }
+            return value;
+        };
+
+        char c = get();
+        skip_whitespace(c);
+        width = get_integer(c);
+        skip_whitespace(c);
+        height = get_integer(c);
+        skip_whitespace(c);
+        int maxv = get_integer(c);
+
+        channels = grey ? 1 : 3;
+        std::size_t row_size = static_cast<std::size_t>(width) * channels;
+        if (width <= 0 || height <= 0 || maxv <= 0 || maxv > 255 || pos + row_size * height > file_size)
+            return false;
+
+        layout = grey ? HPV_MAPPED_GREY : HPV_MAPPED_RGB;
+        first_row = file_data + pos;
+        stride = static_cast<std::ptrdiff_t>(row_size);
+        return true;
+    }
+
+    bool HPVMappedImage::parse_tga()
+    {
+        if (file_size < 18)
+            return false;
+
+        const unsigned char * header = file_data;
+        uint32_t id_length = header[0];
+        uint32_t color_map_type = header[1];
+        uint32_t image_type = header[2];
+        uint32_t color_map_length = get16le(header + 5);
+        int bits = header[16];
+        bool top_down = (header[17] & 0x20) != 0;
+
+        // uncompressed true colour or grey, no RLE, no palette, no 16 bit
+        bool true_color = image_type == 2 && (bits == 24 || bits == 32);
+        bool grey = image_type == 3 && bits == 8;
+        if (color_map_type != 0 || color_map_length != 0 || !(true_color || grey))
+            return false;
+
+        width = static_cast<int>(get16le(header + 12));
+        height = static_cast<int>(get16le(header + 14));
+        channels = bits / 8;
+
+        std::size_t offset = 18 + id_length;
+        std::size_t row_size = static_cast<std::size_t>(width) * channels;
+        if (width <= 0 || height <= 0 || offset + row_size * height > file_size)
+            return false;
+
+        layout = grey ? HPV_MAPPED_GREY : (bits == 32 ? HPV_MAPPED_BGRA : HPV_MAPPED_BGR);
+        first_row = file_data + offset + (top_down ? 0 : row_size * (height - 1));
+        stride = top_down ? static_cast<std::ptrdiff_t>(row_size) : -static_cast<std::ptrdiff_t>(row_size);
+        return true;
+    }
+
+    bool HPVMappedImage::parse_bmp()
+    {
+        if (file_size < 26)
+            return false;
+
+        std::size_t offset = get32le(file_data + 10);
+        uint32_t header_size = get32le(file_data + 14);
+        int32_t h = 0;
+        uint32_t bits = 0;
+        uint32_t alpha_mask = 0;
+
+        if (header_size == 12)
+        {
+            width = static_cast<int>(get16le(file_data + 18));
+            h = static_cast<int32_t>(get16le(file_data + 20));
+            bits = get16le(file_data + 24);
+        }
+        else if (header_size == 40 || header_size == 56 || header_size == 108 || header_size == 124)
+        {
+            if (file_size < 14 + header_size)
+                return false;
+
+            width = static_cast<int>(get32le(file_data + 18));
+            h = static_cast<int32_t>(get32le(file_data + 22));
+            bits = get16le(file_data + 28);
+
+            // only plain BI_RGB
+            if (get32le(file_data + 30) != 0)
+                return false;
+
+            if (header_size >= 108)
+                alpha_mask = get32le(file_data + 66);
+        }
+        else
+        {
+            return false;
+        }
+
+        if (bits != 24 || h == 0 || h == INT32_MIN)
+            return false;
+
+        // a 24 bit BMP comes out opaque, stb_image still counts the alpha mask of a v4/v5 header
+        height = h < 0 ? -h : h;
+        channels = alpha_mask ? 4 : 3;
+
+        std::size_t row_size = (static_cast<std::size_t>(width) * 3 + 3) & ~static_cast<std::size_t>(3);
+        if (width <= 0 || offset < 14 + header_size || offset + row_size * height > file_size)
+            return false;
+
+        // positive heights are stored bottom-up
+        bool top_down = h < 0;
+        layout = HPV_MAPPED_BGR;
+        first_row = file_data + offset + (top_down ? 0 : row_size * (height - 1));
+        stride = top_down ? static_cast<std::ptrdiff_t>(row_size) : -static_cast<std::ptrdiff_t>(row_size);
+        return true;
+    }
+
+    void HPVMappedImage::expand_rows(int y, int rows, unsigned char * rgba) const
+    {
+        for (int r = 0; r < rows; ++r)
+        {
+            const unsigned char * src = first_row + (y + r) * stride;
+            unsigned char * out = rgba + static_cast<std::size_t>(r) * width * 4;
+
+            switch (layout)
+            {
+                case HPV_MAPPED_GREY:
+                    for (int x = 0; x < width; ++x, out += 4)
+                    {
+                        out[0] = out[1] = out[2] = src[x];
+                        out[3] = 255;
+                    }
+                    break;
+
+                case HPV_MAPPED_RGB:
+                    for (int x = 0; x < width; ++x, src += 3, out += 4)
+                    {
+                        out[0] = src[0];
+                        out[1] = src[1];
+                        out[2] = src[2];
+                        out[3] = 255;
+                    }
+                    break;
+
+                case HPV_MAPPED_BGR:
+                    for (int x = 0; x < width; ++x, src += 3, out += 4)
+                    {
+                        out[0] = src[2];
+                        out[1] = src[1];
+                        out[2] = src[0];
+                        out[3] = 255;
+                    }
+                    break;
+
+                case HPV_MAPPED_BGRA:
+                    for (int x = 0; x < width; ++x, src += 4, out += 4)
+                    {
+                        out[0] = src[2];
+                        out[1] = src[1];
+                        out[2] = src[0];
+                        out[3] = src[3];
+                    }
+                    break;
+            }
+        }
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,82 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_MAPPED_IMAGE_H
+#define HPV_MAPPED_IMAGE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace HPV {
+
+    /* How the pixels of a mapped image are stored */
+    enum HPVMappedLayout
+    {
+        HPV_MAPPED_GREY = 0,            /* PGM, 8 bit TGA */
+        HPV_MAPPED_RGB,                 /* PPM */
+        HPV_MAPPED_BGR,                 /* 24 bit TGA and BMP */
+        HPV_MAPPED_BGRA                 /* 32 bit TGA */
+    };
+
+    /*
+     *  An uncompressed image file mapped into memory: binary PPM/PGM, uncompressed 8, 24 and 32
+     *  bit TGA and 24 bit BMP. Rows are expanded to RGBA straight from the mapping, a few at a
+     *  time, so the frame is neither copied into a read buffer nor decoded into a full RGBA image
+     *  first. The expanded pixels are the same stb_image gives for these files.
+     *
+     *  open() fails for all other files (and on platforms without file mapping), those go through
+     *  the regular read and decode.
+     */
+    class HPVMappedImage
+    {
+    public:
+        HPVMappedImage();
+        ~HPVMappedImage();
+
+        bool open(const std::string& path);
+        void close();
+
+        /* The whole file, e.g. to hash it */
+        const unsigned char * data() const { return file_data; }
+        std::size_t size() const { return file_size; }
+
+        int get_width() const { return width; }
+        int get_height() const { return height; }
+        int get_channels() const { return channels; }
+
+        /* Rows [y, y + rows) as top-down RGBA, 4 * width bytes per row */
+        void expand_rows(int y, int rows, unsigned char * rgba) const;
+
+    private:
+        HPVMappedImage(const HPVMappedImage&);
+        HPVMappedImage& operator=(const HPVMappedImage&);
+
+        bool parse(const std::string& path);
+        bool parse_pnm();
+        bool parse_tga();
+        bool parse_bmp();
+
+        const unsigned char * file_data;
+        std::size_t file_size;
+#ifdef _WIN32
+        void * file_handle;
+        void * mapping_handle;
+#endif
+
+        int width;
+        int height;
+        int channels;                   /* as stb_image reports them */
+        HPVMappedLayout layout;
+        const unsigned char * first_row;    /* the top row */
+        std::ptrdiff_t stride;          /* bytes to the next row down, negative for bottom-up files */
+    };
+
+} /* namespace HPV */
+
+#endif
@@ -0,0 +1,281 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "HPVMerge.hpp"
+#include "Log.hpp"
+
+namespace HPV {
+
+    /* One input file: its header, frame size table and where its frames are */
+    struct HPVMergeInput
+    {
+        std::string path;
+        HPVHeader header;
+        std::vector<uint32_t> frame_sizes;
+        uint64_t data_offset;
+        uint64_t data_size;
+        bool segment;
+        bool shared_frames;             /* the table has references to earlier frames */
+        bool raw_frames;                /* some frames are stored without LZ4 */
+    };
+
+    static bool read_merge_input(const std::string& path, HPVMergeInput& input, std::string& error)
+    {
+        std::ifstream ifs(path.c_str(), std::ios::binary | std::ios::in);
+        if (!ifs.is_open())
+        {
+            error = "Couldn't open " + path;
+            return false;
+        }
+
+        ifs.seekg(0, std::ios::end);
+        uint64_t file_size = static_cast<uint64_t>(ifs.tellg());
+        ifs.seekg(0, std::ios::beg);
+
+        const uint64_t header_size = sizeof(uint32_t) * amount_header_fields;
+        ifs.read(reinterpret_cast<char *>(&input.header), header_size);
+        if (!ifs || input.header.magic != HPV_MAGIC)
+        {
+            error = path + " is not an HPV file";
+            return false;
+        }
+
+        // older versions have no LZ4 stage, newer ones may have layouts we don't know
+        if (input.header.version < HPV_VERSION_0_0_6 || input.header.version > HPV_VERSION_0_0_7)
+        {
+            std::stringstream ss;
+            ss << path << " has unsupported version " << input.header.version;
+            error = ss.str();
+            return false;
+        }
+
+        uint32_t flags = (input.header.version >= HPV_VERSION_0_0_7) ? input.header.flags : 0;
+        bool trailer_index = (flags & HPV_FLAG_TRAILER_INDEX) != 0;
+        uint64_t table_size = static_cast<uint64_t>(input.header.number_of_frames) * sizeof(uint32_t);
+
+        if (header_size + table_size > file_size)
+        {
+            error = "Frame size table doesn't fit in " + path;
+            return false;
+        }
+
+        if (trailer_index)
+        {
+            ifs.seekg(file_size - table_size, std::ios::beg);
+        }
+
+        input.frame_sizes.resize(input.header.number_of_frames);
+        ifs.read(reinterpret_cast<char *>(input.frame_sizes.data()), table_size);
+        if (!ifs)
+        {
+            error = "Couldn't read the frame size table of " + path;
+            return false;
+        }
+
+        input.shared_frames = (flags & HPV_FLAG_SHARED_FRAMES) != 0;
+        input.raw_frames = (flags & HPV_FLAG_RAW_FRAMES) != 0;
+
+        uint32_t crc = 0;
+        input.data_size = 0;
+        for (std::size_t i = 0; i < input.frame_sizes.size(); ++i)
+        {
+            crc += input.frame_sizes[i];
+
+            if (input.shared_frames && (input.frame_sizes[i] & HPV_FRAME_REFERENCE))
+            {
+                if ((input.frame_sizes[i] & ~HPV_FRAME_REFERENCE) >= i)
+                {
+                    error = "Frame size table of " + path + " references a later frame, corrupt file";
+                    return false;
+                }
+                continue;
+            }
+
+            input.data_size += input.raw_frames ? (input.frame_sizes[i] & ~HPV_FRAME_RAW) : input.frame_sizes[i];
+        }
+
+        if (crc != input.header.crc_frame_sizes)
+        {
+            error = "Frame size table CRC of " + path + " doesn't match, corrupt file";
+            return false;
+        }
+
+        input.path = path;
+        input.data_offset = trailer_index ? header_size : header_size + table_size;
+        input.segment = (flags & HPV_FLAG_SEGMENT) != 0;
+
+        if (input.data_offset + input.data_size + (trailer_index ? table_size : 0) > file_size)
+        {
+            error = path + " is truncated";
+            return false;
+        }
+
+        return true;
+    }
+
+    int hpv_merge(const std::vector<std::string>& in_paths, const std::string& out_path, std::string& error, bool allow_gaps)
+    {
+        if (in_paths.empty())
+        {
+            error = "Nothing to merge";
+            return HPV_RET_ERROR;
+        }
+
+        std::vector<HPVMergeInput> inputs(in_paths.size());
+        bool all_segments = true;
+
+        for (std::size_t i = 0; i < in_paths.size(); ++i)
+        {
+            if (in_paths[i] == out_path)
+            {
+                error = "Can't merge " + out_path + " into itself";
+                return HPV_RET_ERROR;
+            }
+
+            if (!read_merge_input(in_paths[i], inputs[i], error))
+                return HPV_RET_ERROR;
+
+            const HPVHeader& first = inputs[0].header;
+            const HPVHeader& header = inputs[i].header;
+            if (header.video_width != first.video_width || header.video_height != first.video_height ||
+                header.compression_type != first.compression_type || header.frame_rate != first.frame_rate)
+            {
+                error = in_paths[i] + " has other dimensions, compression type or frame rate than " + in_paths[0];
+                return HPV_RET_ERROR;
+            }
+
+            all_segments = all_segments && inputs[i].segment;
+        }
+
+        // segments know where they belong, reserved_2 is their first frame
+        if (all_segments)
+        {
+            std::stable_sort(inputs.begin(), inputs.end(), [](const HPVMergeInput& a, const HPVMergeInput& b) {
+                return a.header.reserved_2 < b.header.reserved_2;
+            });
+
+            for (std::size_t i = 1; i < inputs.size(); ++i)
+            {
+                uint64_t expected = static_cast<uint64_t>(inputs[i - 1].header.reserved_2) + inputs[i - 1].header.number_of_frames;
+                if (inputs[i].header.reserved_2 < expected)
+                {
+                    error = inputs[i].path + " overlaps " + inputs[i - 1].path;
+                    return HPV_RET_ERROR;
+                }
+
+                if (inputs[i].header.reserved_2 > expected)
+                {
+                    std::stringstream ss;
+                    ss << "Frames " << expected << " to " << inputs[i].header.reserved_2 - 1 << " are missing between "
+                       << inputs[i - 1].path << " and " << inputs[i].path;
+                    if (!allow_gaps)
+                    {
+                        error = ss.str();
+                        return HPV_RET_ERROR;
+                    }
+                    HPV_VERBOSE("%s", ss.str().c_str());
+                }
+            }
+        }
+
+        // references of held frames move along with the frames of their file
+        std::vector<uint32_t> frame_sizes;
+        uint32_t flags = 0;
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+        {
+            uint64_t first_frame = frame_sizes.size();
+            for (std::size_t f = 0; f < inputs[i].frame_sizes.size(); ++f)
+            {
+                uint32_t entry = inputs[i].frame_sizes[f];
+                if (inputs[i].shared_frames && (entry & HPV_FRAME_REFERENCE))
+                {
+                    uint64_t owner = first_frame + (entry & ~HPV_FRAME_REFERENCE);
+                    if (owner >= HPV_FRAME_REFERENCE)
+                    {
+                        error = "Too many frames to merge into one file";
+                        return HPV_RET_ERROR;
+                    }
+                    entry = HPV_FRAME_REFERENCE | static_cast<uint32_t>(owner);
+                }
+                frame_sizes.push_back(entry);
+            }
+            flags |= inputs[i].shared_frames ? HPV_FLAG_SHARED_FRAMES : 0;
+            flags |= inputs[i].raw_frames ? HPV_FLAG_RAW_FRAMES : 0;
+        }
+
+        if (frame_sizes.size() > UINT32_MAX)
+        {
+            error = "Too many frames to merge into one file";
+            return HPV_RET_ERROR;
+        }
+
+        // the layout of a regular encode: header, frame size table, frames
+        HPVHeader header = inputs[0].header;
+        header.version = flags ? HPV_VERSION_0_0_7 : HPV_VERSION_0_0_6;
+        header.number_of_frames = static_cast<uint32_t>(frame_sizes.size());
+        header.crc_frame_sizes = 0;
+        header.flags = flags;
+        header.reserved_2 = 0;
+        for (std::size_t i = 0; i < frame_sizes.size(); ++i)
+        {
+            header.crc_frame_sizes += frame_sizes[i];
+        }
+
+        std::ofstream ofs(out_path.c_str(), std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!ofs.is_open())
+        {
+            error = "Couldn't create " + out_path;
+            return HPV_RET_ERROR;
+        }
+
+        ofs.write(reinterpret_cast<const char *>(&header), sizeof(uint32_t) * amount_header_fields);
+        ofs.write(reinterpret_cast<const char *>(frame_sizes.data()), frame_sizes.size() * sizeof(uint32_t));
+
+        std::vector<char> block(HPV_MERGE_COPY_BLOCK);
+        for (std::size_t i = 0; i < inputs.size() && ofs; ++i)
+        {
+            std::ifstream ifs(inputs[i].path.c_str(), std::ios::binary | std::ios::in);
+            ifs.seekg(inputs[i].data_offset, std::ios::beg);
+
+            uint64_t remaining = inputs[i].data_size;
+            while (remaining > 0 && ifs && ofs)
+            {
+                std::size_t chunk = static_cast<std::size_t>(std::min<uint64_t>(remaining, block.size()));
+                if (!ifs.read(block.data(), chunk))
+                    break;
+                ofs.write(block.data(), chunk);
+                remaining -= chunk;
+            }
+
+            if (remaining > 0)
+            {
+                error = "Couldn't copy the frames of " + inputs[i].path;
+                ofs.close();
+                remove(out_path.c_str());
+                return HPV_RET_ERROR;
+            }
+        }
+
+        ofs.close();
+        if (!ofs)
+        {
+            error = "Couldn't write " + out_path;
+            remove(out_path.c_str());
+            return HPV_RET_ERROR;
+        }
+
+        HPV_VERBOSE("Merged %zu files with %u frames into %s", inputs.size(), header.number_of_frames, out_path.c_str());
+        return HPV_RET_ERROR_NONE;
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,40 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_MERGE_H
+#define HPV_MERGE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "HPVHeader.hpp"
+
+/* Frame data is copied from the inputs in blocks of this size */
+#define HPV_MERGE_COPY_BLOCK (4 * 1024 * 1024)
+
+namespace HPV {
+
+    /*
+     *  Concatenates HPV files into one, without recompressing: the header, the frame size table
+     *  and its crc are rebuilt, the compressed frames are copied as they are. All inputs must
+     *  have the same dimensions, compression type and frame rate.
+     *
+     *  Segments (HPV_FLAG_SEGMENT) are put in the order of their first frame, whatever the
+     *  order of in_paths, and must not overlap. Frames missing between two segments are an
+     *  error too, unless allow_gaps is set. Other files are merged in the given order. The
+     *  result has the layout of a regular single encode, so merging the segments of a range
+     *  gives the same file as encoding that range in one go.
+     *
+     *  Returns HPV_RET_ERROR_NONE on success, otherwise error tells what went wrong.
+     */
+    int hpv_merge(const std::vector<std::string>& in_paths, const std::string& out_path, std::string& error, bool allow_gaps = false);
+
+} /* namespace HPV */
+
+#endif
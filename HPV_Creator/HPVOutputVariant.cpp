@@ -0,0 +1,309 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <string.h>
+#include <sstream>
+
+#include "HPVOutputVariant.hpp"
+#include "YCoCg.h"
+#include "YCoCgDXT.h"
+#include "lz4.h"
+#include "lz4hc.h"
+#include "Log.hpp"
+
+namespace HPV {
+
+    void hpv_box_downscale(const unsigned char * src, int src_width, int src_height, int factor, uint16_t * sums, unsigned char * dst)
+    {
+        const int width = src_width / factor;
+        const int height = src_height / factor;
+        const int samples = factor * factor;
+        const std::size_t src_row = static_cast<std::size_t>(src_width) * 4;
+        const std::size_t num_sums = static_cast<std::size_t>(width) * 4;
+
+        // one row of channel sums, 16 bits hold up to 257 samples of 255
+        for (int y = 0; y < height; ++y)
+        {
+            std::fill(sums, sums + num_sums, 0);
+
+            for (int dy = 0; dy < factor; ++dy)
+            {
+                const unsigned char * row = src + (static_cast<std::size_t>(y) * factor + dy) * src_row;
+                for (int x = 0; x < width; ++x)
+                {
+                    const unsigned char * px = row + static_cast<std::size_t>(x) * factor * 4;
+                    uint16_t * sum = &sums[static_cast<std::size_t>(x) * 4];
+                    for (int dx = 0; dx < factor * 4; dx += 4)
+                    {
+                        sum[0] += px[dx + 0];
+                        sum[1] += px[dx + 1];
+                        sum[2] += px[dx + 2];
+                        sum[3] += px[dx + 3];
+                    }
+                }
+            }
+
+            unsigned char * out = dst + static_cast<std::size_t>(y) * width * 4;
+            for (std::size_t i = 0; i < num_sums; ++i)
+            {
+                out[i] = static_cast<unsigned char>((sums[i] + samples / 2) / samples);
+            }
+        }
+    }
+
+    HPVOutputVariant::HPVOutputVariant()
+        : type(HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA)
+        , width(0)
+        , height(0)
+        , bytes_per_frame(0)
+        , dxt_compress(nullptr)
+        , trailer_index(false)
+        , bytes_in_header(0)
+        , bytes_in_framesize_table(0)
+        , offset_runner(0)
+        , compressed_size(0)
+        , write_failed(false)
+    {
+
+    }
+
+    HPVOutputVariant::~HPVOutputVariant()
+    {
+        stop();
+        if (writer_thread && writer_thread->joinable())
+        {
+            writer_thread->join();
+        }
+        if (fs)
+        {
+            fs->close();
+        }
+    }
+
+    int HPVOutputVariant::init(const HPVOutputParams& _params, const HPVHeader& main_header, int src_channels, std::size_t table_frames,
+                               HPVWriterType writer_type, HPVDXTFunc _dxt_compress, std::string& error)
+    {
+        params = _params;
+        type = params.type;
+        dxt_compress = _dxt_compress;
+
+        if (params.out_path.empty() || type >= HPVCompressionType::HPV_NUM_TYPES)
+        {
+            error = "Extra output needs a path and a valid compression type";
+            return HPV_RET_ERROR;
+        }
+
+        if (params.downscale != 1 && params.downscale != 2 && params.downscale != 4)
+        {
+            error = "Extra output " + params.out_path + " can only be downscaled by 1, 2 or 4";
+            return HPV_RET_ERROR;
+        }
+
+        width = static_cast<int>(main_header.video_width) / params.downscale;
+        height = static_cast<int>(main_header.video_height) / params.downscale;
+        if (width < 4 || height < 4 || width % 4 != 0 || height % 4 != 0)
+        {
+            std::stringstream ss;
+            ss << "Extra output " << params.out_path << " would be " << width << "x" << height << ", both sides must be a multiple of 4";
+            error = ss.str();
+            return HPV_RET_ERROR;
+        }
+
+        // same choice as for the main output
+        bytes_per_frame = static_cast<std::size_t>(width) * height;
+        if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == type && src_channels == 3)
+        {
+            type = HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA;
+        }
+        if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type)
+        {
+            bytes_per_frame /= 2;
+        }
+
+        fs = create_file_writer(writer_type);
+        uint64_t size_hint = sizeof(uint32_t) * amount_header_fields + table_frames * (sizeof(uint32_t) + bytes_per_frame);
+        if (!fs->init(params.out_path, size_hint, &write_pool))
+        {
+            error = "Couldn't open extra output " + params.out_path;
+            return HPV_RET_ERROR;
+        }
+
+        HPVHeader header = main_header;
+        header.video_width = width;
+        header.video_height = height;
+        header.compression_type = type;
+        // every frame gets its own LZ4 payload here
+        header.flags &= ~(HPV_FLAG_SHARED_FRAMES | HPV_FLAG_RAW_FRAMES);
+        fs->write_header(header);
+        bytes_in_header = fs->get_current_pos();
+
+        trailer_index = (main_header.version >= HPV_VERSION_0_0_7) && (main_header.flags & HPV_FLAG_TRAILER_INDEX);
+        if (trailer_index)
+        {
+            bytes_in_framesize_table = 0;
+        }
+        else
+        {
+            frame_size_table.assign(table_frames, 0);
+            bytes_in_framesize_table = table_frames * sizeof(uint32_t);
+            fs->write_to_stream((const char *)frame_size_table.data(), bytes_in_header, bytes_in_framesize_table);
+        }
+
+        frame_size_table.clear();
+        frame_size_table.reserve(table_frames);
+        offset_runner = bytes_in_header + bytes_in_framesize_table;
+        compressed_size = 0;
+        write_failed = false;
+
+        HPV_VERBOSE("Extra output %s: %dx%d, type %s", params.out_path.c_str(), width, height, HPVCompressionTypeStrings[(int)type].c_str());
+        return HPV_RET_ERROR_NONE;
+    }
+
+    void HPVOutputVariant::start(std::size_t window)
+    {
+        write_queue.reset(window);
+        write_pool.init(LZ4_COMPRESSBOUND(bytes_per_frame));
+        writer_thread.reset(new std::thread(&HPVOutputVariant::write_loop, this));
+    }
+
+    bool HPVOutputVariant::encode(const unsigned char * pixels, int src_width, int src_height, uint64_t index, HPVWorkerArena& arena)
+    {
+        if (!arena.reserve_variant(static_cast<std::size_t>(width) * height * 4, static_cast<std::size_t>(width) * 4, bytes_per_frame))
+            return false;
+
+        // the YCoCg conversion works in place, the main output still needs the pixels
+        unsigned char * src = const_cast<unsigned char *>(pixels);
+        if (params.downscale > 1)
+        {
+            hpv_box_downscale(pixels, src_width, src_height, params.downscale, arena.variant_sums, arena.variant_pixels);
+            src = arena.variant_pixels;
+        }
+        else if (HPVCompressionType::HPV_TYPE_SCALED_DXT5_CoCg_Y == type)
+        {
+            memcpy(arena.variant_pixels, pixels, static_cast<std::size_t>(width) * height * 4);
+            src = arena.variant_pixels;
+        }
+
+        if (HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA == type)
+        {
+            dxt_compress(arena.variant_dxt, src, width, height, false);
+        }
+        else if (HPVCompressionType::HPV_TYPE_DXT5_ALPHA == type)
+        {
+            dxt_compress(arena.variant_dxt, src, width, height, true);
+        }
+        else
+        {
+            ConvertRGBToCoCg_Y(src, width, height);
+            CompressYCoCgDXT5(src, arena.variant_dxt, width, height, width * 4);
+        }
+
+        char * write_buf = reinterpret_cast<char *>(write_pool.acquire());
+        if (!write_buf)
+            return false;
+
+        int size = LZ4_compress_HC_extStateHC(arena.lz4_state, (const char *)arena.variant_dxt, write_buf, static_cast<int>(bytes_per_frame),
+                                              static_cast<int>(write_pool.get_buffer_size()), HPV_LZ4_COMPRESSION_LEVEL);
+        if (size <= 0)
+        {
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+            return false;
+        }
+
+        HPVCompressedItem item;
+        item.write_out_buf = write_buf;
+        item.frame_size = static_cast<uint64_t>(size);
+        item.compression_ratio = (size / (float)bytes_per_frame) * 100.f;
+        if (!write_queue.push(item, index))
+        {
+            // stopped while we were compressing
+            write_pool.release(reinterpret_cast<unsigned char *>(write_buf));
+        }
+
+        return true;
+    }
+
+    void HPVOutputVariant::write_loop()
+    {
+        HPVCompressedItem item;
+
+        // an item without buffer marks the end, see finish()
+        while (write_queue.wait_and_pop(item) && item.write_out_buf)
+        {
+            item.write_pos = offset_runner;
+            fs->write_to_stream(item);
+            if (!fs->is_good())
+            {
+                HPV_ERROR("Error writing to disk for %s", params.out_path.c_str());
+                write_failed = true;
+                break;
+            }
+
+            offset_runner += item.frame_size;
+            compressed_size += item.frame_size;
+            frame_size_table.push_back(static_cast<uint32_t>(item.frame_size));
+        }
+
+        // frames beyond the end or after a stop go back to the pool
+        write_queue.close();
+        while (write_queue.try_pop(item))
+        {
+            if (item.write_out_buf)
+                write_pool.release(reinterpret_cast<unsigned char *>(item.write_out_buf));
+        }
+    }
+
+    int HPVOutputVariant::finish(uint32_t num_frames)
+    {
+        if (!fs)
+            return HPV_RET_ERROR;
+
+        if (writer_thread)
+        {
+            write_queue.push(HPVCompressedItem(), num_frames);
+            writer_thread->join();
+            writer_thread.reset();
+        }
+
+        uint32_t length = static_cast<uint32_t>(frame_size_table.size());
+        uint32_t crc = 0;
+        for (std::size_t i = 0; i < frame_size_table.size(); ++i)
+        {
+            crc += frame_size_table[i];
+        }
+
+        bool good = fs->is_good() && !write_failed;
+
+        if (trailer_index)
+        {
+            bytes_in_framesize_table = frame_size_table.size() * sizeof(uint32_t);
+            good = (fs->write_to_stream((const char *)frame_size_table.data(), offset_runner, bytes_in_framesize_table) == 1) && good;
+        }
+        else
+        {
+            // the reserved table keeps size 0 for the frames that didn't make it
+            length = static_cast<uint32_t>(bytes_in_framesize_table / sizeof(uint32_t));
+            frame_size_table.resize(length, 0);
+            good = (fs->write_to_stream((const char *)frame_size_table.data(), bytes_in_header, bytes_in_framesize_table) == 1) && good;
+        }
+
+        good = (fs->write_to_stream((const char *)&length, 16, 4) == 1) && good;
+        good = (fs->write_to_stream((const char *)&crc, 28, 4) == 1) && good;
+
+        good = (fs->close() == HPV_RET_ERROR_NONE) && good;
+        fs.reset();
+
+        return good ? HPV_RET_ERROR_NONE : HPV_RET_ERROR;
+    }
+
+    void HPVOutputVariant::stop()
+    {
+        write_queue.close();
+    }
+
+} /* namespace HPV */
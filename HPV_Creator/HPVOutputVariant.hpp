@@ -0,0 +1,110 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_OUTPUT_VARIANT_H
+#define HPV_OUTPUT_VARIANT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+
+#include "HPVHeader.hpp"
+#include "HPVBufferPool.hpp"
+#include "HPVFileWriter.hpp"
+#include "ThreadSafeContainers.hpp"
+#include "DXTSIMD.h"
+
+namespace HPV {
+
+    /* One more output of an encode, see HPVCreatorParams::extra_outputs */
+    struct HPVOutputParams
+    {
+        std::string out_path;
+        HPVCompressionType type;
+        uint8_t downscale;              /* 1 = full resolution, 2 = half, 4 = quarter width and height */
+    };
+
+    /*
+     *  HPVOutputVariant: an extra output that is encoded from the frames the creator decodes
+     *  anyway. Workers hand it the RGBA pixels of every frame, it box filters them down, DXT and
+     *  LZ4 compresses them into its own file. Its writer thread puts the frames in order, like
+     *  the creator's coordinator does for the main output.
+     */
+    class HPVOutputVariant
+    {
+    public:
+        HPVOutputVariant();
+        ~HPVOutputVariant();
+
+        /*
+         *  Open the output and write its header, derived from the main output's. table_frames is
+         *  the size of the frame size table reserved up front, 0 when it goes after the last frame.
+         *  src_channels picks DXT1 for a DXT5 output of frames without alpha, like the main output.
+         *  dxt_compress is the DXT1/DXT5 compressor of the main output.
+         */
+        int init(const HPVOutputParams& params, const HPVHeader& main_header, int src_channels, std::size_t table_frames,
+                 HPVWriterType writer_type, HPVDXTFunc dxt_compress, std::string& error);
+
+        /* Starts the writer, at most window frames may wait for it */
+        void start(std::size_t window);
+
+        /* Compress the frame with the given index, called by the workers. False when it failed. */
+        bool encode(const unsigned char * pixels, int src_width, int src_height, uint64_t index, HPVWorkerArena& arena);
+
+        /* Waits for the first num_frames frames, then completes the file */
+        int finish(uint32_t num_frames);
+
+        /* Stops the writer, frames that didn't make it yet are dropped. finish() still completes the file. */
+        void stop();
+
+        const std::string& get_path() const { return params.out_path; }
+        int get_width() const { return width; }
+        int get_height() const { return height; }
+        HPVCompressionType get_type() const { return type; }
+        uint64_t get_compressed_size() const { return compressed_size; }
+
+    private:
+        HPVOutputVariant(const HPVOutputVariant&);
+        HPVOutputVariant& operator=(const HPVOutputVariant&);
+
+        void write_loop();
+
+        HPVOutputParams params;
+        HPVCompressionType type;
+        int width;
+        int height;
+        std::size_t bytes_per_frame;
+        HPVDXTFunc dxt_compress;
+
+        std::unique_ptr<HPVFileWriter> fs;
+        HPVBufferPool write_pool;
+        ThreadSafe_ReorderBuffer<HPVCompressedItem> write_queue;
+        std::unique_ptr<std::thread> writer_thread;
+
+        bool trailer_index;
+        std::size_t bytes_in_header;
+        std::size_t bytes_in_framesize_table;
+        uint64_t offset_runner;
+        std::vector<uint32_t> frame_size_table;
+        uint64_t compressed_size;
+        bool write_failed;
+    };
+
+    /*
+     *  Averages every factor x factor block of RGBA pixels into one. Plain loops over the
+     *  interleaved channels, so the compiler can vectorize them. sums is scratch space for one
+     *  row of channel sums, src_width / factor * 4 entries.
+     */
+    void hpv_box_downscale(const unsigned char * src, int src_width, int src_height, int factor, uint16_t * sums, unsigned char * dst);
+
+} /* namespace HPV */
+
+#endif
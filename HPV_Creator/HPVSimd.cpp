@@ -0,0 +1,138 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "HPVSimd.hpp"
+
+#if defined(HPV_ARCH_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace HPV {
+
+#if defined(HPV_ARCH_X86)
+    static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+        for (int i = 0; i < 4; ++i)
+            regs[i] = static_cast<uint32_t>(info[i]);
+#else
+        if (!__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3]))
+            regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#endif
+    }
+
+    /* Register state the OS saves on a context switch, XCR0 */
+    static uint64_t os_saved_state()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        uint32_t lo = 0;
+        uint32_t hi = 0;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+    }
+
+    struct HPVCpuFeatures
+    {
+        HPVCpuFeatures() : sse2(false), sse41(false), avx2(false), avx512(false)
+        {
+            uint32_t regs[4];
+            cpuid(0, 0, regs);
+            uint32_t max_leaf = regs[0];
+
+            cpuid(1, 0, regs);
+            sse2 = (regs[3] & (1u << 26)) != 0;
+            sse41 = (regs[2] & (1u << 19)) != 0;
+
+            // AVX needs the OS to save the ymm registers too
+            bool osxsave = (regs[2] & (1u << 27)) != 0;
+            bool avx = (regs[2] & (1u << 28)) != 0;
+            uint64_t saved = osxsave ? os_saved_state() : 0;
+            bool ymm_saved = (saved & 0x6) == 0x6;
+            // AVX-512 also needs the opmask and the upper zmm registers saved
+            bool zmm_saved = (saved & 0xe6) == 0xe6;
+
+            if (max_leaf >= 7 && avx && ymm_saved)
+            {
+                cpuid(7, 0, regs);
+                avx2 = (regs[1] & (1u << 5)) != 0;
+                avx512 = zmm_saved && (regs[1] & (1u << 16)) != 0;
+            }
+        }
+
+        bool sse2;
+        bool sse41;
+        bool avx2;
+        bool avx512;
+    };
+
+    static const HPVCpuFeatures& cpu_features()
+    {
+        static HPVCpuFeatures features;
+        return features;
+    }
+#endif
+
+    bool hpv_simd_supported(HPVSimdLevel level)
+    {
+        switch (level)
+        {
+            case HPV_SIMD_SCALAR:
+                return true;
+#if defined(HPV_ARCH_X86)
+            case HPV_SIMD_SSE2:
+                return cpu_features().sse2;
+            case HPV_SIMD_SSE41:
+                return cpu_features().sse41;
+            case HPV_SIMD_AVX2:
+                return cpu_features().avx2;
+            case HPV_SIMD_AVX512:
+                return cpu_features().avx512;
+#endif
+#if defined(HPV_ARCH_NEON)
+            case HPV_SIMD_NEON:
+                // part of every ARMv8 CPU and of the ARMv7 builds that enable it
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    const char * hpv_simd_name(HPVSimdLevel level)
+    {
+        static const char * names[HPV_NUM_SIMD_LEVELS] = { "scalar", "sse2", "sse4.1", "avx2", "avx512", "neon" };
+        return (level >= HPV_SIMD_SCALAR && level < HPV_NUM_SIMD_LEVELS) ? names[level] : "unknown";
+    }
+
+    bool hpv_simd_from_name(const char * name, HPVSimdLevel& level)
+    {
+        for (int i = HPV_SIMD_SCALAR; i < HPV_NUM_SIMD_LEVELS; ++i)
+        {
+            if (strcmp(name, hpv_simd_name(static_cast<HPVSimdLevel>(i))) == 0)
+            {
+                level = static_cast<HPVSimdLevel>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+} /* namespace HPV */
@@ -0,0 +1,55 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_SIMD_H
+#define HPV_SIMD_H
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HPV_ARCH_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define HPV_ARCH_NEON 1
+#endif
+
+/*
+ *  Kernels for an instruction set the build doesn't target by default are compiled with a
+ *  function attribute, so the rest of the library keeps running on any CPU. MSVC needs none.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define HPV_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HPV_TARGET(isa)
+#endif
+
+namespace HPV {
+
+    /* Instruction sets of the SIMD kernels, in the order they are preferred */
+    enum HPVSimdLevel
+    {
+        HPV_SIMD_SCALAR = 0,
+        HPV_SIMD_SSE2,
+        HPV_SIMD_SSE41,
+        HPV_SIMD_AVX2,
+        HPV_SIMD_AVX512,
+        HPV_SIMD_NEON,
+        HPV_NUM_SIMD_LEVELS
+    };
+
+    /* True when the CPU (and the OS, for the wider registers) runs kernels of this level */
+    bool hpv_simd_supported(HPVSimdLevel level);
+
+    /* Short name for logs and the benchmark, e.g. "avx2" */
+    const char * hpv_simd_name(HPVSimdLevel level);
+
+    /* Level of a name hpv_simd_name() gives, false for an unknown name */
+    bool hpv_simd_from_name(const char * name, HPVSimdLevel& level);
+
+} /* namespace HPV */
+
+#endif
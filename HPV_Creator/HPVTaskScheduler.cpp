@@ -0,0 +1,356 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "HPVTaskScheduler.hpp"
+
+namespace HPV {
+
+#if defined(__linux__)
+    /* CPUs granted by a cgroup quota, 0 when there is none */
+    static unsigned int cgroup_quota_cpus()
+    {
+        double quota = -1;
+        double period = 0;
+
+        // cgroup v2: "<quota> <period>" or "max <period>" in the cgroup of this process
+        std::string v2_path = "/sys/fs/cgroup/cpu.max";
+        FILE * fp = fopen("/proc/self/cgroup", "r");
+        if (fp)
+        {
+            char line[512];
+            while (fgets(line, sizeof(line), fp))
+            {
+                if (strncmp(line, "0::", 3) == 0)
+                {
+                    std::string group(line + 3);
+                    group.erase(group.find_last_not_of("\n") + 1);
+                    if (group.size() > 1)
+                        v2_path = "/sys/fs/cgroup" + group + "/cpu.max";
+                    break;
+                }
+            }
+            fclose(fp);
+        }
+
+        const char * v2_candidates[] = { v2_path.c_str(), "/sys/fs/cgroup/cpu.max" };
+        for (int i = 0; i < 2 && quota < 0; ++i)
+        {
+            fp = fopen(v2_candidates[i], "r");
+            if (!fp)
+                continue;
+
+            char limit[32];
+            double v2_period = 0;
+            int fields = fscanf(fp, "%31s %lf", limit, &v2_period);
+            fclose(fp);
+
+            if (fields != 2)
+                continue;
+
+            if (strcmp(limit, "max") == 0)
+                return 0;
+
+            quota = atof(limit);
+            period = v2_period;
+        }
+
+        // cgroup v1: quota of -1 means unlimited
+        if (quota < 0)
+        {
+            const char * v1_dirs[] = { "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct" };
+            for (int i = 0; i < 2 && quota < 0; ++i)
+            {
+                std::string dir(v1_dirs[i]);
+                FILE * q = fopen((dir + "/cpu.cfs_quota_us").c_str(), "r");
+                FILE * p = fopen((dir + "/cpu.cfs_period_us").c_str(), "r");
+                if (q && p && (fscanf(q, "%lf", &quota) != 1 || fscanf(p, "%lf", &period) != 1))
+                    quota = -1;
+                if (q) fclose(q);
+                if (p) fclose(p);
+            }
+        }
+
+        if (quota <= 0 || period <= 0)
+            return 0;
+
+        return static_cast<unsigned int>(std::max(1.0, ceil(quota / period)));
+    }
+#endif
+
+    unsigned int hpv_available_cpus()
+    {
+        unsigned int cpus = std::thread::hardware_concurrency();
+        if (cpus == 0)
+            cpus = 2;
+
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+            cpus = std::min(cpus, static_cast<unsigned int>(CPU_COUNT(&set)));
+
+        unsigned int quota = cgroup_quota_cpus();
+        if (quota > 0)
+            cpus = std::min(cpus, quota);
+#endif
+
+        return cpus;
+    }
+
+    /* the scheduler and worker index of the calling thread, so submit() knows its own deque */
+    static thread_local HPVTaskScheduler * tls_scheduler = nullptr;
+    static thread_local std::size_t tls_worker_idx = 0;
+
+    HPVTaskGroup::HPVTaskGroup() : num_pending(0)
+    {
+
+    }
+
+    void HPVTaskGroup::add()
+    {
+        num_pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void HPVTaskGroup::done()
+    {
+        if (num_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cond.notify_all();
+        }
+    }
+
+    void HPVTaskGroup::wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [this] { return num_pending.load(std::memory_order_acquire) == 0; });
+    }
+
+    std::size_t HPVTaskGroup::pending() const
+    {
+        return num_pending.load(std::memory_order_relaxed);
+    }
+
+    HPVTaskScheduler::HPVTaskScheduler() : active(0), queued(0), next_worker(0), quit(false)
+    {
+        process_cpus = hpv_process_cpus();
+    }
+
+    HPVTaskScheduler::~HPVTaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(park_mtx);
+            quit = true;
+        }
+        park_cond.notify_all();
+
+        for (std::size_t i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+    }
+
+    void HPVTaskScheduler::set_workers(std::size_t num_workers)
+    {
+        if (num_workers == 0)
+            num_workers = 1;
+
+        std::lock_guard<std::mutex> lock(park_mtx);
+
+        // deques are created before any thread can look at them
+        while (workers.size() < num_workers)
+        {
+            workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        }
+
+        active.store(num_workers, std::memory_order_release);
+
+        while (threads.size() < num_workers)
+        {
+            threads.push_back(std::thread(&HPVTaskScheduler::worker_loop, this, threads.size()));
+            pin(threads.size() - 1);
+        }
+
+        park_cond.notify_all();
+    }
+
+    void HPVTaskScheduler::set_affinity(const std::vector<HPVNumaNode>& nodes)
+    {
+        std::lock_guard<std::mutex> lock(park_mtx);
+
+        numa_nodes = nodes;
+
+        for (std::size_t i = 0; i < threads.size(); ++i)
+        {
+            pin(i);
+        }
+    }
+
+    std::size_t HPVTaskScheduler::get_nodes() const
+    {
+        return numa_nodes.empty() ? 1 : numa_nodes.size();
+    }
+
+    void HPVTaskScheduler::pin(std::size_t idx)
+    {
+        if (numa_nodes.empty())
+        {
+            workers[idx]->node.store(0, std::memory_order_release);
+            hpv_pin_thread(threads[idx], process_cpus);
+            return;
+        }
+
+        std::size_t node = idx % numa_nodes.size();
+        workers[idx]->node.store(node, std::memory_order_release);
+        hpv_pin_thread(threads[idx], numa_nodes[node].cpus);
+    }
+
+    void HPVTaskScheduler::set_active(std::size_t num_workers)
+    {
+        std::lock_guard<std::mutex> lock(park_mtx);
+
+        num_workers = std::max<std::size_t>(1, std::min(num_workers, threads.size()));
+        active.store(num_workers, std::memory_order_release);
+
+        park_cond.notify_all();
+    }
+
+    std::size_t HPVTaskScheduler::get_workers() const
+    {
+        return active.load(std::memory_order_acquire);
+    }
+
+    std::size_t HPVTaskScheduler::get_threads() const
+    {
+        return threads.size();
+    }
+
+    void HPVTaskScheduler::submit(HPVTaskGroup& group, const HPVTask& task)
+    {
+        std::size_t num_active = active.load(std::memory_order_acquire);
+        std::size_t idx = (tls_scheduler == this && tls_worker_idx < num_active) ?
+                          tls_worker_idx :
+                          next_worker.fetch_add(1, std::memory_order_relaxed) % num_active;
+
+        Entry entry;
+        entry.task = task;
+        entry.group = &group;
+
+        group.add();
+
+        // counted before it's visible so the count never drops below zero, taking the lock
+        // orders this against a worker that's about to park
+        {
+            std::lock_guard<std::mutex> lock(park_mtx);
+            queued.fetch_add(1, std::memory_order_release);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(workers[idx]->mtx);
+            workers[idx]->tasks.push_back(entry);
+        }
+
+        // parked workers beyond the active count must not swallow the wake-up
+        if (num_active == threads.size())
+            park_cond.notify_one();
+        else
+            park_cond.notify_all();
+    }
+
+    std::size_t HPVTaskScheduler::pending() const
+    {
+        return queued.load(std::memory_order_relaxed);
+    }
+
+    bool HPVTaskScheduler::take(std::size_t idx, Entry& entry)
+    {
+        // newest own task first, it's the one with the warmest caches
+        {
+            Worker& own = *workers[idx];
+            std::lock_guard<std::mutex> lock(own.mtx);
+            if (!own.tasks.empty())
+            {
+                entry = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        // a task of a worker on the same node keeps its memory local, one of another node is
+        // still better than idling
+        return steal(idx, true, entry) || steal(idx, false, entry);
+    }
+
+    bool HPVTaskScheduler::steal(std::size_t idx, bool same_node, Entry& entry)
+    {
+        // the oldest task of another worker, parked workers included
+        std::size_t node = workers[idx]->node.load(std::memory_order_acquire);
+        std::size_t num_workers = workers.size();
+        for (std::size_t i = 1; i < num_workers; ++i)
+        {
+            Worker& victim = *workers[(idx + i) % num_workers];
+            if ((victim.node.load(std::memory_order_acquire) == node) != same_node)
+                continue;
+
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.tasks.empty())
+            {
+                entry = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void HPVTaskScheduler::worker_loop(std::size_t idx)
+    {
+        tls_scheduler = this;
+        tls_worker_idx = idx;
+
+        Entry entry;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(park_mtx);
+                park_cond.wait(lock, [this, idx] {
+                    return quit || (idx < active.load(std::memory_order_acquire) && queued.load(std::memory_order_acquire) > 0);
+                });
+
+                if (quit)
+                    return;
+
+                hpv_set_current_node(workers[idx]->node.load(std::memory_order_acquire));
+            }
+
+            // somebody else may have been quicker, then we just park again
+            if (!take(idx, entry))
+                continue;
+
+            queued.fetch_sub(1, std::memory_order_acq_rel);
+
+            entry.task(idx);
+            entry.group->done();
+            entry.task = HPVTask();
+        }
+    }
+
+} /* namespace HPV */
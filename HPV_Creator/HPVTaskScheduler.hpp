@@ -0,0 +1,131 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef HPV_TASK_SCHEDULER_H
+#define HPV_TASK_SCHEDULER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "HPVAffinity.hpp"
+
+namespace HPV {
+
+    /*
+     *  CPUs this process may actually use: the hardware threads, limited by the affinity mask
+     *  and the cgroup CPU quota on Linux (a quota of 2.5 CPUs gives 3).
+     */
+    unsigned int hpv_available_cpus();
+
+    /* A task gets the index of the worker running it, e.g. to pick that worker's scratch memory */
+    typedef std::function<void(std::size_t worker_idx)> HPVTask;
+
+    /* Tasks that are waited for together */
+    class HPVTaskGroup
+    {
+    public:
+        HPVTaskGroup();
+
+        /* blocks until every task submitted to this group has run */
+        void wait();
+        std::size_t pending() const;
+
+    private:
+        friend class HPVTaskScheduler;
+
+        void add();
+        void done();
+
+        std::atomic<std::size_t> num_pending;
+        std::mutex mtx;
+        std::condition_variable cond;
+    };
+
+    /*
+     *  Work-stealing scheduler. Every worker has its own deque: it takes its newest task first
+     *  and steals the oldest task of another worker when its own deque runs dry. Workers with
+     *  nothing to do park until a task is submitted.
+     *
+     *  Tasks submitted from a worker go to that worker's deque, everything else is spread
+     *  round-robin. The threads live as long as the scheduler, set_workers() only starts the
+     *  missing ones; workers beyond the requested count stay parked.
+     *
+     *  With set_affinity() worker i is pinned to node i % nodes, so any active count spreads
+     *  evenly over the nodes. Thieves then try the workers of their own node first.
+     */
+    class HPVTaskScheduler
+    {
+    public:
+        HPVTaskScheduler();
+        ~HPVTaskScheduler();
+
+        /* starts missing threads, only while no tasks are pending */
+        void set_workers(std::size_t num_workers);
+
+        /* parks or wakes already started workers, safe while tasks run */
+        void set_active(std::size_t num_workers);
+        std::size_t get_workers() const;
+        std::size_t get_threads() const;
+
+        /* pins the workers round-robin to these nodes, an empty list unpins them; only while no tasks are pending */
+        void set_affinity(const std::vector<HPVNumaNode>& nodes);
+        std::size_t get_nodes() const;
+
+        void submit(HPVTaskGroup& group, const HPVTask& task);
+
+        /* tasks waiting for a worker */
+        std::size_t pending() const;
+
+    private:
+        struct Entry
+        {
+            HPVTask task;
+            HPVTaskGroup * group;
+        };
+
+        struct Worker
+        {
+            Worker() : node(0) {}
+
+            std::mutex mtx;
+            std::deque<Entry> tasks;
+            std::atomic<std::size_t> node;      /* index into numa_nodes */
+        };
+
+        void worker_loop(std::size_t idx);
+        bool take(std::size_t idx, Entry& entry);
+        bool steal(std::size_t idx, bool same_node, Entry& entry);
+        void pin(std::size_t idx);
+
+        HPVTaskScheduler(const HPVTaskScheduler&);
+        HPVTaskScheduler& operator=(const HPVTaskScheduler&);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::atomic<std::size_t> active;
+        std::atomic<std::size_t> queued;
+        std::atomic<std::size_t> next_worker;
+        std::vector<HPVNumaNode> numa_nodes;
+        std::vector<int> process_cpus;
+
+        std::mutex park_mtx;
+        std::condition_variable park_cond;
+        bool quit;
+    };
+
+} /* namespace HPV */
+
+#endif
@@ -9,11 +9,18 @@
 #ifndef THREADSAFECONTAINERS_H
 #define THREADSAFECONTAINERS_H
 
+#include <stdint.h>
 #include <mutex>
 #include <condition_variable>
 #include <vector>
 #include <queue>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+
+/* Amount of times a blocking ring buffer operation retries before parking the calling thread */
+#define RINGBUFFER_SPIN_COUNT 64
 
 /*
  * ThreadSafe Queue: allows for threadsafe adding elements to a FIFO queue. It also allows for multiple
@@ -186,4 +193,385 @@ public:
     }
 };
 
+/*
+* ThreadSafe RingBuffer: bounded, lock-free multi-producer/multi-consumer FIFO queue. Every slot
+* carries a sequence number that tells producers and consumers whether it is free or filled, so
+* try_push() and try_pop() only need a single compare-and-swap on the shared positions and never
+* allocate. Based on Dmitry Vyukov's bounded MPMC queue.
+*
+* The blocking push() and pop() spin for a short while and then park the calling thread on a
+* condition variable. The mutex is only touched when a thread actually has to wait, so the
+* fast path stays lock-free. close() wakes up everyone: pushes start failing and pops fail
+* as soon as the remaining items have been drained.
+*
+*/
+template<typename T>
+class ThreadSafe_RingBuffer
+{
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> buffer;
+    std::size_t buffer_mask;
+
+    // keep producer and consumer positions on separate cache lines. Padding rather than
+    // alignas(64): C++11 new doesn't honour over-alignment of the classes that hold a ring buffer.
+    char pad_shared[64 - sizeof(std::unique_ptr<Cell[]>) - sizeof(std::size_t)];
+    std::atomic<std::size_t> enqueue_pos;
+    char pad_enqueue[64 - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> dequeue_pos;
+    char pad_dequeue[64 - sizeof(std::atomic<std::size_t>)];
+
+    std::atomic<bool> closed;
+    std::atomic<int> waiting_producers;
+    std::atomic<int> waiting_consumers;
+    std::mutex park_mtx;
+    std::condition_variable not_full_cond;
+    std::condition_variable not_empty_cond;
+
+    void wake(std::atomic<int>& waiting, std::condition_variable& cond)
+    {
+        // pairs with the fence in park(): either we see the waiter, or the waiter sees our item
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(park_mtx);
+            cond.notify_one();
+        }
+    }
+
+    bool push_slot(const T& new_value)
+    {
+        Cell* cell;
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &buffer[pos & buffer_mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // full
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+
+        cell->data = new_value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop_slot(T& value)
+    {
+        Cell* cell;
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &buffer[pos & buffer_mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // empty
+            else
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+
+        value = std::move(cell->data);
+        cell->sequence.store(pos + buffer_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Spin for a while, then sleep until op() succeeds. Consumers keep draining after close(),
+    // producers give up immediately.
+    template<typename Op>
+    bool park(std::atomic<int>& waiting, std::condition_variable& cond, bool drain_when_closed, Op op)
+    {
+        for (int spin = 0; spin < RINGBUFFER_SPIN_COUNT; ++spin)
+        {
+            if (closed.load(std::memory_order_acquire)) return drain_when_closed && op();
+            if (op()) return true;
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(park_mtx);
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool ok = false;
+        for (;;)
+        {
+            if (closed.load(std::memory_order_acquire))
+            {
+                ok = drain_when_closed && op();
+                break;
+            }
+            if ((ok = op())) break;
+            cond.wait(lock);
+        }
+
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+        return ok;
+    }
+
+public:
+    explicit ThreadSafe_RingBuffer(std::size_t capacity = 2)
+    {
+        reset(capacity);
+    }
+
+    /*
+     * (Re)allocate the ring, capacity is rounded up to a power of two.
+     * Not thread-safe: only call this when no other thread is using the buffer.
+     */
+    void reset(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        buffer.reset(new Cell[size]);
+        buffer_mask = size - 1;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos.store(0, std::memory_order_relaxed);
+        closed.store(false, std::memory_order_relaxed);
+        waiting_producers.store(0, std::memory_order_relaxed);
+        waiting_consumers.store(0, std::memory_order_relaxed);
+    }
+
+    bool try_push(const T& new_value)
+    {
+        if (!push_slot(new_value))
+            return false;
+
+        wake(waiting_consumers, not_empty_cond);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        if (!pop_slot(value))
+            return false;
+
+        wake(waiting_producers, not_full_cond);
+        return true;
+    }
+
+    /*
+     * Blocks while the buffer is full. Returns false when the buffer was closed.
+     */
+    bool push(const T& new_value)
+    {
+        if (!park(waiting_producers, not_full_cond, false, [this, &new_value] { return push_slot(new_value); }))
+            return false;
+
+        wake(waiting_consumers, not_empty_cond);
+        return true;
+    }
+
+    /*
+     * Blocks while the buffer is empty. Returns false when the buffer was closed and drained.
+     */
+    bool pop(T& value)
+    {
+        if (!park(waiting_consumers, not_empty_cond, true, [this, &value] { return pop_slot(value); }))
+            return false;
+
+        wake(waiting_producers, not_full_cond);
+        return true;
+    }
+
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(park_mtx);
+        not_full_cond.notify_all();
+        not_empty_cond.notify_all();
+    }
+
+    bool is_closed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // approximate when other threads are pushing or popping
+    std::size_t size() const
+    {
+        std::size_t head = dequeue_pos.load(std::memory_order_acquire);
+        std::size_t tail = enqueue_pos.load(std::memory_order_acquire);
+        return (tail > head) ? tail - head : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return buffer_mask + 1;
+    }
+};
+
+/*
+* ThreadSafe ReorderBuffer: fixed-capacity window that hands items back in key order. An item with
+* key k is stored in slot k % window, so there are no per-item allocations or lookups. The consumer
+* waits for the next key in line and is only woken when exactly that slot gets filled. Producers
+* that run a full window ahead of the consumer block until the consumer catches up.
+*
+*/
+template<typename T>
+class ThreadSafe_ReorderBuffer
+{
+private:
+    mutable std::mutex mtx;
+    std::vector<T> slots;
+    std::vector<uint8_t> filled;
+    std::size_t filled_count;
+    uint64_t next_key;
+    bool closed;
+    bool consumer_waiting;
+    int waiting_producers;
+    std::condition_variable consumer_cond;
+    std::condition_variable producer_cond;
+
+public:
+    explicit ThreadSafe_ReorderBuffer(std::size_t window = 1)
+    {
+        reset(window);
+    }
+
+    /*
+     * Resize the window and restart at first_key.
+     * Not thread-safe: only call this when no other thread is using the buffer.
+     */
+    void reset(std::size_t window, uint64_t first_key = 0)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        slots.assign(window > 0 ? window : 1, T());
+        filled.assign(slots.size(), 0);
+        filled_count = 0;
+        next_key = first_key;
+        closed = false;
+        consumer_waiting = false;
+        waiting_producers = 0;
+    }
+
+    /*
+     * Blocks while key lies a full window ahead of the consumer. Returns false when the buffer was closed.
+     */
+    bool push(const T& new_value, uint64_t key)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+
+        if (key >= next_key + slots.size())
+        {
+            ++waiting_producers;
+            producer_cond.wait(lock, [this, key] { return closed || key < next_key + slots.size(); });
+            --waiting_producers;
+        }
+
+        if (closed || key < next_key)
+            return false;
+
+        std::size_t idx = key % slots.size();
+        slots[idx] = new_value;
+        filled[idx] = 1;
+        ++filled_count;
+
+        if (key == next_key && consumer_waiting)
+            consumer_cond.notify_one();
+
+        return true;
+    }
+
+    /*
+     * Blocks until the item with the next key in line arrives. Returns false when the buffer was closed.
+     */
+    bool wait_and_pop(T& value)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        std::size_t idx = next_key % slots.size();
+
+        consumer_waiting = true;
+        consumer_cond.wait(lock, [this, idx] { return closed || filled[idx]; });
+        consumer_waiting = false;
+
+        if (!filled[idx])
+            return false;
+
+        take(value, idx);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::size_t idx = next_key % slots.size();
+
+        if (!filled[idx])
+            return false;
+
+        take(value, idx);
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        consumer_cond.notify_all();
+        producer_cond.notify_all();
+    }
+
+    bool empty() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return filled_count == 0;
+    }
+
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return filled_count;
+    }
+
+    std::size_t window() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return slots.size();
+    }
+
+private:
+    // expects mtx to be locked
+    void take(T& value, std::size_t idx)
+    {
+        value = slots[idx];
+        slots[idx] = T();
+        filled[idx] = 0;
+        --filled_count;
+        ++next_key;
+
+        // the window moved up by one, a producer might now fit in
+        if (waiting_producers > 0)
+            producer_cond.notify_all();
+    }
+};
+
 #endif // THREADSAFECONTAINERS_H
@@ -21,7 +21,7 @@ byte CLAMP_BYTE(int x)
 	return ((x) < 0 ? (0) : ((x) > 255 ? 255 : (x)));
 }
 
-void ConvertRGBToCoCg_Y(byte *image, int width, int height) {
+void ConvertRGBToCoCg_Y_Scalar(byte *image, int width, int height) {
 	for (int i = 0; i < width * height; i++) {
 		int r = image[i * 4 + 0];
 		int g = image[i * 4 + 1];
@@ -34,7 +34,7 @@ void ConvertRGBToCoCg_Y(byte *image, int width, int height) {
 	}
 }
 
-void ConvertCoCg_YToRGB(byte *image, int width, int height) {
+void ConvertCoCg_YToRGB_Scalar(byte *image, int width, int height) {
 	for (int i = 0; i < width * height; i++) {
 		int y = image[i * 4 + 3];
 		int co = image[i * 4 + 0] - 128;
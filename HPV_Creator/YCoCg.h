@@ -46,9 +46,15 @@ B  = [   1   -1   -1] [Cg]
 #define COCG_TO_B( co, cg )         ( - co - cg )
 
 byte CLAMP_BYTE(int x);
+
+/* Run the fastest version this CPU supports, see YCoCgSIMD.h */
 void ConvertRGBToCoCg_Y(byte *image, int width, int height);
 void ConvertCoCg_YToRGB(byte *image, int width, int height);
 
+/* The plain per-pixel loops, the SIMD versions give the same bytes */
+void ConvertRGBToCoCg_Y_Scalar(byte *image, int width, int height);
+void ConvertCoCg_YToRGB_Scalar(byte *image, int width, int height);
+
 #ifdef __cplusplus
 }
 #endif
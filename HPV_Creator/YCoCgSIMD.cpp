@@ -0,0 +1,304 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#include <cstddef>
+
+#include "YCoCgSIMD.h"
+
+#if defined(HPV_ARCH_X86)
+#include <immintrin.h>
+#endif
+#if defined(HPV_ARCH_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ *  All versions use the same integer form of the scalar macros, with the +128 folded into the
+ *  rounding so everything stays positive:
+ *
+ *  Co + 128 = (r - b + 257) >> 1            1..256, clamped to 255
+ *  Cg + 128 = (2g - r - b + 514) >> 2       1..256, clamped to 255
+ *  Y        = (r + 2g + b + 2) >> 2         0..255
+ *
+ *  and back, where the two -128 offsets of R cancel out:
+ *
+ *  R = Y + Co - Cg,  G = Y + Cg - 128,  B = Y - Co - Cg + 256,  each clamped to 0..255
+ */
+
+namespace HPV {
+
+#if defined(HPV_ARCH_X86)
+    HPV_TARGET("sse2")
+    static void rgb_to_cocg_y_sse2(byte * image, int width, int height)
+    {
+        const std::size_t count = static_cast<std::size_t>(width) * height;
+        const __m128i mask = _mm_set1_epi32(0xff);
+        const __m128i co_bias = _mm_set1_epi32(257);
+        const __m128i cg_bias = _mm_set1_epi32(514);
+        const __m128i y_bias = _mm_set1_epi32(2);
+
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i * px = reinterpret_cast<__m128i *>(image + i * 4);
+            __m128i v = _mm_loadu_si128(px);
+
+            __m128i r = _mm_and_si128(v, mask);
+            __m128i g2 = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 8), mask), 1);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+            __m128i a = _mm_srli_epi32(v, 24);
+            __m128i rb = _mm_add_epi32(r, b);
+
+            __m128i co = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(r, b), co_bias), 1);
+            __m128i cg = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(g2, cg_bias), rb), 2);
+            __m128i y = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(rb, g2), y_bias), 2);
+
+            // 256 is the only value out of range, x >> 8 is 1 just for that one
+            co = _mm_sub_epi32(co, _mm_srli_epi32(co, 8));
+            cg = _mm_sub_epi32(cg, _mm_srli_epi32(cg, 8));
+
+            __m128i out = _mm_or_si128(_mm_or_si128(co, _mm_slli_epi32(cg, 8)),
+                                       _mm_or_si128(_mm_slli_epi32(a, 16), _mm_slli_epi32(y, 24)));
+            _mm_storeu_si128(px, out);
+        }
+
+        if (i < count)
+        {
+            ConvertRGBToCoCg_Y_Scalar(image + i * 4, static_cast<int>(count - i), 1);
+        }
+    }
+
+    HPV_TARGET("sse2")
+    static inline __m128i cocg_y_to_rgb_4(__m128i v)
+    {
+        const __m128i mask = _mm_set1_epi32(0xff);
+
+        __m128i co = _mm_and_si128(v, mask);
+        __m128i cg = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+        __m128i a = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+        __m128i y = _mm_srli_epi32(v, 24);
+
+        __m128i r = _mm_sub_epi32(_mm_add_epi32(y, co), cg);
+        __m128i g = _mm_sub_epi32(_mm_add_epi32(y, cg), _mm_set1_epi32(128));
+        __m128i b = _mm_sub_epi32(_mm_add_epi32(y, _mm_set1_epi32(256)), _mm_add_epi32(co, cg));
+
+        // the saturating packs clamp to 0..255, which leaves the channels planar:
+        // R0-R3 G0-G3 B0-B3 A0-A3, interleave them back into pixels
+        __m128i planar = _mm_packus_epi16(_mm_packs_epi32(r, g), _mm_packs_epi32(b, a));
+        __m128i rg = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 4));
+        __m128i ba = _mm_unpacklo_epi8(_mm_srli_si128(planar, 8), _mm_srli_si128(planar, 12));
+        return _mm_unpacklo_epi16(rg, ba);
+    }
+
+    HPV_TARGET("sse2")
+    static void cocg_y_to_rgb_sse2(byte * image, int width, int height)
+    {
+        const std::size_t count = static_cast<std::size_t>(width) * height;
+
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i * px = reinterpret_cast<__m128i *>(image + i * 4);
+            _mm_storeu_si128(px, cocg_y_to_rgb_4(_mm_loadu_si128(px)));
+        }
+
+        if (i < count)
+        {
+            ConvertCoCg_YToRGB_Scalar(image + i * 4, static_cast<int>(count - i), 1);
+        }
+    }
+
+    HPV_TARGET("avx2")
+    static void rgb_to_cocg_y_avx2(byte * image, int width, int height)
+    {
+        const std::size_t count = static_cast<std::size_t>(width) * height;
+        const __m256i mask = _mm256_set1_epi32(0xff);
+        const __m256i co_bias = _mm256_set1_epi32(257);
+        const __m256i cg_bias = _mm256_set1_epi32(514);
+        const __m256i y_bias = _mm256_set1_epi32(2);
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i * px = reinterpret_cast<__m256i *>(image + i * 4);
+            __m256i v = _mm256_loadu_si256(px);
+
+            __m256i r = _mm256_and_si256(v, mask);
+            __m256i g2 = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask), 1);
+            __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+            __m256i a = _mm256_srli_epi32(v, 24);
+            __m256i rb = _mm256_add_epi32(r, b);
+
+            __m256i co = _mm256_srli_epi32(_mm256_add_epi32(_mm256_sub_epi32(r, b), co_bias), 1);
+            __m256i cg = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_add_epi32(g2, cg_bias), rb), 2);
+            __m256i y = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(rb, g2), y_bias), 2);
+
+            co = _mm256_sub_epi32(co, _mm256_srli_epi32(co, 8));
+            cg = _mm256_sub_epi32(cg, _mm256_srli_epi32(cg, 8));
+
+            __m256i out = _mm256_or_si256(_mm256_or_si256(co, _mm256_slli_epi32(cg, 8)),
+                                          _mm256_or_si256(_mm256_slli_epi32(a, 16), _mm256_slli_epi32(y, 24)));
+            _mm256_storeu_si256(px, out);
+        }
+
+        if (i < count)
+        {
+            rgb_to_cocg_y_sse2(image + i * 4, static_cast<int>(count - i), 1);
+        }
+    }
+
+    HPV_TARGET("avx2")
+    static void cocg_y_to_rgb_avx2(byte * image, int width, int height)
+    {
+        const std::size_t count = static_cast<std::size_t>(width) * height;
+        const __m256i mask = _mm256_set1_epi32(0xff);
+        const __m256i g_bias = _mm256_set1_epi32(128);
+        const __m256i b_bias = _mm256_set1_epi32(256);
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i * px = reinterpret_cast<__m256i *>(image + i * 4);
+            __m256i v = _mm256_loadu_si256(px);
+
+            __m256i co = _mm256_and_si256(v, mask);
+            __m256i cg = _mm256_and_si256(_mm256_srli_epi32(v, 8), mask);
+            __m256i a = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+            __m256i y = _mm256_srli_epi32(v, 24);
+
+            __m256i r = _mm256_sub_epi32(_mm256_add_epi32(y, co), cg);
+            __m256i g = _mm256_sub_epi32(_mm256_add_epi32(y, cg), g_bias);
+            __m256i b = _mm256_sub_epi32(_mm256_add_epi32(y, b_bias), _mm256_add_epi32(co, cg));
+
+            // packs, unpacks and byte shifts stay within their 128 bit lane, every lane is the
+            // SSE2 version on its own 4 pixels
+            __m256i planar = _mm256_packus_epi16(_mm256_packs_epi32(r, g), _mm256_packs_epi32(b, a));
+            __m256i rg = _mm256_unpacklo_epi8(planar, _mm256_srli_si256(planar, 4));
+            __m256i ba = _mm256_unpacklo_epi8(_mm256_srli_si256(planar, 8), _mm256_srli_si256(planar, 12));
+            _mm256_storeu_si256(px, _mm256_unpacklo_epi16(rg, ba));
+        }
+
+        if (i < count)
+        {
+            cocg_y_to_rgb_sse2(image + i * 4, static_cast<int>(count - i), 1);
+        }
+    }
+#endif
+
+#if defined(HPV_ARCH_NEON)
+    static void rgb_to_cocg_y_neon(byte * image, int width, int height)
+    {
+        const std::size_t count = static_cast<std::size_t>(width) * height;
+        const uint16x8_t co_bias = vdupq_n_u16(257);
+        const uint16x8_t cg_bias = vdupq_n_u16(514);
+        const uint16x8_t y_bias = vdupq_n_u16(2);
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            // vld4 splits the channels, vst4 interleaves them again
+            uint8x8x4_t px = vld4_u8(image + i * 4);
+            uint16x8_t r = vmovl_u8(px.val[0]);
+            uint16x8_t g2 = vshlq_n_u16(vmovl_u8(px.val[1]), 1);
+            uint16x8_t b = vmovl_u8(px.val[2]);
+            uint16x8_t rb = vaddq_u16(r, b);
+
+            uint16x8_t co = vshrq_n_u16(vsubq_u16(vaddq_u16(r, co_bias), b), 1);
+            uint16x8_t cg = vshrq_n_u16(vsubq_u16(vaddq_u16(g2, cg_bias), rb), 2);
+            uint16x8_t y = vshrq_n_u16(vaddq_u16(vaddq_u16(rb, g2), y_bias), 2);
+
+            uint8x8x4_t out;
+            out.val[0] = vqmovn_u16(co);
+            out.val[1] = vqmovn_u16(cg);
+            out.val[2] = px.val[3];
+            out.val[3] = vmovn_u16(y);
+            vst4_u8(image + i * 4, out);
+        }
+
+        if (i < count)
+        {
+            ConvertRGBToCoCg_Y_Scalar(image + i * 4, static_cast<int>(count - i), 1);
+        }
+    }
+
+    static void cocg_y_to_rgb_neon(byte * image, int width, int height)
+    {
+        const std::size_t count = static_cast<std::size_t>(width) * height;
+        const int16x8_t g_bias = vdupq_n_s16(128);
+        const int16x8_t b_bias = vdupq_n_s16(256);
+
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            uint8x8x4_t px = vld4_u8(image + i * 4);
+            int16x8_t co = vreinterpretq_s16_u16(vmovl_u8(px.val[0]));
+            int16x8_t cg = vreinterpretq_s16_u16(vmovl_u8(px.val[1]));
+            int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(px.val[3]));
+
+            uint8x8x4_t out;
+            out.val[0] = vqmovun_s16(vsubq_s16(vaddq_s16(y, co), cg));
+            out.val[1] = vqmovun_s16(vsubq_s16(vaddq_s16(y, cg), g_bias));
+            out.val[2] = vqmovun_s16(vsubq_s16(vaddq_s16(y, b_bias), vaddq_s16(co, cg)));
+            out.val[3] = px.val[2];
+            vst4_u8(image + i * 4, out);
+        }
+
+        if (i < count)
+        {
+            ConvertCoCg_YToRGB_Scalar(image + i * 4, static_cast<int>(count - i), 1);
+        }
+    }
+#endif
+
+    std::vector<HPVYCoCgKernels> hpv_ycocg_kernels()
+    {
+        std::vector<HPVYCoCgKernels> kernels;
+
+        HPVYCoCgKernels scalar = { HPV_SIMD_SCALAR, ConvertRGBToCoCg_Y_Scalar, ConvertCoCg_YToRGB_Scalar };
+        kernels.push_back(scalar);
+
+#if defined(HPV_ARCH_X86)
+        if (hpv_simd_supported(HPV_SIMD_SSE2))
+        {
+            HPVYCoCgKernels sse2 = { HPV_SIMD_SSE2, rgb_to_cocg_y_sse2, cocg_y_to_rgb_sse2 };
+            kernels.push_back(sse2);
+        }
+        if (hpv_simd_supported(HPV_SIMD_AVX2))
+        {
+            HPVYCoCgKernels avx2 = { HPV_SIMD_AVX2, rgb_to_cocg_y_avx2, cocg_y_to_rgb_avx2 };
+            kernels.push_back(avx2);
+        }
+#endif
+#if defined(HPV_ARCH_NEON)
+        if (hpv_simd_supported(HPV_SIMD_NEON))
+        {
+            HPVYCoCgKernels neon = { HPV_SIMD_NEON, rgb_to_cocg_y_neon, cocg_y_to_rgb_neon };
+            kernels.push_back(neon);
+        }
+#endif
+
+        return kernels;
+    }
+
+    static const HPVYCoCgKernels& best_ycocg_kernels()
+    {
+        static const HPVYCoCgKernels best = hpv_ycocg_kernels().back();
+        return best;
+    }
+
+} /* namespace HPV */
+
+void ConvertRGBToCoCg_Y(byte *image, int width, int height)
+{
+    HPV::best_ycocg_kernels().to_cocg_y(image, width, height);
+}
+
+void ConvertCoCg_YToRGB(byte *image, int width, int height)
+{
+    HPV::best_ycocg_kernels().to_rgb(image, width, height);
+}
@@ -0,0 +1,38 @@
+/**********************************************************
+* Holo_ToolSet
+* http://github.com/HasseltVR/Holo_ToolSet
+* http://www.uhasselt.be/edm
+*
+* Distributed under LGPL v2.1 Licence
+* http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+**********************************************************/
+#ifndef YCoCg_SIMD_h
+#define YCoCg_SIMD_h
+
+#include <vector>
+
+#include "YCoCg.h"
+#include "HPVSimd.hpp"
+
+namespace HPV {
+
+    typedef void (*HPVYCoCgFunc)(byte * image, int width, int height);
+
+    /*
+     *  RGB <-> CoCg_Y conversion for one instruction set. The SIMD versions work on 4 (SSE2),
+     *  8 (AVX2, NEON) pixels at a time and leave the rest to the scalar loop. They give the same
+     *  bytes as the scalar version, for any input.
+     */
+    struct HPVYCoCgKernels
+    {
+        HPVSimdLevel level;
+        HPVYCoCgFunc to_cocg_y;
+        HPVYCoCgFunc to_rgb;
+    };
+
+    /* Every version in this build the CPU runs, scalar first. ConvertRGBToCoCg_Y() uses the last. */
+    std::vector<HPVYCoCgKernels> hpv_ycocg_kernels();
+
+} /* namespace HPV */
+
+#endif
@@ -64,12 +64,6 @@ MainWindow::MainWindow(QWidget *parent): QMainWindow(parent), stopped(true)
     setAcceptDrops(true);
 
     hpv_params.fps = 25;
-    hpv_params.in_frame = 0;
-    hpv_params.out_frame = 0;
-    hpv_params.in_path = "";
-    hpv_params.out_path = "";
-    hpv_params.file_names = nullptr;
-    hpv_params.type = HPV::HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA;
 
     stopped = true;
 }
@@ -319,7 +313,7 @@ void MainWindow::convertOrCancel()
         convertOrCancelButton->setText(tr("&Cancel"));
         convertOrCancelButton->setEnabled(true);
         hpv_creator.init(hpv_params, &progress_sink);
-        hpv_creator.process_sequence(8);
+        hpv_creator.process_sequence(HPV_CONCURRENCY_AUTO);
         QTimer::singleShot(PollTimeout, this, SLOT(checkProgress()));
     }
     else
@@ -366,8 +360,28 @@ void MainWindow::checkProgress()
             {
                 uint8_t percent = static_cast<uint8_t>( (progress.done_items/(float)progress.total_items) *100);
 
-                QString str = "Done: " + QString::fromStdString(progress.done_item_name) + " [deflated to: " + QString::number(progress.compression_ratio, 'f', 2) + "%]";
+                QString str = "Done: " + QString::fromStdString(progress.done_item_name) + " [deflated to: " + QString::number(progress.compression_ratio, 'f', 2) + "%]"
+                        + " [frame buffer allocations: " + QString::number(progress.frame_buffer_allocations) + "]";
                 logEdit->appendPlainText(str);
+
+                // where the time goes, to tune the thread counts
+                QString stages = "    frame ms load/convert/dxt/lz4: "
+                        + QString::number(progress.frame_ns[HPV_STAGE_LOAD] / 1e6, 'f', 1) + "/"
+                        + QString::number(progress.frame_ns[HPV_STAGE_CONVERT] / 1e6, 'f', 1) + "/"
+                        + QString::number(progress.frame_ns[HPV_STAGE_DXT] / 1e6, 'f', 1) + "/"
+                        + QString::number(progress.frame_ns[HPV_STAGE_LZ4] / 1e6, 'f', 1)
+                        + " | total s load/convert/dxt/lz4/write/idle: "
+                        + QString::number(progress.times.busy_ns[HPV_STAGE_LOAD] / 1e9, 'f', 2) + "/"
+                        + QString::number(progress.times.busy_ns[HPV_STAGE_CONVERT] / 1e9, 'f', 2) + "/"
+                        + QString::number(progress.times.busy_ns[HPV_STAGE_DXT] / 1e9, 'f', 2) + "/"
+                        + QString::number(progress.times.busy_ns[HPV_STAGE_LZ4] / 1e9, 'f', 2) + "/"
+                        + QString::number(progress.times.write_ns / 1e9, 'f', 2) + "/"
+                        + QString::number(progress.times.idle_ns / 1e9, 'f', 2)
+                        + " | queued for workers/writer: " + QString::number(progress.compression_queue_depth)
+                        + "/" + QString::number(progress.filestream_queue_depth)
+                        + " | workers: " + QString::number(progress.active_workers)
+                        + " | written: " + QString::number(progress.bytes_per_second / (1024 * 1024), 'f', 1) + " MB/s";
+                logEdit->appendPlainText(stages);
                 progressBar->setValue(percent);
             }
         }
@@ -0,0 +1,740 @@
+ /**********************************************************
+ * Holo_ToolSet
+ * HPV Creator encoder benchmark
+ *
+ * http://github.com/HasseltVR/Holo_ToolSet
+ * http://www.uhasselt.be/edm
+ *
+ * Distributed under LGPL v2.1 Licence
+ * http ://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ **********************************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <memory>
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "cmdline.h"
+#include "HPVCreator.hpp"
+#include "HPVFrameSource.hpp"
+#include "YCoCgSIMD.h"
+#include "DXTSIMD.h"
+#include "Timer.h"
+
+using namespace HPV;
+
+/******************************************************************************
+ * Private state.
+ ******************************************************************************/
+
+struct BenchResolution
+{
+    int width;
+    int height;
+};
+
+static const std::vector<std::string> content_names =
+{ "gradient", "noise", "natural", "static" };
+
+/* A DXT kernel fails --kernels when its PSNR is this much below the stb one */
+#define DXT_PSNR_TOLERANCE_DB 0.05
+
+static HPVMemoryFrameSource frame_source;
+static HPVCreator creator;              /* re-used, like the GUI does, so its workers are too */
+static bool first_result = true;
+
+
+/******************************************************************************
+ * Private methods.
+ ******************************************************************************/
+
+static void setup_parser(cmdline::parser& p)
+{
+    p.add<std::string>("resolutions", 'r', "comma separated WxH list", false, "1280x720");
+    p.add<int>("frames", 'f', "frames per run", false, 30);
+    p.add<std::string>("threads", 'n', "comma separated thread counts, 0 = auto (default 1 and all cores)", false, "");
+    p.add<std::string>("types", 't', "comma separated compression types", false, "0,1,2");
+    p.add<std::string>("content", 'c', "comma separated content kinds: gradient,noise,natural,static", false, "gradient,noise,natural,static");
+    p.add<std::string>("out", 'o', "scratch output file, removed after every run", false, "hpv_bench.hpv");
+    p.add<int>("bands", 'b', "block-row bands per frame compressed in parallel (0 = off)", false, 0);
+    p.add<std::string>("writer", 'w', "output writer", false, "pwrite", cmdline::oneof<std::string>("pwrite", "stream"));
+    p.add<std::string>("stages", 'S', "staged pipeline with load,convert,dxt,lz4 worker counts (empty = off)", false, "");
+    p.add("numa", 'N', "pin the workers per NUMA node");
+    p.add<std::string>("dxt", 'X', "DXT1/DXT5 compressor of the encode runs, auto picks the fastest this CPU runs", false, "auto", cmdline::oneof<std::string>("auto", "stb", "sse4.1", "avx2", "avx512"));
+    p.add("kernels", 'K', "check the SIMD pixel kernels against the scalar ones and time them per resolution, instead of encoding");
+}
+
+static std::vector<std::string> split(const std::string& list, char sep)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(list);
+    std::string part;
+
+    while (std::getline(ss, part, sep))
+    {
+        if (!part.empty())
+            parts.push_back(part);
+    }
+
+    return parts;
+}
+
+static bool parse_int_list(const std::string& list, std::vector<int>& values)
+{
+    std::vector<std::string> parts = split(list, ',');
+
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+        char * end = nullptr;
+        long value = strtol(parts[i].c_str(), &end, 10);
+        if (*end != '\0' || value < 0)
+            return false;
+
+        values.push_back(static_cast<int>(value));
+    }
+
+    return !values.empty();
+}
+
+static bool parse_resolutions(const std::string& list, std::vector<BenchResolution>& resolutions)
+{
+    std::vector<std::string> parts = split(list, ',');
+
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+        BenchResolution res;
+        if (sscanf(parts[i].c_str(), "%dx%d", &res.width, &res.height) != 2 ||
+            res.width <= 0 || res.height <= 0 ||
+            (res.width % 4) != 0 || (res.height % 4) != 0)
+        {
+            return false;
+        }
+
+        resolutions.push_back(res);
+    }
+
+    return !resolutions.empty();
+}
+
+/*
+ * Deterministic pixel generators, frame f of every kind differs from frame f-1 (except static)
+ * so the encoder can't take shortcuts the real content wouldn't allow.
+ */
+static uint32_t lcg(uint32_t& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+static void generate_frame(const std::string& content, int frame, int w, int h, std::vector<unsigned char>& rgba)
+{
+    rgba.resize(static_cast<std::size_t>(w) * h * 4);
+    uint32_t rng = 0x9e3779b9u ^ static_cast<uint32_t>(frame * 7919);
+
+    for (int y = 0; y < h; ++y)
+    {
+        unsigned char * row = &rgba[static_cast<std::size_t>(y) * w * 4];
+
+        for (int x = 0; x < w; ++x)
+        {
+            unsigned char * px = row + x * 4;
+
+            if (content == "gradient")
+            {
+                px[0] = static_cast<unsigned char>((x * 255 / w + frame * 3) & 0xff);
+                px[1] = static_cast<unsigned char>((y * 255 / h + frame * 5) & 0xff);
+                px[2] = static_cast<unsigned char>(((x + y) * 255 / (w + h)) & 0xff);
+                px[3] = static_cast<unsigned char>(y * 255 / h);
+            }
+            else if (content == "noise")
+            {
+                uint32_t r = lcg(rng);
+                px[0] = static_cast<unsigned char>(r);
+                px[1] = static_cast<unsigned char>(r >> 8);
+                px[2] = static_cast<unsigned char>(r >> 16);
+                px[3] = static_cast<unsigned char>(lcg(rng));
+            }
+            else if (content == "natural")
+            {
+                // a few drifting low-frequency waves with a little grain on top
+                float fx = x / static_cast<float>(w);
+                float fy = y / static_cast<float>(h);
+                float t = frame * 0.05f;
+                float a = sinf(fx * 6.0f + t) * cosf(fy * 4.0f - t * 0.7f);
+                float b = sinf((fx + fy) * 9.0f - t * 1.3f);
+                int grain = static_cast<int>(lcg(rng) & 0x0f) - 8;
+
+                px[0] = static_cast<unsigned char>(std::min(255, std::max(0, static_cast<int>(128 + 90 * a) + grain)));
+                px[1] = static_cast<unsigned char>(std::min(255, std::max(0, static_cast<int>(110 + 60 * a + 40 * b) + grain)));
+                px[2] = static_cast<unsigned char>(std::min(255, std::max(0, static_cast<int>(100 + 80 * b) + grain)));
+                px[3] = static_cast<unsigned char>(std::min(255, std::max(0, static_cast<int>(200 + 55 * a))));
+            }
+            else /* static */
+            {
+                px[0] = static_cast<unsigned char>(x * 255 / w);
+                px[1] = static_cast<unsigned char>(y * 255 / h);
+                px[2] = static_cast<unsigned char>(((x / 16) ^ (y / 16)) & 1 ? 200 : 40);
+                px[3] = 255;
+            }
+        }
+    }
+}
+
+/* Wrap RGBA pixels in an uncompressed, top-left origin 32bpp TGA so stb_image can decode it */
+static void encode_tga(const std::vector<unsigned char>& rgba, int w, int h, std::vector<unsigned char>& tga)
+{
+    tga.assign(18, 0);
+    tga[2] = 2;                                 // uncompressed true-color
+    tga[12] = static_cast<unsigned char>(w & 0xff);
+    tga[13] = static_cast<unsigned char>(w >> 8);
+    tga[14] = static_cast<unsigned char>(h & 0xff);
+    tga[15] = static_cast<unsigned char>(h >> 8);
+    tga[16] = 32;                               // bits per pixel
+    tga[17] = 0x28;                             // 8 alpha bits, top-left origin
+
+    tga.reserve(18 + rgba.size());
+    for (std::size_t i = 0; i < rgba.size(); i += 4)
+    {
+        // TGA stores BGRA
+        tga.push_back(rgba[i + 2]);
+        tga.push_back(rgba[i + 1]);
+        tga.push_back(rgba[i + 0]);
+        tga.push_back(rgba[i + 3]);
+    }
+}
+
+static void build_corpus(const std::string& content, const BenchResolution& res, int frames, std::vector<std::string>& names)
+{
+    std::vector<unsigned char> rgba;
+    std::vector<unsigned char> tga;
+
+    frame_source.clear();
+    names.clear();
+
+    for (int f = 0; f < frames; ++f)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "mem://%s/%05d.tga", content.c_str(), f);
+
+        if (f == 0 || content != "static")
+        {
+            generate_frame(content, f, res.width, res.height, rgba);
+            encode_tga(rgba, res.width, res.height, tga);
+        }
+
+        frame_source.add(name, tga);
+        names.push_back(name);
+    }
+}
+
+static uint64_t file_size(const std::string& path)
+{
+    FILE * fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return 0;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+
+    return size > 0 ? static_cast<uint64_t>(size) : 0;
+}
+
+/*
+ * One full encode of the corpus currently in frame_source. Returns false when the creator
+ * reported an error.
+ */
+static bool run_encode(HPVCreatorParams params, uint32_t num_threads, double& seconds, HPVStageTimes& times)
+{
+    ThreadSafe_Queue<HPVCompressionProgress> progress_sink;
+    HPVCompressionProgress progress;
+
+    params.num_threads = static_cast<uint8_t>(num_threads);
+
+    uint64_t start = ns();
+
+    if (creator.init(params, &progress_sink) == HPV_RET_ERROR)
+    {
+        if (progress_sink.try_pop(progress))
+            fprintf(stderr, "init failed: %s\n", progress.done_item_name.c_str());
+        return false;
+    }
+
+    creator.process_sequence(num_threads);
+
+    bool ok = true;
+    for (;;)
+    {
+        progress_sink.wait_and_pop(progress);
+
+        if (progress.state == HPV_CREATOR_STATE_ERROR)
+        {
+            fprintf(stderr, "encode failed: %s\n", progress.done_item_name.c_str());
+            ok = false;
+            break;
+        }
+
+        if (progress.state == HPV_CREATOR_STATE_DONE)
+            break;
+    }
+
+    creator.stop();
+
+    seconds = (ns() - start) / 1.0e9;
+    times = creator.get_stage_times();
+
+    return ok;
+}
+
+static void print_result(const BenchResolution& res, const std::string& content, int type, uint32_t threads,
+                         int frames, double seconds, uint64_t out_bytes, const HPVStageTimes& times)
+{
+    double in_bytes = static_cast<double>(res.width) * res.height * 4 * frames;
+
+    printf("%s\n  {\"resolution\": \"%dx%d\", \"content\": \"%s\", \"type\": %d, \"threads\": %u, \"frames\": %d, "
+           "\"seconds\": %.4f, \"fps\": %.2f, \"in_mb_per_s\": %.2f, \"out_bytes\": %llu, \"ratio\": %.4f, "
+           "\"stage_ns\": {\"load\": %llu, \"convert\": %llu, \"dxt\": %llu, \"lz4\": %llu, \"write\": %llu, \"idle\": %llu}}",
+           first_result ? "" : ",",
+           res.width, res.height, content.c_str(), type, threads, frames,
+           seconds, frames / seconds, in_bytes / (1024.0 * 1024.0) / seconds,
+           static_cast<unsigned long long>(out_bytes), out_bytes / in_bytes,
+           static_cast<unsigned long long>(times.busy_ns[HPV_STAGE_LOAD]),
+           static_cast<unsigned long long>(times.busy_ns[HPV_STAGE_CONVERT]),
+           static_cast<unsigned long long>(times.busy_ns[HPV_STAGE_DXT]),
+           static_cast<unsigned long long>(times.busy_ns[HPV_STAGE_LZ4]),
+           static_cast<unsigned long long>(times.write_ns),
+           static_cast<unsigned long long>(times.idle_ns));
+    fflush(stdout);
+
+    first_result = false;
+}
+
+/*
+ * Every SIMD version of a conversion must give the scalar bytes. Checked for all 2^24 colours
+ * (alpha varies along), and for short runs at odd offsets that end in the scalar tail and must
+ * not touch the bytes around them.
+ */
+static bool check_ycocg_kernels(const HPVYCoCgKernels& kernels, const HPVYCoCgKernels& scalar)
+{
+    const std::size_t count = std::size_t(1) << 24;
+    std::vector<unsigned char> input(count * 4);
+    std::vector<unsigned char> expected;
+    std::vector<unsigned char> actual;
+
+    for (int direction = 0; direction < 2; ++direction)
+    {
+        // RGBA in for the forward conversion, Co Cg A Y for the way back: the three colour
+        // channels take every combination
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            unsigned char * px = &input[i * 4];
+            px[0] = static_cast<unsigned char>(i);
+            px[1] = static_cast<unsigned char>(i >> 8);
+            px[direction == 0 ? 2 : 3] = static_cast<unsigned char>(i >> 16);
+            px[direction == 0 ? 3 : 2] = static_cast<unsigned char>(i * 7);
+        }
+
+        HPVYCoCgFunc reference = direction == 0 ? scalar.to_cocg_y : scalar.to_rgb;
+        HPVYCoCgFunc kernel = direction == 0 ? kernels.to_cocg_y : kernels.to_rgb;
+
+        expected = input;
+        actual = input;
+        reference(expected.data(), static_cast<int>(count), 1);
+        kernel(actual.data(), static_cast<int>(count), 1);
+        if (expected != actual)
+            return false;
+
+        uint32_t state = 12345;
+        for (int run = 0; run < 1000; ++run)
+        {
+            std::size_t offset = lcg(state) % 4;
+            int pixels = 1 + static_cast<int>(lcg(state) % 67);
+            std::size_t bytes = offset + pixels * 4 + 4;
+
+            expected.resize(bytes);
+            for (std::size_t b = 0; b < bytes; ++b)
+            {
+                expected[b] = static_cast<unsigned char>(lcg(state));
+            }
+            actual = expected;
+
+            reference(expected.data() + offset, pixels, 1);
+            kernel(actual.data() + offset, pixels, 1);
+            if (expected != actual)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* Runs func on the frame the given amount of times, returns megapixels per second */
+static double time_kernel(HPVYCoCgFunc func, std::vector<unsigned char>& rgba, const BenchResolution& res, int frames)
+{
+    uint64_t start = ns();
+    for (int f = 0; f < frames; ++f)
+    {
+        func(rgba.data(), res.width, res.height);
+    }
+    double seconds = (ns() - start) / 1.0e9;
+
+    return (static_cast<double>(res.width) * res.height * frames) / 1.0e6 / seconds;
+}
+
+static bool run_kernel_checks(const std::vector<BenchResolution>& resolutions, int frames)
+{
+    std::vector<HPVYCoCgKernels> kernels = hpv_ycocg_kernels();
+    bool ok = true;
+
+    for (std::size_t k = 0; k < kernels.size(); ++k)
+    {
+        bool exact = k == 0 || check_ycocg_kernels(kernels[k], kernels[0]);
+        if (!exact)
+        {
+            fprintf(stderr, "%s CoCg_Y conversion differs from the scalar one\n", hpv_simd_name(kernels[k].level));
+            ok = false;
+        }
+
+        for (std::size_t r = 0; r < resolutions.size(); ++r)
+        {
+            std::vector<unsigned char> rgba;
+            generate_frame("natural", 0, resolutions[r].width, resolutions[r].height, rgba);
+
+            // the frame goes back and forth, both directions keep working on real values
+            double to_cocg_y = time_kernel(kernels[k].to_cocg_y, rgba, resolutions[r], frames);
+            double to_rgb = time_kernel(kernels[k].to_rgb, rgba, resolutions[r], frames);
+
+            printf("%s\n  {\"kernel\": \"ycocg\", \"isa\": \"%s\", \"resolution\": \"%dx%d\", \"bit_exact\": %s, "
+                   "\"to_cocg_y_mpix_per_s\": %.1f, \"to_rgb_mpix_per_s\": %.1f}",
+                   first_result ? "" : ",", hpv_simd_name(kernels[k].level), resolutions[r].width, resolutions[r].height,
+                   exact ? "true" : "false", to_cocg_y, to_rgb);
+            fflush(stdout);
+            first_result = false;
+        }
+    }
+
+    return ok;
+}
+
+/* Back to RGBA the way the GPU does it, for the PSNR of the DXT kernels */
+static void decode_dxt(const unsigned char * dxt, int width, int height, bool dxt5, std::vector<unsigned char>& rgba)
+{
+    rgba.assign(static_cast<std::size_t>(width) * height * 4, 255);
+
+    for (int by = 0; by < height; by += 4)
+    {
+        for (int bx = 0; bx < width; bx += 4)
+        {
+            int alpha[8] = { 255, 255, 255, 255, 255, 255, 255, 255 };
+            uint64_t alpha_bits = 0;
+
+            if (dxt5)
+            {
+                alpha[0] = dxt[0];
+                alpha[1] = dxt[1];
+                for (int i = 2; i < 8; ++i)
+                {
+                    if (alpha[0] > alpha[1])
+                        alpha[i] = ((8 - i) * alpha[0] + (i - 1) * alpha[1]) / 7;
+                    else
+                        alpha[i] = i < 6 ? ((6 - i) * alpha[0] + (i - 1) * alpha[1]) / 5 : (i == 6 ? 0 : 255);
+                }
+                for (int i = 0; i < 6; ++i)
+                    alpha_bits |= static_cast<uint64_t>(dxt[2 + i]) << (8 * i);
+                dxt += 8;
+            }
+
+            int c[2] = { dxt[0] | (dxt[1] << 8), dxt[2] | (dxt[3] << 8) };
+            int color[4][3];
+            for (int i = 0; i < 2; ++i)
+            {
+                int r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+                color[i][0] = (r << 3) | (r >> 2);
+                color[i][1] = (g << 2) | (g >> 4);
+                color[i][2] = (b << 3) | (b >> 2);
+            }
+            for (int ch = 0; ch < 3; ++ch)
+            {
+                if (dxt5 || c[0] > c[1])
+                {
+                    color[2][ch] = (2 * color[0][ch] + color[1][ch]) / 3;
+                    color[3][ch] = (color[0][ch] + 2 * color[1][ch]) / 3;
+                }
+                else
+                {
+                    color[2][ch] = (color[0][ch] + color[1][ch]) / 2;
+                    color[3][ch] = 0;
+                }
+            }
+            uint32_t indices = dxt[4] | (dxt[5] << 8) | (dxt[6] << 16) | (static_cast<uint32_t>(dxt[7]) << 24);
+            dxt += 8;
+
+            for (int i = 0; i < 16; ++i)
+            {
+                unsigned char * px = &rgba[(static_cast<std::size_t>(by + i / 4) * width + bx + i % 4) * 4];
+                const int * rgb = color[(indices >> (2 * i)) & 3];
+                px[0] = static_cast<unsigned char>(rgb[0]);
+                px[1] = static_cast<unsigned char>(rgb[1]);
+                px[2] = static_cast<unsigned char>(rgb[2]);
+                px[3] = static_cast<unsigned char>(alpha[(alpha_bits >> (3 * i)) & 7]);
+            }
+        }
+    }
+}
+
+/* PSNR of the decoded blocks against the source, over RGB for DXT1 and RGBA for DXT5, capped at 100 dB */
+static double dxt_psnr(const std::vector<unsigned char>& source, const std::vector<unsigned char>& dxt, int width, int height, bool dxt5)
+{
+    std::vector<unsigned char> decoded;
+    decode_dxt(dxt.data(), width, height, dxt5, decoded);
+
+    const int channels = dxt5 ? 4 : 3;
+    double sum = 0.0;
+    for (std::size_t i = 0; i < source.size(); i += 4)
+    {
+        for (int ch = 0; ch < channels; ++ch)
+        {
+            double d = static_cast<double>(source[i + ch]) - decoded[i + ch];
+            sum += d * d;
+        }
+    }
+
+    double mse = sum / (static_cast<double>(width) * height * channels);
+    return mse > 0.0 ? std::min(100.0, 10.0 * log10(255.0 * 255.0 / mse)) : 100.0;
+}
+
+/*
+ * Every DXT compressor on every content kind: quality against the source next to the stb
+ * reference, the share of blocks identical to stb's, and its speed. Fails when a kernel's
+ * PSNR is more than DXT_PSNR_TOLERANCE_DB below the stb one.
+ */
+static bool run_dxt_checks(const std::vector<BenchResolution>& resolutions, const std::vector<std::string>& contents, int frames)
+{
+    std::vector<HPVDXTKernel> kernels = hpv_dxt_kernels();
+    bool ok = true;
+
+    for (std::size_t r = 0; r < resolutions.size(); ++r)
+    {
+        const int width = resolutions[r].width;
+        const int height = resolutions[r].height;
+        const std::size_t blocks = static_cast<std::size_t>(width / 4) * (height / 4);
+
+        for (std::size_t c = 0; c < contents.size(); ++c)
+        {
+            std::vector<unsigned char> rgba;
+            generate_frame(contents[c], 0, width, height, rgba);
+
+            for (int dxt5 = 0; dxt5 < 2; ++dxt5)
+            {
+                const std::size_t block_bytes = dxt5 ? 16 : 8;
+                std::vector<unsigned char> reference(blocks * block_bytes);
+                std::vector<unsigned char> dxt(blocks * block_bytes);
+                double reference_psnr = 0.0;
+
+                for (std::size_t k = 0; k < kernels.size(); ++k)
+                {
+                    uint64_t start = ns();
+                    for (int f = 0; f < frames; ++f)
+                    {
+                        kernels[k].compress(dxt.data(), rgba.data(), width, height, dxt5);
+                    }
+                    double seconds = (ns() - start) / 1.0e9;
+
+                    double psnr = dxt_psnr(rgba, dxt, width, height, dxt5 != 0);
+                    if (k == 0)
+                    {
+                        reference = dxt;
+                        reference_psnr = psnr;
+                    }
+
+                    std::size_t identical = 0;
+                    for (std::size_t b = 0; b < blocks; ++b)
+                    {
+                        if (memcmp(&dxt[b * block_bytes], &reference[b * block_bytes], block_bytes) == 0)
+                            identical++;
+                    }
+
+                    if (psnr < reference_psnr - DXT_PSNR_TOLERANCE_DB)
+                    {
+                        fprintf(stderr, "%s DXT%d compressor loses %.3f dB against stb on %s %dx%d\n", hpv_simd_name(kernels[k].level),
+                                dxt5 ? 5 : 1, reference_psnr - psnr, contents[c].c_str(), width, height);
+                        ok = false;
+                    }
+
+                    printf("%s\n  {\"kernel\": \"dxt%d\", \"isa\": \"%s\", \"resolution\": \"%dx%d\", \"content\": \"%s\", "
+                           "\"psnr_db\": %.3f, \"psnr_delta_db\": %.3f, \"identical_blocks_percent\": %.2f, \"blocks_per_s\": %.0f}",
+                           first_result ? "" : ",", dxt5 ? 5 : 1, k == 0 ? "stb" : hpv_simd_name(kernels[k].level), width, height,
+                           contents[c].c_str(), psnr, psnr - reference_psnr, 100.0 * identical / blocks,
+                           static_cast<double>(blocks) * frames / seconds);
+                    fflush(stdout);
+                    first_result = false;
+                }
+            }
+        }
+    }
+
+    return ok;
+}
+
+
+/******************************************************************************
+ * Main application.
+ ******************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    // the JSON on stdout is the only output, errors go to stderr
+    HPV::hpv_log_disable_stdout();
+    HPV::hpv_log_disable_log_to_file();
+
+    cmdline::parser p;
+    setup_parser(p);
+    p.parse_check(argc, argv);
+
+    std::vector<BenchResolution> resolutions;
+    if (!parse_resolutions(p.get<std::string>("resolutions"), resolutions))
+    {
+        fprintf(stderr, "Invalid resolutions, expecting e.g. 1280x720,1920x1080 with sides a multiple of 4\n");
+        return 1;
+    }
+
+    int frames = p.get<int>("frames");
+    if (frames <= 0)
+    {
+        fprintf(stderr, "Frame count must be > 0\n");
+        return 1;
+    }
+
+    std::vector<std::string> contents = split(p.get<std::string>("content"), ',');
+    for (std::size_t i = 0; i < contents.size(); ++i)
+    {
+        if (std::find(content_names.begin(), content_names.end(), contents[i]) == content_names.end())
+        {
+            fprintf(stderr, "Unknown content kind %s\n", contents[i].c_str());
+            return 1;
+        }
+    }
+
+    if (p.exist("kernels"))
+    {
+        printf("[");
+        bool ok = run_kernel_checks(resolutions, frames);
+        ok = run_dxt_checks(resolutions, contents, frames) && ok;
+        printf("\n]\n");
+        return ok ? 0 : 1;
+    }
+
+    std::vector<int> threads;
+    std::string thread_list = p.get<std::string>("threads");
+    if (thread_list.empty())
+    {
+        threads.push_back(1);
+        int cores = static_cast<int>(hpv_available_cpus());
+        if (cores > 1)
+            threads.push_back(std::min(cores, 255));
+    }
+    else if (!parse_int_list(thread_list, threads))
+    {
+        fprintf(stderr, "Invalid thread counts\n");
+        return 1;
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i)
+    {
+        if (threads[i] > 255)
+        {
+            fprintf(stderr, "Thread count %d out of range (0-255)\n", threads[i]);
+            return 1;
+        }
+    }
+
+    std::vector<int> types;
+    if (!parse_int_list(p.get<std::string>("types"), types))
+    {
+        fprintf(stderr, "Invalid compression types\n");
+        return 1;
+    }
+    for (std::size_t i = 0; i < types.size(); ++i)
+    {
+        if (types[i] >= static_cast<int>(HPVCompressionType::HPV_NUM_TYPES))
+        {
+            fprintf(stderr, "Unrecognised compression type %d\n", types[i]);
+            return 1;
+        }
+    }
+
+    std::vector<std::string> names;
+
+    HPVCreatorParams params;
+    params.in_path = "mem://";
+    params.out_path = p.get<std::string>("out");
+    params.file_names = &names;
+    params.frame_source = &frame_source;
+    params.out_frame = static_cast<uint32_t>(frames - 1);
+    params.fps = 30;
+    params.bands_per_frame = static_cast<uint16_t>(std::max(0, p.get<int>("bands")));
+    params.writer_type = p.get<std::string>("writer") == "stream" ? HPVWriterType::HPV_WRITER_STREAM : HPVWriterType::HPV_WRITER_POSITIONAL;
+    params.numa_affinity = p.exist("numa");
+
+    HPVSimdLevel dxt_level = HPV_SIMD_SCALAR;
+    std::string dxt = p.get<std::string>("dxt");
+    params.dxt_level = (dxt == "stb" || hpv_simd_from_name(dxt.c_str(), dxt_level)) ? static_cast<int8_t>(dxt_level) : -1;
+
+    std::string stages = p.get<std::string>("stages");
+    if (!stages.empty())
+    {
+        std::vector<int> counts;
+        if (!parse_int_list(stages, counts) || counts.size() != HPV_NUM_STAGES ||
+            std::find(counts.begin(), counts.end(), 0) != counts.end())
+        {
+            fprintf(stderr, "--stages needs %d worker counts > 0\n", HPV_NUM_STAGES);
+            return 1;
+        }
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            params.stage_threads[stage] = static_cast<uint8_t>(std::min(counts[stage], 255));
+        }
+    }
+
+    bool ok = true;
+    printf("[");
+
+    for (std::size_t r = 0; r < resolutions.size() && ok; ++r)
+    {
+        for (std::size_t c = 0; c < contents.size() && ok; ++c)
+        {
+            build_corpus(contents[c], resolutions[r], frames, names);
+
+            for (std::size_t t = 0; t < types.size() && ok; ++t)
+            {
+                params.type = static_cast<HPVCompressionType>(types[t]);
+
+                for (std::size_t n = 0; n < threads.size() && ok; ++n)
+                {
+                    double seconds = 0;
+                    HPVStageTimes times;
+
+                    ok = run_encode(params, static_cast<uint32_t>(threads[n]), seconds, times);
+                    if (ok)
+                    {
+                        print_result(resolutions[r], contents[c], types[t], static_cast<uint32_t>(threads[n]),
+                                     frames, seconds, file_size(params.out_path), times);
+                    }
+
+                    remove(params.out_path.c_str());
+                }
+            }
+        }
+    }
+
+    printf("\n]\n");
+    frame_source.clear();
+
+    return ok ? 0 : 1;
+}
@@ -13,12 +13,27 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <fstream>
+#include <memory>
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #include <dirent.h>
+#include <sys/stat.h>
 
 #include "cmdline.h"
 #include "HPVCreator.hpp"
+#include "HPVMerge.hpp"
 
 using namespace HPV;
 
@@ -31,8 +46,24 @@ static HPVCreator hpv_creator;
 static std::vector<std::string> file_names;
 static std::string m_cur_filename;
 static uint32_t planned_total;
-static ThreadSafe_Queue<HPVCompressionProgress> progress_sink;
-static HPVCompressionProgress progress;
+static bool json_progress = false;
+static std::atomic<bool> watching(false);
+static int raw_fd = -1;
+static std::atomic<bool> raw_stop(false);
+static std::unique_ptr<HPVRawFrameSource> raw_source;
+static bool raw_y4m = false;
+
+/* Interval at which --watch looks for new frames */
+#define WATCH_POLL_INTERVAL_MS 500
+
+/* Raw frames that may wait for a worker before --raw stops reading the input */
+#define RAW_PENDING_FRAMES 8
+
+/* How often a reader waiting for --raw input checks whether it should stop */
+#define RAW_POLL_INTERVAL_MS 100
+
+/* Longest Y4M stream header or FRAME line we accept */
+#define Y4M_MAX_LINE 1024
 
 
 /******************************************************************************
@@ -41,22 +72,107 @@ static HPVCompressionProgress progress;
 
 static void setup_parser(cmdline::parser& p)
 {
-    p.add<std::string>("in", 'i', "in path", true);
-    p.add<int>("fps", 'f', "framerate", true);
-    p.add<int>("type", 't', "type", true);
+    p.add<std::string>("in", 'i', "in path (required without --batch)", false, "");
+    p.add<int>("fps", 'f', "framerate (required without --batch)", false, 0);
+    p.add<int>("type", 't', "type (required without --batch)", false, 0);
     
     p.add<int>("start", 's', "start frame", false, 0);
     p.add<int>("end", 'e', "end frame", false, 100);
     p.add<std::string>("out", 'o', "out path", false, "");
-    p.add<int>("threads", 'n', "num threads", false, 8);
+    p.add<int>("threads", 'n', "num threads (0 = auto)", false, 8, cmdline::range(0, 255));
+    p.add<int>("bands", 'b', "block-row bands per frame compressed in parallel (0 = off)", false, 0);
+    p.add<std::string>("writer", 'w', "output writer", false, "pwrite", cmdline::oneof<std::string>("pwrite", "stream"));
+    p.add("resume", 'r', "keep a checkpoint next to the output and re-use unchanged frames of the previous encode");
+    p.add<std::string>("stages", 'S', "staged pipeline with load,convert,dxt,lz4 worker counts, e.g. 4,4,16,8 (empty = off)", false, "");
+    p.add<int>("watch", 'W', "keep appending new frames from the in path until none arrived for this many seconds (0 = off)", false, 0);
+    p.add<std::string>("max-mem", 'M', "memory budget for the frames in flight, e.g. 16G or 512M (empty = no limit)", false, "");
+    p.add("numa", 'N', "pin the workers per NUMA node and keep every frame's memory on its node");
+    p.add("early-start", 'E', "start encoding while the input is still scanned, the frame index is written after the last frame");
+    p.add<std::string>("batch", 'B', "encode every job of this manifest on one shared worker pool (empty = off)", false, "");
+    p.add<int>("jobs", 'J', "jobs of the batch that may run at the same time (0 = as many as there are workers)", false, 0);
+    p.add("segment", 'g', "mark the output as a segment of a longer encode, to be merged with --merge");
+    p.add<std::string>("merge", 'm', "merge the HPV files given after the options into this file, without recompressing (empty = off)", false, "");
+    p.add("allow-gaps", 'G', "let --merge join segments with frames missing between them");
+    p.add<std::string>("raw", 'R', "read uncompressed rgba, rgb or y4m frames from the in path, - for stdin (empty = off)", false, "");
+    p.add<std::string>("size", 'z', "WxH of the --raw rgba and rgb frames", false, "");
+    p.add("share-held", 'D', "store identical frames once, later copies reference the first one (needs a player that knows HPV_FLAG_SHARED_FRAMES)");
+    p.add<int>("store-raw", 'k', "store frames raw when LZ4 makes them less than this percentage smaller (0 = always LZ4, needs a player that knows HPV_FLAG_RAW_FRAMES)", false, 0);
+    p.add<std::string>("dxt", 'X', "DXT1/DXT5 compressor, auto picks the fastest this CPU runs, HPVCreatorBench -K checks each against stb", false, "auto", cmdline::oneof<std::string>("auto", "stb", "sse4.1", "avx2", "avx512"));
+    p.add<std::string>("progress", 'P', "progress output, json prints one JSON object per line and keeps the log out of stdout", false, "text", cmdline::oneof<std::string>("text", "json"));
+    p.add<std::string>("outputs", 'O', "more outputs from the same decoded frames, path:type[:downscale] separated by commas (empty = off)", false, "");
 }
 
-static uint32_t parse_in_path(HPVCreatorParams& params)
+/*
+ * --outputs: "path:type[:downscale],...", downscale 1, 2 or 4. The fields are split off from the
+ * right, so a path may contain colons itself (C:\videos\half.hpv:0:2).
+ */
+static bool parse_outputs(const std::string& list, std::vector<HPVOutputParams>& outputs)
+{
+    std::stringstream ss(list);
+    std::string entry;
+
+    while (std::getline(ss, entry, ','))
+    {
+        std::vector<int> fields;
+        std::size_t colon;
+
+        // type and the optional downscale are numbers, the rest is the path
+        while (fields.size() < 2 && (colon = entry.find_last_of(':')) != std::string::npos)
+        {
+            std::string field = entry.substr(colon + 1);
+            if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos)
+                break;
+
+            fields.insert(fields.begin(), atoi(field.c_str()));
+            entry.erase(colon);
+        }
+
+        if (entry.empty() || fields.empty())
+        {
+            HPV_ERROR("Invalid --outputs entry, expecting path:type[:downscale]");
+            return false;
+        }
+
+        HPVOutputParams output;
+        output.out_path = entry;
+        output.type = static_cast<HPVCompressionType>(fields[0]);
+        output.downscale = static_cast<uint8_t>(fields.size() > 1 ? fields[1] : 1);
+        outputs.push_back(output);
+    }
+
+    return true;
+}
+
+/* "16G", "512M", "2048K" or plain bytes, 0 on a malformed size */
+static uint64_t parse_size(const std::string& size)
+{
+    char * end = nullptr;
+    double value = strtod(size.c_str(), &end);
+    if (end == size.c_str() || value <= 0)
+        return 0;
+
+    std::string unit(end);
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+
+    if (unit == "K" || unit == "KB")
+        value *= 1024.0;
+    else if (unit == "M" || unit == "MB")
+        value *= 1024.0 * 1024.0;
+    else if (unit == "G" || unit == "GB")
+        value *= 1024.0 * 1024.0 * 1024.0;
+    else if (unit == "T" || unit == "TB")
+        value *= 1024.0 * 1024.0 * 1024.0 * 1024.0;
+    else if (!unit.empty() && unit != "B")
+        return 0;
+
+    return static_cast<uint64_t>(value);
+}
+
+static uint32_t list_in_path(const std::string& path, std::vector<std::string>& names)
 {
     uint32_t count = 0;
     struct dirent *de;
     std::string filename;
-    const std::string& path = params.in_path;
     
     DIR *dir = opendir(path.c_str());
     if(!dir)
@@ -71,26 +187,419 @@ static uint32_t parse_in_path(HPVCreatorParams& params)
         {
             count++;
             
-            filename.append(hpv_params.in_path);
+            filename.append(path);
             filename.append("/");
             filename.append(de->d_name);
-            file_names.push_back(filename);
+            names.push_back(filename);
             filename.clear();
         }
     }
 
     // sort vector because linux implementation of readdir() implementation
     // is not guaranteed to be incremental
-    std::sort(file_names.begin(), file_names.end());
-    params.file_names = &file_names;
+    std::sort(names.begin(), names.end());
     
     closedir(dir);
     
     return count;
 }
 
+static uint32_t parse_in_path(HPVCreatorParams& params)
+{
+    params.file_names = &file_names;
+    return list_in_path(params.in_path, file_names);
+}
+
+/*
+ * --watch: poll the in path and append every new frame to the running encode. A frame is only
+ * appended once its size stopped changing between two polls (the renderer is done writing it),
+ * and frames are appended in name order. The input is finished after idle_seconds without news.
+ */
+static void watch_in_path(int idle_seconds)
+{
+    std::set<std::string> known(file_names.begin(), file_names.end());
+    std::vector<std::string> candidates;
+    std::map<std::string, off_t> last_sizes;
+    std::map<std::string, off_t> sizes;
+    bool stable = true;
+    std::chrono::steady_clock::time_point last_news = std::chrono::steady_clock::now();
+
+    while (watching.load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_POLL_INTERVAL_MS));
+
+        candidates.clear();
+        sizes.clear();
+        stable = true;
+        list_in_path(hpv_params.in_path, candidates);
+
+        for (std::size_t i = 0; i < candidates.size(); ++i)
+        {
+            const std::string& name = candidates[i];
+            if (known.count(name))
+                continue;
+
+            struct stat st;
+            off_t size = (stat(name.c_str(), &st) == 0) ? st.st_size : 0;
+            sizes[name] = size;
+
+            // frames behind one that is still being written have to wait for it
+            std::map<std::string, off_t>::iterator last = last_sizes.find(name);
+            stable = stable && size > 0 && last != last_sizes.end() && last->second == size;
+            if (!stable)
+            {
+                if (last == last_sizes.end() || last->second != size)
+                    last_news = std::chrono::steady_clock::now();
+                continue;
+            }
+
+            if (hpv_creator.append_frame(name) == HPV_RET_ERROR)
+            {
+                return;
+            }
+
+            known.insert(name);
+            sizes.erase(name);
+            last_news = std::chrono::steady_clock::now();
+        }
+
+        last_sizes.swap(sizes);
+
+        if (std::chrono::steady_clock::now() - last_news >= std::chrono::seconds(idle_seconds))
+        {
+            HPV_VERBOSE("No new frames for %d seconds, finishing the encode", idle_seconds);
+            break;
+        }
+    }
+
+    hpv_creator.finish_input();
+}
+
+/*
+ * --raw: frames come uncompressed from stdin or a pipe. The first frame is read up front so init()
+ * has a reference, the rest is appended to the streaming encode while it runs.
+ */
+static std::string raw_frame_name(uint32_t idx)
+{
+    std::stringstream ss;
+    ss << (hpv_params.in_path == "-" ? std::string("stdin") : hpv_params.in_path) << ":" << idx;
+    return ss.str();
+}
+
+/*
+ * Reads size bytes of the input, fewer at its end or once raw_stop is set. The input is polled
+ * instead of blocking in read(), so the reader thread can always be stopped and joined.
+ */
+static std::size_t read_raw_bytes(void * buf, std::size_t size)
+{
+    std::size_t got = 0;
+    while (got < size && !raw_stop.load(std::memory_order_relaxed))
+    {
+        struct pollfd pfd;
+        pfd.fd = raw_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int ready = poll(&pfd, 1, RAW_POLL_INTERVAL_MS);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (ready <= 0)
+            continue;
+
+        ssize_t n = read(raw_fd, static_cast<char *>(buf) + got, size - got);
+        if (n == 0)
+            break;
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+        got += static_cast<std::size_t>(n);
+    }
+    return got;
+}
+
+/* A line up to and without its '\n', false at the end of the input or when it is too long */
+static bool read_raw_line(std::string& line)
+{
+    line.clear();
+    char c = 0;
+    while (read_raw_bytes(&c, 1) == 1)
+    {
+        if (c == '\n')
+            return true;
+        if (line.size() >= Y4M_MAX_LINE)
+            return false;
+        line.push_back(c);
+    }
+    return false;
+}
+
+/*
+ * "YUV4MPEG2 W1920 H1080 F30000:1001 Ip A1:1 C420jpeg XCOLORRANGE=FULL": dimensions, frame rate,
+ * chroma layout and range. Only 8 bit 4:2:0 and 4:4:4 are supported.
+ */
+static bool parse_y4m_header(int& width, int& height, int& fps, HPVRawFormat& format, bool& full_range)
+{
+    std::string line;
+    if (!read_raw_line(line) || line.compare(0, 9, "YUV4MPEG2") != 0)
+    {
+        HPV_ERROR("%s is not a Y4M stream", hpv_params.in_path.c_str());
+        return false;
+    }
+
+    std::string colorspace = "420";
+    std::stringstream tokens(line.substr(9));
+    std::string token;
+    while (tokens >> token)
+    {
+        switch (token[0])
+        {
+            case 'W':
+                width = atoi(token.c_str() + 1);
+                break;
+            case 'H':
+                height = atoi(token.c_str() + 1);
+                break;
+            case 'F':
+            {
+                int num = 0;
+                int den = 0;
+                if (sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && den > 0)
+                    fps = (num + den / 2) / den;
+                break;
+            }
+            case 'C':
+                colorspace = token.substr(1);
+                break;
+            case 'X':
+                full_range = full_range || token == "XCOLORRANGE=FULL";
+                break;
+        }
+    }
+
+    if (colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2")
+    {
+        format = HPVRawFormat::HPV_RAW_YUV420;
+    }
+    else if (colorspace == "444")
+    {
+        format = HPVRawFormat::HPV_RAW_YUV444;
+    }
+    else
+    {
+        HPV_ERROR("Y4M colorspace C%s isn't supported, use 8 bit 420 or 444", colorspace.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/* The next frame of the input, false at its end. A frame cut short is dropped. */
+static bool read_raw_frame(std::vector<unsigned char>& data)
+{
+    if (raw_y4m)
+    {
+        std::string line;
+        if (!read_raw_line(line))
+            return false;
+
+        if (line.compare(0, 5, "FRAME") != 0)
+        {
+            HPV_ERROR("Expected a Y4M FRAME header in %s", hpv_params.in_path.c_str());
+            return false;
+        }
+    }
+
+    data.resize(raw_source->frame_size());
+    std::size_t got = read_raw_bytes(data.data(), data.size());
+    if (got == data.size())
+        return true;
+
+    if ((got > 0 || raw_y4m) && !raw_stop.load(std::memory_order_relaxed))
+    {
+        HPV_ERROR("Input ended in the middle of a frame, dropped its %zu bytes", got);
+    }
+    return false;
+}
+
+/* The reader thread: feeds every frame after the first to the running encode */
+static void read_raw_input()
+{
+    std::vector<unsigned char> data;
+    uint32_t idx = 1;
+
+    while (read_raw_frame(data))
+    {
+        std::string name = raw_frame_name(idx++);
+        if (!raw_source->add(name, data) || hpv_creator.append_frame(name) == HPV_RET_ERROR)
+            break;
+    }
+
+    hpv_creator.finish_input();
+}
+
+static bool open_raw_input(const cmdline::parser& p)
+{
+    std::string format_name = p.get<std::string>("raw");
+    HPVRawFormat format = HPVRawFormat::HPV_RAW_RGBA;
+    bool full_range = false;
+    int width = 0;
+    int height = 0;
+    int fps = 0;
+
+    raw_y4m = format_name == "y4m";
+    if (!raw_y4m)
+    {
+        if (format_name == "rgba")
+            format = HPVRawFormat::HPV_RAW_RGBA;
+        else if (format_name == "rgb")
+            format = HPVRawFormat::HPV_RAW_RGB;
+        else
+        {
+            HPV_ERROR("Unknown --raw format %s, expecting rgba, rgb or y4m", format_name.c_str());
+            return false;
+        }
+
+        if (sscanf(p.get<std::string>("size").c_str(), "%dx%d", &width, &height) != 2)
+        {
+            HPV_ERROR("--raw=%s needs the frame size, e.g. --size=1920x1080", format_name.c_str());
+            return false;
+        }
+    }
+
+    if (!p.exist("out"))
+    {
+        HPV_ERROR("--raw needs an --out path");
+        return false;
+    }
+
+    raw_fd = (hpv_params.in_path == "-") ? STDIN_FILENO : open(hpv_params.in_path.c_str(), O_RDONLY);
+    if (raw_fd < 0)
+    {
+        HPV_ERROR("Couldn't open %s", hpv_params.in_path.c_str());
+        return false;
+    }
+
+    if (raw_y4m && !parse_y4m_header(width, height, fps, format, full_range))
+        return false;
+
+    // the command line wins over the stream's own frame rate
+    if (p.exist("fps"))
+        fps = p.get<int>("fps");
+    if (fps <= 0 || fps > 255)
+    {
+        HPV_ERROR("Invalid frame rate %d", fps);
+        return false;
+    }
+    hpv_params.fps = static_cast<uint8_t>(fps);
+
+    if (width <= 0 || height <= 0 || width > HPV_MAX_SIDE_SIZE || height > HPV_MAX_SIDE_SIZE)
+    {
+        HPV_ERROR("Invalid frame size %dx%d", width, height);
+        return false;
+    }
+
+    raw_source.reset(new HPVRawFrameSource(format, width, height, full_range, RAW_PENDING_FRAMES));
+
+    std::vector<unsigned char> data;
+    if (!read_raw_frame(data))
+    {
+        HPV_ERROR("No frames in %s", hpv_params.in_path.c_str());
+        return false;
+    }
+
+    file_names.assign(1, raw_frame_name(0));
+    raw_source->add(file_names[0], data);
+
+    hpv_params.file_names = &file_names;
+    hpv_params.frame_source = raw_source.get();
+    hpv_params.in_frame = 0;
+    hpv_params.out_frame = 0;
+    hpv_params.streaming = true;
+
+    HPV_VERBOSE("Reading %dx%d %s frames from %s", width, height, format_name.c_str(), hpv_params.in_path.c_str());
+    return true;
+}
+
 static bool parse_params(const cmdline::parser& p)
 {
+    hpv_params.num_threads = p.get<int>("threads");
+    hpv_params.bands_per_frame = static_cast<uint16_t>(std::max(0, p.get<int>("bands")));
+    hpv_params.writer_type = (p.get<std::string>("writer") == "stream") ? HPVWriterType::HPV_WRITER_STREAM : HPVWriterType::HPV_WRITER_POSITIONAL;
+    hpv_params.resume = p.exist("resume");
+    hpv_params.streaming = p.get<int>("watch") > 0;
+
+    hpv_params.numa_affinity = p.exist("numa");
+    hpv_params.early_start = p.exist("early-start");
+
+    if (!p.get<std::string>("max-mem").empty())
+    {
+        hpv_params.max_memory = parse_size(p.get<std::string>("max-mem"));
+        if (hpv_params.max_memory == 0)
+        {
+            HPV_ERROR("Invalid --max-mem %s, expecting e.g. 16G", p.get<std::string>("max-mem").c_str());
+            return false;
+        }
+    }
+
+    if (!p.get<std::string>("stages").empty())
+    {
+        int counts[HPV_NUM_STAGES] = { 0 };
+        if (sscanf(p.get<std::string>("stages").c_str(), "%d,%d,%d,%d", &counts[HPV_STAGE_LOAD], &counts[HPV_STAGE_CONVERT], &counts[HPV_STAGE_DXT], &counts[HPV_STAGE_LZ4]) != HPV_NUM_STAGES)
+        {
+            HPV_ERROR("--stages needs %d comma separated worker counts", HPV_NUM_STAGES);
+            return false;
+        }
+
+        for (int stage = 0; stage < HPV_NUM_STAGES; ++stage)
+        {
+            hpv_params.stage_threads[stage] = static_cast<uint8_t>(std::min(255, std::max(1, counts[stage])));
+        }
+    }
+
+    json_progress = p.get<std::string>("progress") == "json";
+    hpv_params.segment = p.exist("segment");
+    hpv_params.share_held_frames = p.exist("share-held");
+    hpv_params.store_raw_below = static_cast<uint8_t>(std::min(100, std::max(0, p.get<int>("store-raw"))));
+
+    // oneof() already checked the name, stb is the scalar level
+    HPVSimdLevel dxt_level = HPV_SIMD_SCALAR;
+    std::string dxt = p.get<std::string>("dxt");
+    hpv_params.dxt_level = (dxt == "stb" || hpv_simd_from_name(dxt.c_str(), dxt_level)) ? static_cast<int8_t>(dxt_level) : -1;
+
+    if (!p.get<std::string>("outputs").empty() && !parse_outputs(p.get<std::string>("outputs"), hpv_params.extra_outputs))
+    {
+        return false;
+    }
+
+    // merging doesn't encode anything
+    if (!p.get<std::string>("merge").empty())
+    {
+        return true;
+    }
+
+    // the jobs of a batch bring their own paths, type and range
+    if (!p.get<std::string>("batch").empty())
+    {
+        if (hpv_params.streaming || !p.get<std::string>("raw").empty() || !hpv_params.extra_outputs.empty() ||
+            std::find(hpv_params.stage_threads, hpv_params.stage_threads + HPV_NUM_STAGES, 0) == hpv_params.stage_threads + HPV_NUM_STAGES)
+        {
+            HPV_ERROR("--batch can't be combined with --watch, --raw, --outputs or --stages");
+            return false;
+        }
+        return true;
+    }
+
+    // a Y4M stream has its own frame rate
+    bool raw = !p.get<std::string>("raw").empty();
+    if (!p.exist("in") || !p.exist("type") || (!p.exist("fps") && p.get<std::string>("raw") != "y4m"))
+    {
+        HPV_ERROR("--in, --fps and --type are required");
+        return false;
+    }
+
     hpv_params.in_path = p.get<std::string>("in");
     hpv_params.out_path = p.get<std::string>("out");
     hpv_params.fps = p.get<int>("fps");
@@ -99,8 +608,17 @@ static bool parse_params(const cmdline::parser& p)
     {
         hpv_params.type = HPVCompressionType::HPV_TYPE_DXT1_NO_ALPHA;
     }
-    hpv_params.num_threads = p.get<int>("threads");
-    
+
+    if (raw)
+    {
+        if (hpv_params.streaming)
+        {
+            HPV_ERROR("--raw can't be combined with --watch");
+            return false;
+        }
+        return open_raw_input(p);
+    }
+
     if ((planned_total = parse_in_path(hpv_params)) == 0)
     {
         HPV_ERROR("In path doesn't exist");
@@ -139,40 +657,399 @@ static bool parse_params(const cmdline::parser& p)
 }
 
 
-static bool parse_progress()
+static std::string json_string(const std::string& str)
 {
-    if (progress_sink.try_pop(progress))
+    std::stringstream ss;
+    ss << '"';
+    for (std::size_t i = 0; i < str.size(); ++i)
     {
-        switch (progress.state)
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        switch (c)
         {
-            case HPV_CREATOR_STATE_ERROR:
-                HPV_ERROR("%s", progress.done_item_name.c_str());
-                hpv_creator.stop();
-                return false;
-            case HPV_CREATOR_STATE_DONE:
-                HPV_VERBOSE("%s", progress.done_item_name.c_str());
-                hpv_creator.stop();
-                return false;
+            case '"': ss << "\\\""; break;
+            case '\\': ss << "\\\\"; break;
+            case '\n': ss << "\\n"; break;
+            case '\r': ss << "\\r"; break;
+            case '\t': ss << "\\t"; break;
             default:
+                if (c < 0x20)
+                    ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+                else
+                    ss << str[i];
+        }
+    }
+    ss << '"';
+    return ss.str();
+}
+
+/* --progress=json: one object per report, "event" is progress, done or error */
+static void print_json_progress(const HPVCompressionProgress& progress)
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+
+    if (progress.state == HPV_CREATOR_STATE_ERROR)
+    {
+        ss << "{\"event\":\"error\",\"message\":" << json_string(progress.done_item_name) << "}";
+    }
+    else
+    {
+        bool done = progress.state == HPV_CREATOR_STATE_DONE;
+        ss  << "{\"event\":" << (done ? "\"done\"" : "\"progress\"")
+            << ",\"frames_done\":" << progress.done_items
+            << ",\"frames_total\":" << progress.total_items
+            << ",\"frames_per_second\":" << progress.frames_per_second
+            << ",\"mb_per_second_in\":" << progress.read_bytes_per_second / (1024 * 1024)
+            << ",\"mb_per_second_out\":" << progress.bytes_per_second / (1024 * 1024)
+            << ",\"bytes_in\":" << progress.bytes_read
+            << ",\"bytes_out\":" << progress.bytes_written
+            << ",\"elapsed_seconds\":" << progress.elapsed_seconds
+            << ",\"eta_seconds\":";
+        if (progress.eta_seconds < 0)
+            ss << "null";
+        else
+            ss << progress.eta_seconds;
+
+        if (!done)
+        {
+            ss  << ",\"frame\":" << json_string(progress.done_item_name)
+                << ",\"deflated_to_percent\":" << progress.compression_ratio
+                << ",\"frame_ms\":{\"load\":" << progress.frame_ns[HPV_STAGE_LOAD] / 1e6
+                << ",\"convert\":" << progress.frame_ns[HPV_STAGE_CONVERT] / 1e6
+                << ",\"dxt\":" << progress.frame_ns[HPV_STAGE_DXT] / 1e6
+                << ",\"lz4\":" << progress.frame_ns[HPV_STAGE_LZ4] / 1e6 << "}"
+                << ",\"queued_for_workers\":" << progress.compression_queue_depth
+                << ",\"queued_for_writer\":" << progress.filestream_queue_depth;
+        }
+
+        ss  << ",\"total_seconds\":{\"load\":" << progress.times.busy_ns[HPV_STAGE_LOAD] / 1e9
+            << ",\"convert\":" << progress.times.busy_ns[HPV_STAGE_CONVERT] / 1e9
+            << ",\"dxt\":" << progress.times.busy_ns[HPV_STAGE_DXT] / 1e9
+            << ",\"lz4\":" << progress.times.busy_ns[HPV_STAGE_LZ4] / 1e9
+            << ",\"write\":" << progress.times.write_ns / 1e9
+            << ",\"idle\":" << progress.times.idle_ns / 1e9 << "}"
+            << ",\"workers\":" << progress.active_workers
+            << ",\"frame_buffer_allocations\":" << progress.frame_buffer_allocations;
+
+        if (done)
+        {
+            ss << ",\"summary\":" << json_string(progress.done_item_name);
+        }
+        ss << "}";
+    }
+
+    // the scheduler reading this wants every line as soon as it is there
+    fprintf(stdout, "%s\n", ss.str().c_str());
+    fflush(stdout);
+}
+
+/* Progress callback of the creator, runs on the encoder's threads */
+static void print_progress(const HPVCompressionProgress& progress)
+{
+    if (json_progress)
+    {
+        print_json_progress(progress);
+        return;
+    }
+
+    switch (progress.state)
+    {
+        case HPV_CREATOR_STATE_ERROR:
+            HPV_ERROR("%s", progress.done_item_name.c_str());
+            break;
+        case HPV_CREATOR_STATE_DONE:
+            HPV_VERBOSE("%s", progress.done_item_name.c_str());
+            break;
+        default:
+        {
+            std::stringstream ss;
+            int percent = static_cast<int>( (progress.done_items/(float)progress.total_items) * 100);
+            
+            ss  << "["
+            << percent
+            << "%]: "
+            << progress.done_item_name
+            << " [deflated to: "
+            << progress.compression_ratio
+            << "%] [frame buffer allocations: "
+            << progress.frame_buffer_allocations
+            << "] [frame ms load/convert/dxt/lz4: "
+            << progress.frame_ns[HPV_STAGE_LOAD] / 1e6 << "/"
+            << progress.frame_ns[HPV_STAGE_CONVERT] / 1e6 << "/"
+            << progress.frame_ns[HPV_STAGE_DXT] / 1e6 << "/"
+            << progress.frame_ns[HPV_STAGE_LZ4] / 1e6
+            << "] [total s load/convert/dxt/lz4/write/idle: "
+            << progress.times.busy_ns[HPV_STAGE_LOAD] / 1e9 << "/"
+            << progress.times.busy_ns[HPV_STAGE_CONVERT] / 1e9 << "/"
+            << progress.times.busy_ns[HPV_STAGE_DXT] / 1e9 << "/"
+            << progress.times.busy_ns[HPV_STAGE_LZ4] / 1e9 << "/"
+            << progress.times.write_ns / 1e9 << "/"
+            << progress.times.idle_ns / 1e9
+            << "] [queued for workers/writer: "
+            << progress.compression_queue_depth << "/"
+            << progress.filestream_queue_depth
+            << "] [workers: "
+            << progress.active_workers
+            << "] [read/written: "
+            << progress.read_bytes_per_second / (1024 * 1024) << "/"
+            << progress.bytes_per_second / (1024 * 1024)
+            << " MB/s] [";
+            if (progress.eta_seconds >= 0)
+                ss << "ETA " << progress.eta_seconds << " s, ";
+            ss << progress.frames_per_second << " frames/s]";
+            
+            HPV_VERBOSE("%s", ss.str().c_str());
+            break;
+        }
+    }
+}
+
+
+/******************************************************************************
+ * Batch mode.
+ ******************************************************************************/
+
+/* Interval at which --batch prints the progress of the whole batch */
+#define BATCH_REPORT_INTERVAL_MS 1000
+
+enum BatchJobState
+{
+    BATCH_JOB_WAITING,
+    BATCH_JOB_RUNNING,
+    BATCH_JOB_DONE,
+    BATCH_JOB_FAILED
+};
+
+struct BatchJob
+{
+    BatchJob() : state(BATCH_JOB_WAITING), done_frames(0), total_frames(0), last_percent(-1) {}
+
+    HPVCreatorParams params;
+    std::vector<std::string> file_names;
+    std::unique_ptr<HPVCreator> creator;
+    ThreadSafe_Queue<HPVCompressionProgress> progress_sink;
+    BatchJobState state;
+    uint32_t done_frames;
+    uint32_t total_frames;
+    int last_percent;
+    std::chrono::steady_clock::time_point start;
+};
+
+/*
+ * --batch manifest: one job per line, "<in path> <out path> <type> <fps> [<start frame> <end frame>]".
+ * Empty lines and lines starting with # are skipped. All other options apply to every job.
+ */
+static bool parse_manifest(const std::string& path, std::vector<std::unique_ptr<BatchJob>>& jobs)
+{
+    std::ifstream manifest(path.c_str());
+    if (!manifest.is_open())
+    {
+        HPV_ERROR("Couldn't open batch manifest %s", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    int line_nr = 0;
+    while (std::getline(manifest, line))
+    {
+        ++line_nr;
+
+        std::istringstream fields(line);
+        std::string in_path;
+        if (!(fields >> in_path) || in_path[0] == '#')
+            continue;
+
+        std::unique_ptr<BatchJob> job(new BatchJob());
+        job->params = hpv_params;
+
+        int type = 0;
+        int fps = 0;
+        if (!(fields >> job->params.out_path >> type >> fps) || type < 0 || type >= static_cast<int>(HPVCompressionType::HPV_NUM_TYPES) || fps <= 0 || fps > 255)
+        {
+            HPV_ERROR("%s:%d: expecting <in path> <out path> <type> <fps> [<start frame> <end frame>]", path.c_str(), line_nr);
+            return false;
+        }
+
+        job->params.in_path = in_path;
+        job->params.type = static_cast<HPVCompressionType>(type);
+        job->params.fps = static_cast<uint8_t>(fps);
+
+        uint32_t count = list_in_path(in_path, job->file_names);
+        if (count == 0)
+        {
+            HPV_ERROR("%s:%d: in path %s has no frames", path.c_str(), line_nr, in_path.c_str());
+            return false;
+        }
+
+        int in_frame = 0;
+        int out_frame = static_cast<int>(count) - 1;
+        if ((fields >> in_frame) && !(fields >> out_frame))
+        {
+            HPV_ERROR("%s:%d: a start frame needs an end frame", path.c_str(), line_nr);
+            return false;
+        }
+        job->params.in_frame = static_cast<uint32_t>(std::max(0, in_frame));
+        job->params.out_frame = static_cast<uint32_t>(std::max(0, out_frame));
+        job->total_frames = job->params.out_frame >= job->params.in_frame ? job->params.out_frame - job->params.in_frame + 1 : 0;
+
+        jobs.push_back(std::move(job));
+    }
+
+    if (jobs.empty())
+    {
+        HPV_ERROR("Batch manifest %s has no jobs", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void start_job(BatchJob& job, std::size_t idx, std::size_t num_jobs)
+{
+    job.params.file_names = &job.file_names;
+    job.creator.reset(new HPVCreator());
+    job.start = std::chrono::steady_clock::now();
+    job.state = BATCH_JOB_RUNNING;
+
+    HPV_VERBOSE("[job %zu/%zu] %s -> %s: %d frames", idx + 1, num_jobs, job.params.in_path.c_str(), job.params.out_path.c_str(), job.total_frames);
+
+    if (job.creator->init(job.params, &job.progress_sink) == HPV_RET_ERROR ||
+        job.creator->process_sequence(job.params.num_threads) == HPV_RET_ERROR)
+    {
+        job.state = BATCH_JOB_FAILED;
+    }
+}
+
+/* Handles the job's progress reports, returns false once it's done or failed */
+static bool poll_job(BatchJob& job, std::size_t idx, std::size_t num_jobs)
+{
+    HPVCompressionProgress job_progress;
+    while (job.progress_sink.try_pop(job_progress))
+    {
+        if (job_progress.state == HPV_CREATOR_STATE_ERROR)
+        {
+            HPV_ERROR("[job %zu/%zu] %s: %s", idx + 1, num_jobs, job.params.in_path.c_str(), job_progress.done_item_name.c_str());
+            job.state = BATCH_JOB_FAILED;
+        }
+        else if (job_progress.state == HPV_CREATOR_STATE_DONE)
+        {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.start).count();
+            HPV_VERBOSE("[job %zu/%zu] %s done in %.2f seconds, %.1f frames/s", idx + 1, num_jobs, job.params.out_path.c_str(), seconds, job.done_frames / seconds);
+            job.state = BATCH_JOB_DONE;
+        }
+        else
+        {
+            job.done_frames = static_cast<uint32_t>(job_progress.done_items);
+
+            // one line per 10% per job, a frame by frame log of hundreds of clips is unreadable
+            int percent = static_cast<int>((job_progress.done_items / (float)job_progress.total_items) * 10) * 10;
+            if (percent != job.last_percent)
             {
-                std::stringstream ss;
-                int percent = static_cast<int>( (progress.done_items/(float)progress.total_items) * 100);
-                
-                ss  << "["
-                << percent
-                << "%]: "
-                << progress.done_item_name
-                << " [deflated to: "
-                << progress.compression_ratio
-                << "%]";
-                
-                HPV_VERBOSE("%s", ss.str().c_str());
-                return true;
+                job.last_percent = percent;
+                HPV_VERBOSE("[job %zu/%zu] %s: %d%% (%d/%d frames)", idx + 1, num_jobs, job.params.in_path.c_str(), percent, job_progress.done_items, job_progress.total_items);
             }
         }
+
+        if (job.state != BATCH_JOB_RUNNING)
+            break;
     }
-    
-    return true;
+
+    if (job.state == BATCH_JOB_RUNNING)
+        return true;
+
+    // joins the coordinator, none of the job's tasks are left on the pool after this
+    job.creator->stop();
+    job.creator.reset();
+    return false;
+}
+
+/*
+ * --batch: all jobs share one worker pool. Jobs start in manifest order, a new one only when the
+ * pool has no frames waiting and the job started last is past its first frame. Small clips
+ * that can't keep every worker busy are then packed together, while a big job keeps the
+ * pool to itself.
+ */
+static int run_batch(const std::string& manifest, int max_jobs)
+{
+    // declared before the jobs, so it outlives their creators
+    HPVTaskScheduler pool;
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+
+    if (!parse_manifest(manifest, jobs))
+        return 1;
+
+    unsigned int available = std::min(hpv_available_cpus(), 255u);
+    unsigned int num_threads = hpv_params.num_threads == HPV_CONCURRENCY_AUTO ? available : std::min<unsigned int>(hpv_params.num_threads, available);
+    if (hpv_params.numa_affinity)
+    {
+        pool.set_affinity(hpv_numa_nodes());
+    }
+    pool.set_workers(num_threads);
+
+    if (max_jobs <= 0)
+        max_jobs = static_cast<int>(num_threads);
+
+    uint64_t total_frames = 0;
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        jobs[i]->params.worker_pool = &pool;
+        total_frames += jobs[i]->total_frames;
+    }
+
+    HPV_VERBOSE("Batch of %zu jobs, %llu frames on %d workers, at most %d jobs at a time", jobs.size(), (unsigned long long)total_frames, num_threads, max_jobs);
+
+    std::size_t next_job = 0;
+    std::size_t finished = 0;
+    std::size_t failed = 0;
+    std::vector<std::size_t> running;
+    std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_report = batch_start;
+
+    while (finished < jobs.size())
+    {
+        // at most one new job per round, it needs a moment to fill the pool
+        bool last_started = running.empty() || jobs[running.back()]->done_frames > 0;
+        if (next_job < jobs.size() && last_started &&
+            (running.empty() || (running.size() < static_cast<std::size_t>(max_jobs) && pool.pending() == 0)))
+        {
+            start_job(*jobs[next_job], next_job, jobs.size());
+            running.push_back(next_job);
+            ++next_job;
+        }
+
+        for (std::size_t i = 0; i < running.size(); )
+        {
+            BatchJob& job = *jobs[running[i]];
+            if (poll_job(job, running[i], jobs.size()))
+            {
+                ++i;
+                continue;
+            }
+
+            failed += (job.state == BATCH_JOB_FAILED) ? 1 : 0;
+            ++finished;
+            running.erase(running.begin() + i);
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::milliseconds(BATCH_REPORT_INTERVAL_MS) || finished == jobs.size())
+        {
+            uint64_t done_frames = 0;
+            for (std::size_t i = 0; i < jobs.size(); ++i)
+            {
+                done_frames += jobs[i]->done_frames;
+            }
+
+            double seconds = std::chrono::duration<double>(now - batch_start).count();
+            HPV_VERBOSE("[batch] %zu/%zu jobs done, %zu running, %zu failed, %llu/%llu frames, %.1f frames/s",
+                        finished, jobs.size(), running.size(), failed, (unsigned long long)done_frames, (unsigned long long)total_frames, done_frames / seconds);
+            last_report = now;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return failed > 0 ? 1 : 0;
 }
 
 
@@ -189,17 +1066,70 @@ int main(int argc, char *argv[])
     
     setup_parser(p);
     p.parse_check(argc, argv);
-    parse_params(p);
+    if (!parse_params(p))
+    {
+        return 1;
+    }
+
+    if (!p.get<std::string>("merge").empty())
+    {
+        std::string error;
+        if (hpv_merge(p.rest(), p.get<std::string>("merge"), error, p.exist("allow-gaps")) == HPV_RET_ERROR)
+        {
+            HPV_ERROR("%s", error.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!p.get<std::string>("batch").empty())
+    {
+        return run_batch(p.get<std::string>("batch"), p.get<int>("jobs"));
+    }
     
-    if (hpv_creator.init(hpv_params, &progress_sink) == HPV_RET_ERROR)
+    // progress arrives through the callback, this thread just waits for the end
+    hpv_creator.set_progress_callback(print_progress);
+    if (json_progress)
+    {
+        HPV::hpv_log_disable_stdout();
+    }
+
+    if (hpv_creator.init(hpv_params, nullptr) == HPV_RET_ERROR)
     {
-        parse_progress();
         return 1;
     }
     
     hpv_creator.process_sequence(hpv_params.num_threads);
+
+    std::thread watcher;
+    std::thread reader;
+    if (raw_source)
+    {
+        reader = std::thread(read_raw_input);
+    }
+    else if (hpv_params.streaming)
+    {
+        watching.store(true);
+        watcher = std::thread(watch_in_path, p.get<int>("watch"));
+    }
     
-    while (parse_progress()) {}
+    HPVCompressionProgress progress;
+    int ret = hpv_creator.wait(&progress);
+    hpv_creator.stop();
+
+    if (watcher.joinable())
+    {
+        watching.store(false);
+        watcher.join();
+    }
+
+    if (reader.joinable())
+    {
+        // after a failed encode the reader may still wait for input or for room in the source
+        raw_stop.store(true, std::memory_order_relaxed);
+        raw_source->close();
+        reader.join();
+    }
     
-    return 0;
+    return (ret == HPV_RET_ERROR_NONE) ? 0 : 1;
 }
@@ -97,6 +97,7 @@ namespace HPV {
         void            launchUpdateThread();
         void            update();
         bool            hasNewFrame();
+        bool            isHoldingFrame();
         void            resetPlayer();
         
         float           getPosition();
@@ -126,6 +127,9 @@ namespace HPV {
         size_t          _filesize;
         uint32_t *      _frame_sizes_table;
         uint64_t *      _frame_offsets_table;
+        uint32_t *      _frame_payload_table;       /* the frame whose payload a frame shows, itself unless it's a held frame */
+        int64_t         _loaded_payload;            /* payload in _frame_buffer, -1 when none */
+        std::atomic<bool> _holding_frame;          /* the current frame shows the payload that is already in _frame_buffer */
         size_t          _bytes_per_frame;
         uint64_t        _new_frame_time;
         uint64_t        _global_time_per_frame;
@@ -145,7 +149,7 @@ namespace HPV {
         
         unsigned char*  _frame_buffer;
         
-        void            populateFrameOffsets(uint32_t);
+        int             populateFrameOffsets(uint32_t);
         int             readCurrentFrame();
         
         ThreadSafe_Queue<HPVEvent> * _m_event_sink;
@@ -100,6 +100,9 @@ namespace HPV {
 
 		/* The current fill index (in case of using PBO) */
 		uint8_t tex_fill_index = 0;
+
+		/* A frame waits in a PBO for the next update to copy it to the texture */
+		bool pbo_pending = false;
 	};
 
 	/*
@@ -22,10 +22,14 @@ namespace HPV {
     , _gather_stats(false)
     , _m_event_sink(nullptr)
     , _frame_sizes_table(nullptr)
+    , _frame_offsets_table(nullptr)
+    , _frame_payload_table(nullptr)
+    , _loaded_payload(-1)
     {
         _should_update = false;
         _update_result.store(0, std::memory_order_relaxed);
         _was_seeked.store(false, std::memory_order_relaxed);
+        _holding_frame.store(false, std::memory_order_relaxed);
         _header.magic = 0;
         _header.version = 0;
         _header.video_width = 0;
@@ -33,6 +37,7 @@ namespace HPV {
         _header.number_of_frames = 0;
         _header.frame_rate = 0;
         _header.crc_frame_sizes = 0;
+        _header.flags = 0;
         _decode_stats.gpu_upload_time = 0;
         _decode_stats.hdd_read_time = 0;
         _decode_stats.l4z_decode_time = 0;
@@ -115,11 +120,26 @@ namespace HPV {
         // ready reading the header...save our position
         _num_bytes_in_header = static_cast<uint32_t>(_ifs.tellg());
         _num_bytes_in_sizes_table = _header.number_of_frames * sizeof(uint32_t);
+
+        // streamed encodes append the frame size table after the last frame
+        bool trailer_index = (_header.version >= HPV_VERSION_0_0_7) && (_header.flags & HPV_FLAG_TRAILER_INDEX);
+
+        if (trailer_index && _num_bytes_in_header + _num_bytes_in_sizes_table > _filesize)
+        {
+            HPV_ERROR("Frame sizes table doesn't fit in file, corrupt file")
+            return HPV_RET_ERROR;
+        }
         
         // read in frame size table and check crc
         _frame_sizes_table = new uint32_t[_header.number_of_frames];
         _frame_offsets_table = new uint64_t[_header.number_of_frames];
+        _frame_payload_table = new uint32_t[_header.number_of_frames];
         
+        if (trailer_index)
+        {
+            _ifs.seekg(_filesize - _num_bytes_in_sizes_table, std::ios_base::beg);
+        }
+
         _ifs.read((char *)_frame_sizes_table, _num_bytes_in_sizes_table);
         
         uint32_t crc = 0;
@@ -134,8 +154,12 @@ namespace HPV {
             return HPV_RET_ERROR;
         }
         
-        uint32_t start_offset = _num_bytes_in_header + _num_bytes_in_sizes_table;
-        this->populateFrameOffsets(start_offset);
+        uint32_t start_offset = trailer_index ? _num_bytes_in_header : _num_bytes_in_header + _num_bytes_in_sizes_table;
+        if (!this->populateFrameOffsets(start_offset))
+        {
+            HPV_ERROR("Frame sizes table references a later frame, corrupt file")
+            return HPV_RET_ERROR;
+        }
         
         // calculate frame size in bytes from compression type
         _bytes_per_frame = _header.video_width * _header.video_height;
@@ -217,6 +241,14 @@ namespace HPV {
                 delete [] _frame_buffer;
                 _frame_buffer = nullptr;
             }
+
+            if (_frame_payload_table)
+            {
+                delete [] _frame_payload_table;
+                _frame_payload_table = nullptr;
+            }
+            _loaded_payload = -1;
+            _holding_frame.store(false, std::memory_order_relaxed);
             
             // clear out header
             memset(&_header, 0x00, HPV::amount_header_fields);
@@ -237,16 +269,35 @@ namespace HPV {
         return HPV_RET_ERROR_NONE;
     }
     
-    void HPVPlayer::populateFrameOffsets(uint32_t start_offset)
+    int HPVPlayer::populateFrameOffsets(uint32_t start_offset)
     {
+        // held frames (HPV_FLAG_SHARED_FRAMES) have no payload, they get the offset and size of
+        // the earlier frame they reference. Raw frames (HPV_FLAG_RAW_FRAMES) keep their flag in the size.
+        bool shared_frames = (_header.version >= HPV_VERSION_0_0_7) && (_header.flags & HPV_FLAG_SHARED_FRAMES);
+        bool raw_frames = (_header.version >= HPV_VERSION_0_0_7) && (_header.flags & HPV_FLAG_RAW_FRAMES);
         uint64_t offset_runner = (uint64_t)start_offset;
-        _frame_offsets_table[0] = offset_runner;
         
-        for (uint32_t frame_idx = 1; frame_idx < _header.number_of_frames; ++frame_idx)
+        for (uint32_t frame_idx = 0; frame_idx < _header.number_of_frames; ++frame_idx)
         {
-            offset_runner += _frame_sizes_table[frame_idx-1];
-            _frame_offsets_table[frame_idx] = offset_runner;
+            if (shared_frames && (_frame_sizes_table[frame_idx] & HPV_FRAME_REFERENCE))
+            {
+                uint32_t payload_idx = _frame_sizes_table[frame_idx] & ~HPV_FRAME_REFERENCE;
+                if (payload_idx >= frame_idx)
+                    return HPV_RET_ERROR;
+
+                _frame_payload_table[frame_idx] = _frame_payload_table[payload_idx];
+                _frame_sizes_table[frame_idx] = _frame_sizes_table[payload_idx];
+                _frame_offsets_table[frame_idx] = _frame_offsets_table[payload_idx];
+            }
+            else
+            {
+                _frame_payload_table[frame_idx] = frame_idx;
+                _frame_offsets_table[frame_idx] = offset_runner;
+                offset_runner += raw_frames ? (_frame_sizes_table[frame_idx] & ~HPV_FRAME_RAW) : _frame_sizes_table[frame_idx];
+            }
         }
+
+        return HPV_RET_ERROR_NONE;
     }
     
     inline int HPVPlayer::readCurrentFrame()
@@ -254,6 +305,15 @@ namespace HPV {
         static uint64_t _before_read, _before_decode;
         static uint64_t _after_read, _after_decode;
         
+        // a held frame shows what is in the frame buffer already: no read, decode or upload
+        if (_frame_payload_table[_curr_frame] == _loaded_payload)
+        {
+            _holding_frame.store(true, std::memory_order_relaxed);
+            _decode_stats.hdd_read_time = 0;
+            _decode_stats.l4z_decode_time = 0;
+            return HPV_RET_ERROR_NONE;
+        }
+
         if (_gather_stats)
         {
             _before_read = ns();
@@ -268,11 +328,44 @@ namespace HPV {
             return HPV_RET_ERROR;
         }
         
+        uint32_t frame_size = _frame_sizes_table[_curr_frame];
+        bool raw = (_header.version >= HPV_VERSION_0_0_7) && (_header.flags & HPV_FLAG_RAW_FRAMES) && (frame_size & HPV_FRAME_RAW);
+        if (raw)
+        {
+            frame_size &= ~HPV_FRAME_RAW;
+            if (frame_size != _bytes_per_frame)
+            {
+                HPV_ERROR("Raw frame %" PRId64 " has the wrong size", _curr_frame);
+                return HPV_RET_ERROR;
+            }
+
+            // stored without LZ4, it goes straight into the frame buffer
+            _ifs.read((char *)_frame_buffer, frame_size);
+
+            if (_gather_stats)
+            {
+                _decode_stats.hdd_read_time = ns() - _before_read;
+                _decode_stats.l4z_decode_time = 0;
+            }
+
+            if (!_ifs.good())
+            {
+                HPV_ERROR("Failed to read frame %" PRId64, _curr_frame);
+                return HPV_RET_ERROR;
+            }
+
+            _loaded_payload = _frame_payload_table[_curr_frame];
+            _holding_frame.store(false, std::memory_order_relaxed);
+            _update_result.store(1, std::memory_order_relaxed);
+
+            return HPV_RET_ERROR_NONE;
+        }
+        
         // create local buffer for storing L4Z compressed frame
-        char * _l4z_buffer = new char[ _frame_sizes_table[_curr_frame] ];
+        char * _l4z_buffer = new char[ frame_size ];
         
         // read L4Z data from disk into buffer
-        _ifs.read(_l4z_buffer, _frame_sizes_table[_curr_frame]);
+        _ifs.read(_l4z_buffer, frame_size);
         
         if (_gather_stats)
         {
@@ -310,6 +403,8 @@ namespace HPV {
         
         delete [] _l4z_buffer;
         
+        _loaded_payload = _frame_payload_table[_curr_frame];
+        _holding_frame.store(false, std::memory_order_relaxed);
         _update_result.store(1, std::memory_order_relaxed);
         
         return HPV_RET_ERROR_NONE;
@@ -793,6 +888,11 @@ namespace HPV {
             return false;
     }
     
+    bool HPVPlayer::isHoldingFrame()
+    {
+        return _holding_frame.load(std::memory_order_relaxed);
+    }
+    
     int HPVPlayer::enableStats(bool _enable)
     {
         _gather_stats = _enable;
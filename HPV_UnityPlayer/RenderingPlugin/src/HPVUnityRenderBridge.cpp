@@ -404,6 +404,27 @@ namespace HPV {
 			// get update flag for this player
 			bool should_update = update_flags[player_idx];
 
+			// A held frame has nothing new to upload. The PBO path is a frame behind though: the
+			// frame before the hold still waits in a PBO, so copy that one to the texture now.
+			if (!should_update && HPVRendererType::RENDERER_OPENGLCORE == m_Renderer && pbo_supported)
+			{
+				HPVRenderData& render_data = m_RenderData[player_idx];
+
+				if (!render_data.gpu_resources_need_init && render_data.opengl.pbo_pending && render_data.player->isHoldingFrame())
+				{
+					uint8_t pbo_filled_index = (render_data.opengl.tex_fill_index + 1) % 2;
+
+					glBindTexture(GL_TEXTURE_2D, render_data.opengl.tex);
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, render_data.opengl.pboIds[pbo_filled_index]);
+					glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, render_data.player->getWidth(), render_data.player->getHeight(), render_data.opengl.gl_format, static_cast<GLsizei>(render_data.player->getBytesPerFrame()), 0);
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					glBindTexture(GL_TEXTURE_2D, 0);
+
+					render_data.opengl.pbo_pending = false;
+					ReportGLError();
+				}
+			}
+
 			if (should_update)
 			{
 				// get specifics for this player
@@ -482,6 +503,7 @@ namespace HPV {
 						{
 							memcpy(ptr, render_data.player->getBufferPtr(), render_data.player->getBytesPerFrame());
 							glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+							render_data.opengl.pbo_pending = true;
 						}
 
 						glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);